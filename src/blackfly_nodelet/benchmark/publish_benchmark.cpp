@@ -0,0 +1,302 @@
+// Microbenchmarks of the per frame publish path, run on synthetic frames without a camera.
+// The stages that only need memory run anywhere, the ones that advertise topics need a running roscore
+// and are skipped without one. Results go to stdout, --benchmark_format=json or --benchmark_out=<file>
+// give machine readable output.
+//
+// Frame sizes are a 1440x1080 sensor at binning 1, 2 and 4, in Mono8 and BGR8.
+
+#include <vector>
+#include <string>
+#include <atomic>
+
+#include <benchmark/benchmark.h>
+
+#include <ros/ros.h>
+#include <ros/callback_queue.h>
+#include <ros/serialization.h>
+#include <sensor_msgs/Image.h>
+#include <sensor_msgs/CameraInfo.h>
+#include <sensor_msgs/fill_image.h>
+#include <sensor_msgs/image_encodings.h>
+#include <image_transport/image_transport.h>
+#include <camera_info_manager/camera_info_manager.h>
+
+#include "synthetic_camera.h"
+#include "message_pool.h"
+
+#define BENCH_SENSOR_WIDTH 1440
+#define BENCH_SENSOR_HEIGHT 1080
+
+namespace
+{
+
+// only created when a master is running
+ros::NodeHandle *g_nh_ptr = nullptr;
+ros::CallbackQueue g_queue;
+std::atomic<uint64_t> g_received(0);
+
+void count_image(const sensor_msgs::ImageConstPtr &)
+{
+	g_received++;
+}
+
+// one synthetic frame of the format (0 Mono8, 1 BGR8) and binning in state.range
+struct bench_frame
+{
+	bench_frame(const benchmark::State &state)
+	{
+		bool color = state.range(0) == 1;
+		int binning = int(state.range(1));
+		width = BENCH_SENSOR_WIDTH / binning;
+		height = BENCH_SENSOR_HEIGHT / binning;
+		stride = width * (color ? 3 : 1);
+		format = color ? PixelFormat_BGR8 : PixelFormat_Mono8;
+		encoding = color ? sensor_msgs::image_encodings::BGR8 : sensor_msgs::image_encodings::MONO8;
+		pool = boost::make_shared<SyntheticBufferPool>(4, size_t(stride) * height);
+		for (size_t b = 0; b < 4; b++)
+		{
+			uint8_t *buffer = pool->buffer(b);
+			for (size_t i = 0; i < pool->buffer_size(); i++)
+			{
+				buffer[i] = uint8_t(i);
+			}
+		}
+	}
+	size_t size() const
+	{
+		return size_t(stride) * height;
+	}
+	int width;
+	int height;
+	int stride;
+	PixelFormatEnums format;
+	std::string encoding;
+	boost::shared_ptr<SyntheticBufferPool> pool;
+};
+
+void frame_label(benchmark::State &state, const bench_frame &frame)
+{
+	state.SetLabel(std::string(frame.encoding) + " " + std::to_string(frame.width) + "x" + std::to_string(frame.height));
+}
+
+bool master_up(benchmark::State &state)
+{
+	if (g_nh_ptr == nullptr)
+	{
+		state.SkipWithError("no ROS master");
+		return false;
+	}
+	return true;
+}
+
+// the copy of the camera buffer into a pooled message, as ImageEventHandler does it
+void BM_FillImage(benchmark::State &state)
+{
+	bench_frame frame(state);
+	MessagePool<sensor_msgs::Image> pool(4);
+	size_t frame_size = frame.size();
+	pool.prepare([frame_size](sensor_msgs::Image &msg) { msg.data.resize(frame_size); });
+	for (auto _ : state)
+	{
+		sensor_msgs::Image::Ptr msg = pool.acquire();
+		sensor_msgs::fillImage(*msg, frame.encoding, frame.height, frame.width, frame.stride, frame.pool->buffer(0));
+		benchmark::DoNotOptimize(msg->data.data());
+	}
+	state.SetBytesProcessed(int64_t(state.iterations()) * int64_t(frame_size));
+	frame_label(state, frame);
+}
+
+// the cached CameraInfo copied into a pooled message, the per frame part of the camera info path
+void BM_CameraInfoCopy(benchmark::State &state)
+{
+	MessagePool<sensor_msgs::CameraInfo> pool(4);
+	sensor_msgs::CameraInfo cam_info;
+	cam_info.width = BENCH_SENSOR_WIDTH;
+	cam_info.height = BENCH_SENSOR_HEIGHT;
+	cam_info.distortion_model = "plumb_bob";
+	cam_info.D.resize(5, 0.01);
+	for (auto _ : state)
+	{
+		sensor_msgs::CameraInfo::Ptr msg = pool.acquire();
+		*msg = cam_info;
+		benchmark::DoNotOptimize(msg.get());
+	}
+}
+
+// the once a second refresh from the camera info manager, which locks and copies under the manager's mutex
+void BM_CameraInfoManager(benchmark::State &state)
+{
+	if (!master_up(state))
+	{
+		return;
+	}
+	ros::NodeHandle nh(*g_nh_ptr, "bench_info");
+	camera_info_manager::CameraInfoManager manager(nh, "bench_info");
+	for (auto _ : state)
+	{
+		sensor_msgs::CameraInfo cam_info = manager.getCameraInfo();
+		benchmark::DoNotOptimize(cam_info.height);
+	}
+}
+
+// an exposure end event matched to its frame id, with the event already there
+void BM_EventStampMatched(benchmark::State &state)
+{
+	DeviceEventHandler handler(CameraPtr(), 0.002);
+	uint64_t frame_id = 0;
+	ros::Time stamp;
+	for (auto _ : state)
+	{
+		handler.exposure_end(frame_id, int64_t(frame_id) * 1000);
+		benchmark::DoNotOptimize(handler.get_exposure_end(frame_id, stamp, false));
+		frame_id++;
+	}
+}
+
+// the newest event, for cameras without frame ids
+void BM_EventStampNewest(benchmark::State &state)
+{
+	DeviceEventHandler handler(CameraPtr(), 0.002);
+	uint64_t frame_id = 0;
+	for (auto _ : state)
+	{
+		handler.exposure_end(frame_id, int64_t(frame_id) * 1000);
+		benchmark::DoNotOptimize(handler.get_last_exposure_end());
+		frame_id++;
+	}
+}
+
+// what a subscriber in another process costs the publisher on top of the copy
+void BM_SerializeImage(benchmark::State &state)
+{
+	bench_frame frame(state);
+	sensor_msgs::Image msg;
+	sensor_msgs::fillImage(msg, frame.encoding, frame.height, frame.width, frame.stride, frame.pool->buffer(0));
+	for (auto _ : state)
+	{
+		ros::SerializedMessage serialized = ros::serialization::serializeMessage(msg);
+		benchmark::DoNotOptimize(serialized.num_bytes);
+	}
+	state.SetBytesProcessed(int64_t(state.iterations()) * int64_t(frame.size()));
+	frame_label(state, frame);
+}
+
+// publish of a shared pointer to a subscriber in the same process, delivered without serialisation
+void BM_PublishIntraProcess(benchmark::State &state)
+{
+	if (!master_up(state))
+	{
+		return;
+	}
+	bench_frame frame(state);
+	ros::Publisher pub = g_nh_ptr->advertise<sensor_msgs::Image>("bench_intra", 10);
+	ros::Subscriber sub = g_nh_ptr->subscribe("bench_intra", 10, count_image);
+	for (int i = 0; i < 200 && pub.getNumSubscribers() == 0; i++)
+	{
+		ros::WallDuration(0.01).sleep();
+	}
+	MessagePool<sensor_msgs::Image> pool(4);
+	size_t frame_size = frame.size();
+	pool.prepare([frame_size](sensor_msgs::Image &msg) { msg.data.resize(frame_size); });
+	sensor_msgs::Image::Ptr msg = pool.acquire();
+	sensor_msgs::fillImage(*msg, frame.encoding, frame.height, frame.width, frame.stride, frame.pool->buffer(0));
+	uint64_t received = g_received;
+	for (auto _ : state)
+	{
+		pub.publish(sensor_msgs::ImageConstPtr(msg));
+		g_queue.callAvailable();
+	}
+	state.counters["delivered"] = double(g_received - received) / double(state.iterations());
+	frame_label(state, frame);
+}
+
+// a synthetic frame through ImageEventHandler::handle_frame, stamping, copy, CameraInfo and publish to one
+// intra-process subscriber, on the calling thread as without a frame queue
+void BM_HandleFrame(benchmark::State &state)
+{
+	if (!master_up(state))
+	{
+		return;
+	}
+	bench_frame frame(state);
+	ros::NodeHandle nh(*g_nh_ptr, "bench_cam");
+	image_transport::ImageTransport it(nh);
+	image_transport::CameraPublisher cam_pub = it.advertiseCamera("image", 10);
+	ros::Subscriber sub = nh.subscribe("image", 10, count_image);
+	boost::shared_ptr<camera_info_manager::CameraInfoManager> cam_info_mgr = boost::make_shared<camera_info_manager::CameraInfoManager>(nh, "bench_cam");
+	for (int i = 0; i < 200 && cam_pub.getNumSubscribers() == 0; i++)
+	{
+		ros::WallDuration(0.01).sleep();
+	}
+	DeviceEventHandler device_handler(CameraPtr(), 0.002);
+	ImageEventHandler *handler = new ImageEventHandler("bench_cam", CameraPtr(), &cam_pub, cam_info_mgr, &device_handler, false);
+	uint64_t frame_id = 0;
+	uint64_t received = g_received;
+	for (auto _ : state)
+	{
+		size_t index;
+		if (!frame.pool->take(index))
+		{
+			state.SkipWithError("synthetic buffers exhausted");
+			break;
+		}
+		frame_metadata metadata;
+		metadata.valid = true;
+		metadata.frame_id = frame_id;
+		device_handler.exposure_end(frame_id, int64_t(ros::Time::now().toNSec()));
+		handler->handle_frame(boost::make_shared<SyntheticFrame>(frame.pool, index, frame.format, frame.width, frame.height, frame.stride, false, metadata));
+		g_queue.callAvailable();
+		frame_id++;
+	}
+	state.counters["delivered"] = double(g_received - received) / double(state.iterations());
+	state.SetBytesProcessed(int64_t(state.iterations()) * int64_t(frame.size()));
+	frame_label(state, frame);
+	delete handler;
+}
+
+// Mono8 and BGR8 at binning 1, 2 and 4
+void frame_sizes(benchmark::internal::Benchmark *bench)
+{
+	bench->ArgNames({"bgr", "binning"});
+	for (int color = 0; color <= 1; color++)
+	{
+		for (int binning = 1; binning <= 4; binning *= 2)
+		{
+			bench->Args({color, binning});
+		}
+	}
+}
+
+BENCHMARK(BM_FillImage)->Apply(frame_sizes);
+BENCHMARK(BM_CameraInfoCopy);
+BENCHMARK(BM_CameraInfoManager);
+BENCHMARK(BM_EventStampMatched);
+BENCHMARK(BM_EventStampNewest);
+BENCHMARK(BM_SerializeImage)->Apply(frame_sizes);
+BENCHMARK(BM_PublishIntraProcess)->Apply(frame_sizes);
+BENCHMARK(BM_HandleFrame)->Apply(frame_sizes);
+
+} // namespace
+
+int main(int argc, char **argv)
+{
+	ros::init(argc, argv, "blackfly_publish_benchmark", ros::init_options::AnonymousName | ros::init_options::NoSigintHandler);
+	benchmark::Initialize(&argc, argv);
+	if (benchmark::ReportUnrecognizedArguments(argc, argv))
+	{
+		return 1;
+	}
+	if (ros::master::check())
+	{
+		g_nh_ptr = new ros::NodeHandle("~");
+		g_nh_ptr->setCallbackQueue(&g_queue);
+	}
+	else
+	{
+		ROS_WARN("Blackfly Benchmark: No ROS master, skipping the benchmarks that advertise topics");
+	}
+	benchmark::RunSpecifiedBenchmarks();
+	delete g_nh_ptr;
+	ros::shutdown();
+	return 0;
+}
@@ -0,0 +1,359 @@
+// Soak and scaling harness: how many cameras at what rate one host carries.
+// For every combination of camera_counts x subscriber_counts it loads a blackfly_nodelet with that many synthetic
+// cameras into this process, subscribes the given number of subscribers to every camera and measures, after a warmup,
+// throughput, frames lost end to end, exposure end to subscriber latency and the CPU the process used.
+// The subscribers are in process like any nodelet consumer, so they get the published messages without serialisation.
+// Synthetic cameras seed their generators from their names and the whole sweep comes from the parameters, a run
+// with the same parameters on the same host repeats the same load. See launch/soak.launch.
+
+#include <vector>
+#include <string>
+#include <atomic>
+#include <mutex>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <thread>
+#include <cstring>
+#include <cstdlib>
+#include <algorithm>
+
+#include <sys/resource.h>
+#include <sys/utsname.h>
+
+#include <ros/ros.h>
+#include <nodelet/loader.h>
+#include <sensor_msgs/Image.h>
+#include <diagnostic_msgs/DiagnosticArray.h>
+
+#include "latency_histogram.h"
+
+namespace
+{
+
+struct soak_config
+{
+	std::vector<int> camera_counts;
+	std::vector<int> subscriber_counts;
+	int width = 1440;
+	int height = 1080;
+	std::string pixel_format = "mono8";
+	double fps = 30.0;
+	// seconds before and of each measurement
+	double warmup = 3.0;
+	double duration = 20.0;
+	int queue_depth = 0;
+	int worker_threads = 0;
+	bool zero_copy = false;
+	double jitter = 0.0;
+	// threads delivering to the subscribers, 0 for one per core
+	int subscriber_threads = 0;
+	std::string output = "";
+};
+
+struct soak_result
+{
+	soak_result() : cameras(0), subscribers(0), throughput_fps(0.0), received(0), lost(0), loss_rate(0.0), source_underruns(0), cpu_cores(0.0) {}
+	int cameras;
+	int subscribers;
+	double throughput_fps;
+	uint64_t received;
+	uint64_t lost;
+	double loss_rate;
+	uint64_t source_underruns;
+	latency_summary latency;
+	double cpu_cores;
+};
+
+// counters of one subscription, callbacks of one subscriber never run concurrently
+class soak_subscriber
+{
+	public:
+		soak_subscriber(LatencyHistogram *p_latency_ptr, std::atomic<bool> *p_measuring_ptr)
+			: m_latency_ptr(p_latency_ptr), m_measuring_ptr(p_measuring_ptr), m_received(0), m_lost(0), m_have_last(false), m_last_id(0) {}
+		void callback(const sensor_msgs::ImageConstPtr &msg)
+		{
+			ros::Time now = ros::Time::now();
+			// synthetic cameras write their frame counter into the first bytes of every frame
+			uint64_t frame_id = 0;
+			std::memcpy(&frame_id, msg->data.data(), std::min(sizeof(frame_id), msg->data.size()));
+			bool measuring = m_measuring_ptr->load();
+			if (measuring)
+			{
+				m_received++;
+				if (m_have_last && frame_id > m_last_id + 1)
+				{
+					m_lost += frame_id - m_last_id - 1;
+				}
+				m_latency_ptr->record(int64_t(now.toNSec()) - int64_t(msg->header.stamp.toNSec()));
+			}
+			m_have_last = true;
+			m_last_id = frame_id;
+		}
+		uint64_t received() const
+		{
+			return m_received;
+		}
+		uint64_t lost() const
+		{
+			return m_lost;
+		}
+
+	private:
+		LatencyHistogram *m_latency_ptr;
+		std::atomic<bool> *m_measuring_ptr;
+		std::atomic<uint64_t> m_received;
+		std::atomic<uint64_t> m_lost;
+		bool m_have_last;
+		uint64_t m_last_id;
+};
+
+// sums one counter over all camera statuses of the newest ~stats message
+class stats_listener
+{
+	public:
+		void callback(const diagnostic_msgs::DiagnosticArrayConstPtr &msg)
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			m_stats = *msg;
+		}
+		uint64_t sum(const std::string &key)
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			uint64_t total = 0;
+			for (size_t s = 0; s < m_stats.status.size(); s++)
+			{
+				for (size_t v = 0; v < m_stats.status[s].values.size(); v++)
+				{
+					if (m_stats.status[s].values[v].key == key)
+					{
+						total += std::strtoull(m_stats.status[s].values[v].value.c_str(), nullptr, 10);
+					}
+				}
+			}
+			return total;
+		}
+
+	private:
+		std::mutex m_mutex;
+		diagnostic_msgs::DiagnosticArray m_stats;
+};
+
+double process_cpu_seconds()
+{
+	struct rusage usage;
+	getrusage(RUSAGE_SELF, &usage);
+	return usage.ru_utime.tv_sec + usage.ru_utime.tv_usec * 1e-6 + usage.ru_stime.tv_sec + usage.ru_stime.tv_usec * 1e-6;
+}
+
+// the parameters of a blackfly_nodelet with num_cameras synthetic cameras
+void set_nodelet_params(const std::string &name, const soak_config &config, int num_cameras)
+{
+	std::vector<std::string> names;
+	std::vector<std::string> serials;
+	std::vector<std::string> info_paths;
+	std::vector<std::string> backends;
+	std::vector<std::string> pixel_formats;
+	for (int i = 0; i < num_cameras; i++)
+	{
+		names.push_back("soak_cam_" + std::to_string(i));
+		serials.push_back("synthetic_" + std::to_string(i));
+		info_paths.push_back("");
+		backends.push_back("synthetic");
+		pixel_formats.push_back(config.pixel_format);
+	}
+	std::vector<bool> flags_off(num_cameras, false);
+	std::vector<double> fps(num_cameras, config.fps);
+	std::vector<double> exposure(num_cameras, 5000.0);
+	std::vector<double> ones(num_cameras, 1.0);
+	std::vector<int> int_ones(num_cameras, 1);
+	std::vector<int> zeros(num_cameras, 0);
+	ros::param::set(name + "/camera_names", names);
+	ros::param::set(name + "/camera_serial_nums", serials);
+	ros::param::set(name + "/camera_info_paths", info_paths);
+	ros::param::set(name + "/camera_backends", backends);
+	ros::param::set(name + "/pixel_formats", pixel_formats);
+	ros::param::set(name + "/mono_flags", std::vector<bool>(num_cameras, config.pixel_format == "mono8"));
+	ros::param::set(name + "/is_triggered_flags", flags_off);
+	ros::param::set(name + "/fps", fps);
+	ros::param::set(name + "/is_auto_exp_flags", flags_off);
+	ros::param::set(name + "/max_auto_exp", exposure);
+	ros::param::set(name + "/min_auto_exp", exposure);
+	ros::param::set(name + "/fixed_exp", exposure);
+	ros::param::set(name + "/auto_gains", flags_off);
+	ros::param::set(name + "/gains", ones);
+	ros::param::set(name + "/max_gains", ones);
+	ros::param::set(name + "/min_gains", ones);
+	ros::param::set(name + "/enable_gamma", flags_off);
+	ros::param::set(name + "/gammas", ones);
+	ros::param::set(name + "/binnings", int_ones);
+	ros::param::set(name + "/binning_mode", zeros);
+	ros::param::set(name + "/lighting_mode", zeros);
+	ros::param::set(name + "/auto_exposure_priority", zeros);
+	// stamps stay the exposure end so the latency runs from there
+	ros::param::set(name + "/exp_comp_flags", flags_off);
+	ros::param::set(name + "/zero_copy_flags", std::vector<bool>(num_cameras, config.zero_copy));
+	ros::param::set(name + "/queue_depths", std::vector<int>(num_cameras, config.queue_depth));
+	ros::param::set(name + "/buffer_counts", zeros);
+	ros::param::set(name + "/synthetic_width", config.width);
+	ros::param::set(name + "/synthetic_height", config.height);
+	ros::param::set(name + "/synthetic_jitter", config.jitter);
+	ros::param::set(name + "/enable_dyn_reconf", false);
+	if (config.worker_threads > 0)
+	{
+		ros::param::set(name + "/worker_threads", config.worker_threads);
+	}
+}
+
+soak_result run_configuration(nodelet::Loader &loader, const soak_config &config, int num_cameras, int num_subscribers)
+{
+	soak_result result;
+	result.cameras = num_cameras;
+	result.subscribers = num_subscribers;
+	std::string name = "/blackfly_soak_" + std::to_string(num_cameras) + "x" + std::to_string(num_subscribers);
+	set_nodelet_params(name, config, num_cameras);
+	nodelet::M_string remappings;
+	nodelet::V_string my_argv;
+	if (!loader.load(name, "blackfly/blackfly_nodelet", remappings, my_argv))
+	{
+		ROS_FATAL("Blackfly Soak: Failed to load blackfly/blackfly_nodelet");
+		ros::param::del(name);
+		return result;
+	}
+
+	ros::NodeHandle nh;
+	LatencyHistogram latency;
+	std::atomic<bool> measuring(false);
+	std::vector<soak_subscriber *> subscribers;
+	std::vector<ros::Subscriber> subscriptions;
+	for (int c = 0; c < num_cameras; c++)
+	{
+		std::string cam_name = "soak_cam_" + std::to_string(c);
+		for (int s = 0; s < num_subscribers; s++)
+		{
+			soak_subscriber *subscriber = new soak_subscriber(&latency, &measuring);
+			subscribers.push_back(subscriber);
+			subscriptions.push_back(nh.subscribe(cam_name + "/" + cam_name, 10, &soak_subscriber::callback, subscriber));
+		}
+	}
+	stats_listener stats;
+	ros::Subscriber stats_sub = nh.subscribe(name + "/stats", 1, &stats_listener::callback, &stats);
+
+	ros::WallDuration(config.warmup).sleep();
+	uint64_t underruns_begin = stats.sum("synthetic_underruns");
+	double cpu_begin = process_cpu_seconds();
+	ros::WallTime begin = ros::WallTime::now();
+	measuring = true;
+	ros::WallDuration(config.duration).sleep();
+	measuring = false;
+	double elapsed = (ros::WallTime::now() - begin).toSec();
+	double cpu = process_cpu_seconds() - cpu_begin;
+	// the next stats message covers the end of the window
+	ros::WallDuration(1.1).sleep();
+	uint64_t underruns_end = stats.sum("synthetic_underruns");
+
+	result.received = 0;
+	result.lost = 0;
+	for (size_t i = 0; i < subscribers.size(); i++)
+	{
+		result.received += subscribers[i]->received();
+		result.lost += subscribers[i]->lost();
+	}
+	// frames one subscriber of one camera got per second
+	result.throughput_fps = subscribers.empty() ? 0.0 : result.received / double(subscribers.size()) / elapsed;
+	result.loss_rate = result.received + result.lost > 0 ? double(result.lost) / double(result.received + result.lost) : 0.0;
+	result.source_underruns = underruns_end - underruns_begin;
+	result.latency = latency.take();
+	result.cpu_cores = cpu / elapsed;
+
+	subscriptions.clear();
+	stats_sub.shutdown();
+	loader.unload(name);
+	ros::param::del(name);
+	for (size_t i = 0; i < subscribers.size(); i++)
+	{
+		delete subscribers[i];
+	}
+	return result;
+}
+
+std::string host_description()
+{
+	struct utsname host;
+	uname(&host);
+	std::stringstream ss;
+	ss << host.nodename << " " << host.sysname << " " << host.release << " " << host.machine << ", " << std::thread::hardware_concurrency() << " cores";
+	return ss.str();
+}
+
+} // namespace
+
+int main(int argc, char **argv)
+{
+	ros::init(argc, argv, "blackfly_soak");
+	ros::NodeHandle pnh("~");
+	soak_config config;
+	if (!pnh.getParam("camera_counts", config.camera_counts))
+	{
+		config.camera_counts = {1, 2, 4};
+	}
+	if (!pnh.getParam("subscriber_counts", config.subscriber_counts))
+	{
+		config.subscriber_counts = {1};
+	}
+	pnh.getParam("width", config.width);
+	pnh.getParam("height", config.height);
+	pnh.getParam("pixel_format", config.pixel_format);
+	pnh.getParam("fps", config.fps);
+	pnh.getParam("warmup", config.warmup);
+	pnh.getParam("duration", config.duration);
+	pnh.getParam("queue_depth", config.queue_depth);
+	pnh.getParam("worker_threads", config.worker_threads);
+	pnh.getParam("zero_copy", config.zero_copy);
+	pnh.getParam("jitter", config.jitter);
+	pnh.getParam("subscriber_threads", config.subscriber_threads);
+	pnh.getParam("output", config.output);
+
+	ros::AsyncSpinner spinner(config.subscriber_threads);
+	spinner.start();
+	// the nodelets get their own callback threads from the loader
+	nodelet::Loader loader(false);
+
+	unsigned int cores = std::thread::hardware_concurrency();
+	std::stringstream report;
+	report << "# blackfly soak, " << host_description() << "\n";
+	report << "# " << config.width << "x" << config.height << " " << config.pixel_format << " at " << config.fps << " fps, warmup " << config.warmup
+			<< " s, duration " << config.duration << " s, queue_depth " << config.queue_depth << ", zero_copy " << config.zero_copy
+			<< ", jitter " << config.jitter << " s\n";
+	report << "cameras,subscribers,throughput_fps,received,lost,loss_rate,source_underruns,latency_p50_us,latency_p95_us,latency_p99_us,latency_max_us,"
+			<< "cpu_cores,cpu_per_camera,cpu_per_core_pct\n";
+	ROS_INFO("Blackfly Soak: %s", host_description().c_str());
+	for (size_t c = 0; c < config.camera_counts.size() && ros::ok(); c++)
+	{
+		for (size_t s = 0; s < config.subscriber_counts.size() && ros::ok(); s++)
+		{
+			int num_cameras = config.camera_counts[c];
+			int num_subscribers = config.subscriber_counts[s];
+			ROS_INFO("Blackfly Soak: %d cameras, %d subscribers each", num_cameras, num_subscribers);
+			soak_result result = run_configuration(loader, config, num_cameras, num_subscribers);
+			double cpu_per_camera = num_cameras > 0 ? result.cpu_cores / num_cameras : 0.0;
+			double cpu_per_core = cores > 0 ? 100.0 * result.cpu_cores / cores : 0.0;
+			report << result.cameras << "," << result.subscribers << "," << result.throughput_fps << "," << result.received << "," << result.lost << ","
+					<< result.loss_rate << "," << result.source_underruns << "," << result.latency.p50 << "," << result.latency.p95 << "," << result.latency.p99 << ","
+					<< result.latency.max << "," << result.cpu_cores << "," << cpu_per_camera << "," << cpu_per_core << "\n";
+			ROS_INFO("Blackfly Soak: %.1f fps per subscriber, %.4f%% lost, latency p50 %lu us p99 %lu us, %.2f cores (%.2f per camera, %.1f%% of the host)",
+						result.throughput_fps, 100.0 * result.loss_rate, (unsigned long)result.latency.p50, (unsigned long)result.latency.p99,
+						result.cpu_cores, cpu_per_camera, cpu_per_core);
+		}
+	}
+	std::cout << report.str();
+	if (!config.output.empty())
+	{
+		std::ofstream out(config.output.c_str());
+		out << report.str();
+		ROS_INFO("Blackfly Soak: Report written to %s", config.output.c_str());
+	}
+	spinner.stop();
+	ros::shutdown();
+	return 0;
+}
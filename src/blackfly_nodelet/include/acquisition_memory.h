@@ -0,0 +1,100 @@
+#ifndef ACQUISITION_MEMORY_
+#define ACQUISITION_MEMORY_
+#include <cstddef>
+#include <cstring>
+#include <cerrno>
+
+#include <sys/mman.h>
+
+#include <ros/ros.h>
+
+// One contiguous region per camera handed to spinnaker as user owned stream buffers.
+// It is allocated once at startup, backed by huge pages where possible, faulted in and locked,
+// so acquiring a frame never touches the allocator or takes a page fault.
+
+#define HUGE_PAGE_SIZE (2 * 1024 * 1024)
+// usb3 cameras need every stream buffer rounded up to the packet size or frames tear
+#define USB3_PACKET_SIZE 1024
+
+class AcquisitionMemory
+{
+	public:
+		AcquisitionMemory(size_t p_size) : m_data(nullptr), m_size(0), m_mapped_size(0), m_huge_pages(false), m_locked(false)
+		{
+			m_size = p_size;
+			m_mapped_size = ((p_size + HUGE_PAGE_SIZE - 1) / HUGE_PAGE_SIZE) * HUGE_PAGE_SIZE;
+			// explicit huge pages need vm.nr_hugepages reserved, MAP_POPULATE faults them in right away
+			void *data = mmap(nullptr, m_mapped_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB | MAP_POPULATE, -1, 0);
+			if (data != MAP_FAILED)
+			{
+				m_huge_pages = true;
+			}
+			else
+			{
+				// fall back to normal pages and ask for transparent huge pages instead
+				data = mmap(nullptr, m_mapped_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_POPULATE, -1, 0);
+				if (data == MAP_FAILED)
+				{
+					ROS_ERROR("Blackfly Nodelet: Failed to map %zu bytes of acquisition memory: %s", m_mapped_size, std::strerror(errno));
+					return;
+				}
+				madvise(data, m_mapped_size, MADV_HUGEPAGE);
+			}
+			m_data = data;
+			if (mlock(m_data, m_mapped_size) == 0)
+			{
+				m_locked = true;
+			}
+			else
+			{
+				ROS_WARN("Blackfly Nodelet: Failed to lock %zu bytes of acquisition memory: %s", m_mapped_size, std::strerror(errno));
+			}
+		}
+		~AcquisitionMemory()
+		{
+			if (m_data != nullptr)
+			{
+				if (m_locked)
+				{
+					munlock(m_data, m_mapped_size);
+				}
+				munmap(m_data, m_mapped_size);
+			}
+		}
+		bool valid() const
+		{
+			return m_data != nullptr;
+		}
+		void *data() const
+		{
+			return m_data;
+		}
+		// bytes requested, the mapping is rounded up to whole huge pages
+		size_t size() const
+		{
+			return m_size;
+		}
+		size_t mapped_size() const
+		{
+			return m_mapped_size;
+		}
+		// explicit huge pages, otherwise transparent huge pages were only requested
+		bool huge_pages() const
+		{
+			return m_huge_pages;
+		}
+		bool locked() const
+		{
+			return m_locked;
+		}
+
+	private:
+		AcquisitionMemory(const AcquisitionMemory &);
+		AcquisitionMemory &operator=(const AcquisitionMemory &);
+		void *m_data;
+		size_t m_size;
+		size_t m_mapped_size;
+		bool m_huge_pages;
+		bool m_locked;
+};
+#endif // ACQUISITION_MEMORY_
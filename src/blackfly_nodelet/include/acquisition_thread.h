@@ -0,0 +1,139 @@
+#ifndef ACQUISITION_THREAD_
+#define ACQUISITION_THREAD_
+#include <string>
+#include <thread>
+#include <atomic>
+#include <cstring>
+#include <cerrno>
+#include <chrono>
+#include <algorithm>
+
+#include <pthread.h>
+#include <sched.h>
+#include <sys/mman.h>
+
+#include <ros/ros.h>
+
+#include "Spinnaker.h"
+
+#include "image_event_handler.h"
+
+using namespace Spinnaker;
+
+// GetNextImage timeout, bounds how long stopping the thread takes [ms]
+#define ACQUISITION_POLL_TIMEOUT_MS 100
+// first wait after a failed GetNextImage, doubled on every further failure up to the poll timeout [ms]
+#define ACQUISITION_ERROR_BACKOFF_MS 1
+
+// Locks all current and future pages of the process in RAM so the acquisition path never takes a page fault.
+// Needs CAP_IPC_LOCK or a large enough memlock limit.
+inline bool lock_process_memory()
+{
+	if (mlockall(MCL_CURRENT | MCL_FUTURE) != 0)
+	{
+		ROS_WARN("Blackfly Nodelet: mlockall failed: %s", std::strerror(errno));
+		return false;
+	}
+	ROS_INFO("Blackfly Nodelet: Process memory locked");
+	return true;
+}
+
+// Pulls frames for one camera with GetNextImage on a dedicated thread instead of the spinnaker event thread,
+// so the thread can be pinned to a core and run with real-time priority.
+// Frames go through the same ImageEventHandler::OnImageEvent as in event mode.
+class AcquisitionThread
+{
+	public:
+		// cpu < 0 leaves the affinity alone, priority 0 keeps the default scheduler, otherwise SCHED_FIFO with that priority
+		AcquisitionThread(std::string p_cam_name, CameraPtr p_cam_ptr, ImageEventHandler *p_image_event_handler_ptr, int p_cpu, int p_priority)
+		{
+			m_cam_name = p_cam_name;
+			m_cam_ptr = p_cam_ptr;
+			m_image_event_handler_ptr = p_image_event_handler_ptr;
+			m_cpu = p_cpu;
+			m_priority = p_priority;
+			m_stop = false;
+		}
+		~AcquisitionThread()
+		{
+			stop();
+			m_cam_ptr = nullptr;
+		}
+		void start()
+		{
+			m_stop = false;
+			m_thread = std::thread(&AcquisitionThread::acquisition_loop, this);
+		}
+		// returns within one poll timeout, must be called before acquisition ends
+		void stop()
+		{
+			m_stop = true;
+			if (m_thread.joinable())
+			{
+				m_thread.join();
+			}
+		}
+
+	private:
+		void configure_thread()
+		{
+			// thread names are limited to 15 characters
+			std::string name = ("bf_" + m_cam_name).substr(0, 15);
+			pthread_setname_np(pthread_self(), name.c_str());
+			if (m_cpu >= 0)
+			{
+				cpu_set_t cpu_set;
+				CPU_ZERO(&cpu_set);
+				CPU_SET(m_cpu, &cpu_set);
+				int err = pthread_setaffinity_np(pthread_self(), sizeof(cpu_set), &cpu_set);
+				if (err != 0)
+				{
+					ROS_WARN("Blackfly Nodelet: Failed to pin acquisition thread of camera %s to cpu %d: %s", m_cam_name.c_str(), m_cpu, std::strerror(err));
+				}
+			}
+			if (m_priority > 0)
+			{
+				sched_param param;
+				param.sched_priority = m_priority;
+				int err = pthread_setschedparam(pthread_self(), SCHED_FIFO, &param);
+				if (err != 0)
+				{
+					ROS_WARN("Blackfly Nodelet: Failed to set SCHED_FIFO priority %d for camera %s: %s", m_priority, m_cam_name.c_str(), std::strerror(err));
+				}
+			}
+		}
+		void acquisition_loop()
+		{
+			configure_thread();
+			// a disconnected camera fails right away, without the wait the thread would spin, possibly at real-time priority
+			int backoff_ms = 0;
+			while (!m_stop)
+			{
+				ImagePtr image;
+				try
+				{
+					image = m_cam_ptr->GetNextImage(ACQUISITION_POLL_TIMEOUT_MS);
+				}
+				catch (Spinnaker::Exception &e)
+				{
+					if (e.GetError() != SPINNAKER_ERR_TIMEOUT)
+					{
+						ROS_ERROR_THROTTLE(1.0, "Blackfly Nodelet: GetNextImage failed on camera %s: %s", m_cam_name.c_str(), e.what());
+						backoff_ms = backoff_ms > 0 ? std::min(2 * backoff_ms, ACQUISITION_POLL_TIMEOUT_MS) : ACQUISITION_ERROR_BACKOFF_MS;
+						std::this_thread::sleep_for(std::chrono::milliseconds(backoff_ms));
+					}
+					continue;
+				}
+				backoff_ms = 0;
+				m_image_event_handler_ptr->OnImageEvent(image);
+			}
+		}
+		std::string m_cam_name;
+		CameraPtr m_cam_ptr;
+		ImageEventHandler *m_image_event_handler_ptr;
+		int m_cpu;
+		int m_priority;
+		std::atomic<bool> m_stop;
+		std::thread m_thread;
+};
+#endif // ACQUISITION_THREAD_
@@ -4,6 +4,10 @@
 #include <vector>
 #include <string>
 #include <time.h>
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <sys/stat.h>
 
 #include <ros/ros.h>
 
@@ -36,6 +40,8 @@
 #include <blackfly/BlackFlyConfig.h>
 
 #include "camera.h"
+#include "synthetic_camera.h"
+#include "stats.h"
 
 using namespace Spinnaker;
 using namespace Spinnaker::GenApi;
@@ -47,18 +53,35 @@ namespace blackfly
 class blackfly_nodelet : public nodelet::Nodelet
 {
 public:
-	blackfly_nodelet() : first_callback(true), Nodelet() {}
+	blackfly_nodelet() : first_callback(true), m_worker_pool_ptr(nullptr), m_frame_sync_ptr(nullptr), Nodelet() {}
 	~blackfly_nodelet();
 	virtual void onInit();
 	void callback_dyn_reconf(blackfly::BlackFlyConfig &config, uint32_t level);
+	bool callback_set_roi(blackfly::SetRoi::Request &request, blackfly::SetRoi::Response &response);
+	void publish_stats(const ros::TimerEvent &event);
 
 private:
 	void enable_chunk_data(INodeMap &cam_node_map);
+	camera_interface *start_camera(const camera_settings &settings, const std::string &serial, camera_startup_timing &timing);
+	void publish_startup_timings(ros::NodeHandle &pnh, const std::vector<camera_settings> &settings_vect, const std::vector<camera_startup_timing> &timings);
 	boost::shared_ptr<camera_info_manager::CameraInfoManager> c_info_mgr_ptr;
 	int numCameras;
 	SystemPtr system;
 	CameraList camList;
-	std::vector<blackfly_camera *> m_cam_vect;
+	std::vector<camera_interface *> m_cam_vect;
+	// indexed like camera_names, nullptr for cameras that failed to start
+	std::vector<camera_interface *> m_cam_by_id;
+	// shared by all cameras for the host side image processing
+	WorkerPool *m_worker_pool_ptr;
+	// gives the frames of one trigger pulse the same stamp on all triggered cameras, nullptr unless sync_triggered_cameras is set
+	FrameSynchronizer *m_frame_sync_ptr;
+	// DiagnosticArray with one status per camera, published once a second
+	ros::Publisher m_stats_pub;
+	ros::Timer m_stats_timer;
+	// per phase startup times of every camera, latched
+	ros::Publisher m_startup_pub;
+	// ~set_roi
+	ros::ServiceServer m_roi_srv;
 	bool first_callback;
 	// dynamic reconfigure
 	dynamic_reconfigure::Server<blackfly::BlackFlyConfig> *dr_srv;
@@ -1,13 +1,33 @@
+#ifndef CAMERA_
+#define CAMERA_
 #include <vector>
 #include <string>
 #include <ros/ros.h>
 #include <nodelet/nodelet.h>
 #include "Spinnaker.h"
+#include "camera_interface.h"
 #include "image_event_handler.h"
 #include "device_event_handler.h"
+#include "worker_pool.h"
+#include "demosaic.h"
+#include "clock_estimator.h"
+#include "acquisition_thread.h"
+#include "stats.h"
+#include "acquisition_memory.h"
+#include "user_set_cache.h"
+#include "node_cache.h"
+#include <std_msgs/Float64.h>
+#include <thread>
+#include <future>
+#include <condition_variable>
+#include <cmath>
+#include <algorithm>
+#include <sstream>
+#include <iomanip>
 #include <sensor_msgs/image_encodings.h>
 #include <image_transport/image_transport.h>
 #include <camera_info_manager/camera_info_manager.h>
+#include <blackfly/BlackFlyConfig.h>
 
 using namespace Spinnaker;
 
@@ -76,12 +96,186 @@ struct camera_settings
 	int lighting_mode;
 	int auto_exposure_priority;
 	bool exp_comp_flag;
+	// publish loaned spinnaker buffers on <cam_name>_loaned instead of copying them
+	bool zero_copy = false;
+	// "mono8", "bgr8", "bayer_rg8" or "bayer_rg16", empty selects mono8/bgr8 from the mono flag
+	std::string pixel_format = "";
+	// host side demosaic of bayer_rg8 frames published on <cam_name>_color
+	demosaic_method demosaic = DEMOSAIC_BILINEAR;
+	// stamp frames from the camera clock mapped to host time instead of the exposure end event arrival
+	bool device_clock = false;
+	// seconds between TimestampLatch observations of the camera clock
+	double clock_sync_period = 1.0;
+	// seconds an image waits for an exposure end event delivered after it
+	double event_match_tolerance = 0.002;
+	// pull frames with GetNextImage on a dedicated thread instead of the spinnaker image event
+	bool polling = false;
+	// core the polling thread is pinned to, -1 for no pinning
+	int acquisition_cpu = -1;
+	// SCHED_FIFO priority of the polling thread, 0 keeps the default scheduler
+	int acquisition_priority = 0;
+	// frames queued between the spinnaker callback and the worker pool, 0 converts and publishes on the callback thread
+	int queue_depth = 0;
+	queue_overflow_policy queue_overflow = QUEUE_DROP_OLDEST;
+	// stream buffers, 0 sizes them from fps * buffer_latency_budget under buffer_memory_cap
+	int buffer_count = 5;
+	// "NewestOnly", "OldestFirst" or "OldestFirstOverwrite", empty keeps the camera default
+	std::string buffer_handling_mode = "";
+	// seconds of frames the automatic buffer count holds
+	double buffer_latency_budget = 0.25;
+	// upper bound of the automatic buffer count [MB per camera]
+	double buffer_memory_cap = 256.0;
+	// stream buffers in a preallocated, locked and huge page backed region owned by the camera instead of spinnaker's allocator, opt in
+	bool user_buffers = false;
+	// load the camera configuration from user_set when it was saved from the same settings, otherwise write it and save it there
+	bool warm_start = false;
+	std::string user_set = "UserSet1";
+	// quality of the jpeg published on <cam_name>/compressed, 0 leaves compression to image_transport
+	int jpeg_quality = 0;
+	// slices one jpeg frame is split into across the worker pool, 0 uses every worker
+	int jpeg_slices = 0;
+	// directory the raw frames are recorded to, empty for no recording
+	std::string record_dir = "";
+	// frames waiting for the disk before new ones are left out of the recording
+	int record_slots = 16;
+	// bytes preallocated per segment file
+	uint64_t record_segment_size = 1024ULL * 1024 * 1024;
+	// publish the luminance of a colour camera on image_mono/image while it has subscribers
+	bool mono_output = false;
+	// publish image_half/image and image_quarter/image computed on the host, each while it has subscribers
+	bool pyramid = false;
+	// readout window in pixels at the configured binning, a width or height of 0 extends it to the sensor edge
+	int roi_offset_x = 0;
+	int roi_offset_y = 0;
+	int roi_width = 0;
+	int roi_height = 0;
+	// "spinnaker" for a camera found by serial, "synthetic" for generated frames
+	std::string backend = "spinnaker";
+	// resolution of the generated frames
+	int synthetic_width = 1440;
+	int synthetic_height = 1080;
+	// standard deviation of the generated frame timing [s]
+	double synthetic_jitter = 0.0;
+	// fractions of the generated frames lost before the host and delivered incomplete
+	double synthetic_drop_rate = 0.0;
+	double synthetic_incomplete_rate = 0.0;
 };
 
-class blackfly_camera
+// latches per clock observation, the one with the shortest round trip is kept
+#define CLOCK_LATCH_TRIES 5
+// the automatic buffer count never goes below this, loans and the frame queue need buffers besides the one being filled
+#define MIN_AUTO_BUFFER_COUNT 3
+// part of the settings hash, bump it whenever setup_camera writes something new so saved user sets are rewritten
+#define USER_SET_LAYOUT_VERSION 2
+
+// The topics of one camera and the image event handler feeding them, shared by every backend so a new output is wired in one place.
+// Backend specific parts, like device clock stamps or user owned buffer memory, are added to the handler by the camera.
+class CameraOutputs
+{
+public:
+	CameraOutputs()
+	{
+		m_image_transport_ptr = nullptr;
+	}
+	~CameraOutputs()
+	{
+		// the handler publishing on these topics is deleted by the camera before
+		delete m_image_transport_ptr;
+	}
+	// advertises every topic the settings ask for and loads the calibration
+	void advertise(const camera_settings &settings)
+	{
+		ros::NodeHandle nh(settings.cam_name);
+		m_image_transport_ptr = new image_transport::ImageTransport(nh);
+		if (settings.jpeg_quality > 0)
+		{
+			// the nodelet encodes the compressed topic itself, keep the image_transport plugin off it
+			std::vector<std::string> disabled_plugins(1, "image_transport/compressed");
+			nh.setParam(settings.cam_name + "/disable_pub_plugins", disabled_plugins);
+			m_jpeg_pub = nh.advertise<sensor_msgs::CompressedImage>(settings.cam_name + "/compressed", 10);
+		}
+		m_cam_pub = m_image_transport_ptr->advertiseCamera(settings.cam_name, 10);
+		m_metadata_pub = nh.advertise<blackfly::FrameMetadata>(settings.cam_name + "_metadata", 10);
+		if (settings.pixel_format == "bayer_rg8" && settings.demosaic != DEMOSAIC_NONE)
+		{
+			m_color_pub = m_image_transport_ptr->advertise(settings.cam_name + "_color", 10);
+		}
+		else if (settings.pixel_format == "bayer_rg16" && settings.demosaic != DEMOSAIC_NONE)
+		{
+			ROS_WARN("Blackfly Nodelet: Host demosaic only supports bayer_rg8, camera %s publishes the raw mosaic only", settings.cam_name.c_str());
+		}
+		m_cam_info_mgr_ptr = boost::make_shared<camera_info_manager::CameraInfoManager>(nh, settings.cam_name, settings.cam_info_path);
+		m_cam_info_mgr_ptr->loadCameraInfo(settings.cam_info_path);
+		if (settings.zero_copy)
+		{
+			m_loan_pub = nh.advertise<LoanedImage>(settings.cam_name + "_loaned", 10);
+		}
+		if (settings.mono_output)
+		{
+			m_mono_pub = m_image_transport_ptr->advertiseCamera("image_mono/image", 10);
+		}
+		if (settings.pyramid)
+		{
+			m_half_pub = m_image_transport_ptr->advertiseCamera("image_half/image", 10);
+			m_quarter_pub = m_image_transport_ptr->advertiseCamera("image_quarter/image", 10);
+		}
+	}
+	// Creates the image event handler with every output the settings enable. cam_ptr is empty for a backend without a
+	// spinnaker camera, worker_pool_ptr, recorder_ptr and frame_sync_ptr may be null.
+	ImageEventHandler *create_handler(const camera_settings &settings, CameraPtr cam_ptr, DeviceEventHandler *device_event_handler_ptr, unsigned int max_loans,
+										WorkerPool *worker_pool_ptr, FrameRecorder *recorder_ptr, FrameSynchronizer *frame_sync_ptr)
+	{
+		ImageEventHandler *handler_ptr = new ImageEventHandler(settings.cam_name, cam_ptr, &m_cam_pub, m_cam_info_mgr_ptr, device_event_handler_ptr, settings.exp_comp_flag,
+																settings.zero_copy ? &m_loan_pub : nullptr, max_loans);
+		handler_ptr->enable_metadata_output(&m_metadata_pub);
+		if (settings.pixel_format == "bayer_rg8" && settings.demosaic != DEMOSAIC_NONE)
+		{
+			handler_ptr->enable_color_output(&m_color_pub, settings.demosaic, worker_pool_ptr);
+		}
+		if (settings.queue_depth > 0 && worker_pool_ptr != nullptr)
+		{
+			handler_ptr->enable_frame_queue(settings.queue_depth, settings.queue_overflow, worker_pool_ptr);
+		}
+		if (settings.jpeg_quality > 0)
+		{
+			handler_ptr->enable_jpeg_output(&m_jpeg_pub, settings.jpeg_quality, settings.jpeg_slices, worker_pool_ptr);
+		}
+		if (recorder_ptr != nullptr)
+		{
+			handler_ptr->enable_recording(recorder_ptr);
+		}
+		if (frame_sync_ptr != nullptr)
+		{
+			handler_ptr->enable_frame_sync(frame_sync_ptr);
+		}
+		if (settings.mono_output)
+		{
+			handler_ptr->enable_mono_output(&m_mono_pub, worker_pool_ptr);
+		}
+		if (settings.pyramid)
+		{
+			handler_ptr->enable_pyramid_output(&m_half_pub, &m_quarter_pub, worker_pool_ptr);
+		}
+		return handler_ptr;
+	}
+
+private:
+	image_transport::ImageTransport *m_image_transport_ptr;
+	image_transport::CameraPublisher m_cam_pub;
+	image_transport::Publisher m_color_pub;
+	image_transport::CameraPublisher m_mono_pub;
+	image_transport::CameraPublisher m_half_pub;
+	image_transport::CameraPublisher m_quarter_pub;
+	ros::Publisher m_loan_pub;
+	ros::Publisher m_jpeg_pub;
+	ros::Publisher m_metadata_pub;
+	boost::shared_ptr<camera_info_manager::CameraInfoManager> m_cam_info_mgr_ptr;
+};
+
+class blackfly_camera : public camera_interface
 {
 public:
-	blackfly_camera(camera_settings settings, CameraPtr cam_ptr)
+	blackfly_camera(camera_settings settings, CameraPtr cam_ptr, WorkerPool *worker_pool_ptr = nullptr, FrameSynchronizer *frame_sync_ptr = nullptr)
 	{
 		// save the camera pointer and the settings object
 		m_cam_ptr = cam_ptr;
@@ -90,197 +284,1117 @@ public:
 		// create a new node handle
 		ros::NodeHandle nh(m_cam_settings.cam_name);
 
-		// setup ros image transport
-		m_image_transport_ptr = new image_transport::ImageTransport(nh);
-		m_cam_pub = m_image_transport_ptr->advertiseCamera(m_cam_settings.cam_name, 10);
-		m_cam_info_mgr_ptr = boost::make_shared<camera_info_manager::CameraInfoManager>(nh, m_cam_settings.cam_name, m_cam_settings.cam_info_path);
-		m_cam_info_mgr_ptr->loadCameraInfo(m_cam_settings.cam_info_path);
+		// setup the image topics
+		m_outputs.advertise(m_cam_settings);
+		if (m_cam_settings.device_clock)
+		{
+			m_clock_drift_pub = nh.advertise<std_msgs::Float64>(m_cam_settings.cam_name + "_clock_drift", 10);
+			m_clock_residual_pub = nh.advertise<std_msgs::Float64>(m_cam_settings.cam_name + "_clock_residual", 10);
+		}
 
-		// setup the camera
-		setup_camera();
+		// bring the camera up phase by phase, a failure leaves this camera stopped without affecting the others
+		m_image_event_handler_ptr = nullptr;
+		m_device_event_handler_ptr = nullptr;
+		m_acquisition_thread_ptr = nullptr;
+		m_node_cache_ptr = nullptr;
+		m_recorder_ptr = nullptr;
+		m_initialized = false;
+		m_image_event_registered = false;
+		m_device_event_registered = false;
+		m_acquiring = false;
+		m_clock_sync_stop = false;
+		m_control_stop = false;
+		m_config_pending = false;
+		// the generated config has no constructor, start from the cfg defaults so the first batch sees no stop or start edge by accident
+		m_applied_config = blackfly::BlackFlyConfig::__getDefault__();
+		m_applied_config.acquisition_stop = false;
+		m_applied_config.acquisition_start = false;
+		m_reconf_batches = 0;
+		m_reconf_last_us = 0;
+		m_reconf_max_us = 0;
+		m_acquisition_stopped = false;
+		m_roi_pending = false;
+		m_roi_changes = 0;
+		m_roi_last_gap_us = 0;
+		m_max_fps = 0.0;
+		m_stream_payload = 0;
+		ros::WallTime phase_start = ros::WallTime::now();
+		try
+		{
+			m_cam_ptr->Init();
+			m_initialized = true;
+			m_node_cache_ptr = new CameraNodeCache(m_cam_ptr);
+			m_startup_timing.init = lap(phase_start);
 
-		// create event handlers
-		m_device_event_handler_ptr = new DeviceEventHandler(m_cam_ptr);
-		m_image_event_handler_ptr = new ImageEventHandler(m_cam_settings.cam_name, m_cam_ptr, &m_cam_pub, m_cam_info_mgr_ptr, m_device_event_handler_ptr, m_cam_settings.exp_comp_flag);
+			// setup the camera, from the user set if it holds these settings already
+			if (m_cam_settings.warm_start && load_user_set())
+			{
+				m_startup_timing.warm_start = true;
+			}
+			else if (!setup_camera())
+			{
+				m_startup_timing.error = "camera settings incomplete";
+			}
+			else if (m_cam_settings.warm_start)
+			{
+				save_user_set();
+			}
+			// before the stream buffers, the chunks make every payload larger
+			setup_chunk_data();
+			setup_stream_buffers();
+			if (m_cam_settings.user_buffers)
+			{
+				setup_buffer_memory();
+			}
+			if (!m_cam_settings.record_dir.empty())
+			{
+				setup_recorder();
+			}
+			m_startup_timing.configure = lap(phase_start);
 
-		// register event handlers
-		m_cam_ptr->RegisterEvent(*m_device_event_handler_ptr);
-		m_cam_ptr->RegisterEvent(*m_image_event_handler_ptr);
+			// create event handlers
+			m_device_event_handler_ptr = new DeviceEventHandler(m_cam_ptr, m_cam_settings.event_match_tolerance);
+			// always leave a couple of buffers in the stream so the camera can keep acquiring while frames are on loan
+			unsigned int max_loans = m_buffer_count > 2 ? m_buffer_count - 2 : 1;
+			m_image_event_handler_ptr = m_outputs.create_handler(m_cam_settings, m_cam_ptr, m_device_event_handler_ptr, max_loans,
+																	worker_pool_ptr, m_recorder_ptr, frame_sync_ptr);
+			if (m_buffer_memory_ptr)
+			{
+				m_image_event_handler_ptr->hold_buffer_memory(m_buffer_memory_ptr);
+			}
+			if (m_cam_settings.device_clock)
+			{
+				m_image_event_handler_ptr->enable_device_clock_stamps(&m_clock_estimator);
+			}
+			window_changed();
 
-		m_cam_ptr->BeginAcquisition();
+			// register event handlers, in polling mode the acquisition thread hands the frames to the image event handler
+			m_cam_ptr->RegisterEvent(*m_device_event_handler_ptr);
+			m_device_event_registered = true;
+			if (m_cam_settings.polling)
+			{
+				m_acquisition_thread_ptr = new AcquisitionThread(m_cam_settings.cam_name, m_cam_ptr, m_image_event_handler_ptr,
+																	m_cam_settings.acquisition_cpu, m_cam_settings.acquisition_priority);
+			}
+			else
+			{
+				m_cam_ptr->RegisterEvent(*m_image_event_handler_ptr);
+				m_image_event_registered = true;
+			}
+			m_startup_timing.register_events = lap(phase_start);
+
+			// runtime ROI changes keep the stream running and have to fit into its buffers, read with everything that adds to the payload set
+			m_stream_payload = uint64_t(m_cam_ptr->PayloadSize.GetValue());
+			m_cam_ptr->BeginAcquisition();
+			m_acquiring = true;
+			if (m_acquisition_thread_ptr != nullptr)
+			{
+				m_acquisition_thread_ptr->start();
+			}
+			m_startup_timing.start = lap(phase_start);
+		}
+		catch (Spinnaker::Exception &ex)
+		{
+			m_startup_timing.error = ex.what();
+			ROS_ERROR("Blackfly Nodelet: Failed to start camera %s: %s", m_cam_settings.cam_name.c_str(), ex.what());
+			return;
+		}
+		m_startup_timing.ok = true;
+
+		// dynamic reconfigure batches are applied here, away from the dynamic reconfigure and image threads
+		m_control_thread = std::thread(&blackfly_camera::control_loop, this);
+
+		// keep observing the camera clock, frames fall back to event stamps until the estimator has enough samples
+		if (m_cam_settings.device_clock)
+		{
+			m_clock_sync_thread = std::thread(&blackfly_camera::clock_sync_loop, this);
+		}
 	}
 	~blackfly_camera()
 	{
-		if (m_cam_ptr->IsValid())
+		if (m_control_thread.joinable())
 		{
-			m_cam_ptr->EndAcquisition();
-			m_cam_ptr->UnregisterEvent(*m_image_event_handler_ptr);
-			m_cam_ptr->UnregisterEvent(*m_device_event_handler_ptr);
-			delete m_image_event_handler_ptr;
-			delete m_device_event_handler_ptr;
-			m_cam_ptr->DeInit();
-			std::free(user_buffer);
+			{
+				std::lock_guard<std::mutex> lock(m_control_mutex);
+				m_control_stop = true;
+			}
+			m_control_cond.notify_all();
+			m_control_thread.join();
 		}
+		if (m_clock_sync_thread.joinable())
+		{
+			{
+				std::lock_guard<std::mutex> lock(m_clock_sync_mutex);
+				m_clock_sync_stop = true;
+			}
+			m_clock_sync_cond.notify_all();
+			m_clock_sync_thread.join();
+		}
+		// undo whatever the constructor got to, a camera that failed half way is torn down the same way
+		try
+		{
+			// no new frames reach the handler from here on, by either the polling thread or the image event
+			if (m_acquisition_thread_ptr != nullptr)
+			{
+				m_acquisition_thread_ptr->stop();
+			}
+			if (m_image_event_registered)
+			{
+				m_cam_ptr->UnregisterEvent(*m_image_event_handler_ptr);
+				m_image_event_registered = false;
+			}
+			if (m_image_event_handler_ptr != nullptr)
+			{
+				// queued frames hold stream buffers, hand them back before acquisition ends
+				m_image_event_handler_ptr->flush_frame_queue();
+				m_image_event_handler_ptr->close_loans();
+			}
+			if (m_acquiring && m_cam_ptr->IsValid())
+			{
+				m_cam_ptr->EndAcquisition();
+			}
+			if (m_device_event_registered)
+			{
+				m_cam_ptr->UnregisterEvent(*m_device_event_handler_ptr);
+			}
+		}
+		catch (Spinnaker::Exception &ex)
+		{
+			ROS_ERROR("Blackfly Nodelet: Failed to stop camera %s: %s", m_cam_settings.cam_name.c_str(), ex.what());
+		}
+		delete m_acquisition_thread_ptr;
+		delete m_image_event_handler_ptr;
+		delete m_device_event_handler_ptr;
+		// writes out the frames still queued for the disk
+		delete m_recorder_ptr;
+		delete m_node_cache_ptr;
+		try
+		{
+			if (m_initialized && m_cam_ptr->IsValid())
+			{
+				m_cam_ptr->DeInit();
+			}
+		}
+		catch (Spinnaker::Exception &ex)
+		{
+			ROS_ERROR("Blackfly Nodelet: Failed to deinitialize camera %s: %s", m_cam_settings.cam_name.c_str(), ex.what());
+		}
+		m_cam_ptr = nullptr;
+		// the buffer memory is unmapped with the last owner, outstanding loans included
 	}
-	// This function sets the internal buffersize of spinnaker -> By default it allocates memory based on the frame rate of the camera.
-	// This may require very large memory when using multiple cameras, and may cause additional issues.
-	void set_buffer_size(unsigned int buff_size)
+	// true when the camera is acquiring
+	bool started() const
 	{
-		// Retrieve Stream Parameters device nodemap
-		Spinnaker::GenApi::INodeMap &sNodeMap = m_cam_ptr->GetTLStreamNodeMap();
-		// Retrieve Buffer Handling Mode Information
-		CEnumerationPtr ptrHandlingMode = sNodeMap.GetNode("StreamBufferHandlingMode");
-		if (!IsAvailable(ptrHandlingMode) || !IsWritable(ptrHandlingMode))
+		return m_startup_timing.ok;
+	}
+	const camera_startup_timing &get_startup_timing() const
+	{
+		return m_startup_timing;
+	}
+	void fill_stats(diagnostic_msgs::DiagnosticStatus &status)
+	{
+		status.name = m_cam_settings.cam_name;
+		status.level = diagnostic_msgs::DiagnosticStatus::OK;
+		if (m_image_event_handler_ptr == nullptr)
 		{
-			ROS_ERROR("Unable to set Buffer Handling mode (node retrieval). Aborting...");
+			status.level = diagnostic_msgs::DiagnosticStatus::ERROR;
+			status.message = "failed to start: " + m_startup_timing.error;
+			return;
 		}
-		CEnumEntryPtr ptrHandlingModeEntry = ptrHandlingMode->GetCurrentEntry();
-		if (!IsAvailable(ptrHandlingModeEntry) || !IsReadable(ptrHandlingModeEntry))
+		add_stat(status, "stream_buffers", m_buffer_count);
+		add_stat(status, "node_writes", m_node_cache_ptr->writes());
+		add_stat(status, "node_writes_saved", m_node_cache_ptr->saved());
+		add_stat(status, "reconfigure_batches", m_reconf_batches.load());
+		add_stat(status, "reconfigure_last_ms", m_reconf_last_us.load() / 1000.0);
+		add_stat(status, "reconfigure_max_ms", m_reconf_max_us.load() / 1000.0);
+		add_stat(status, "roi_changes", m_roi_changes.load());
+		add_stat(status, "roi_last_gap_ms", m_roi_last_gap_us.load() / 1000.0);
+		add_stat(status, "max_fps", m_max_fps.load());
+		if (m_buffer_memory_ptr)
+		{
+			add_stat(status, "buffer_memory_bytes", m_buffer_memory_ptr->mapped_size());
+			add_stat(status, "buffer_memory_huge_pages", m_buffer_memory_ptr->huge_pages());
+			add_stat(status, "buffer_memory_locked", m_buffer_memory_ptr->locked());
+		}
+		if (m_recorder_ptr != nullptr)
+		{
+			m_recorder_ptr->fill_stats(status);
+		}
+		m_image_event_handler_ptr->fill_stats(status);
+	}
+	// Latches the camera clock a few times and adds the observation with the shortest round trip to the clock estimator.
+	// The host time is the midpoint of the latch command, half the round trip is its uncertainty.
+	bool latch_device_clock()
+	{
+		int64_t best_rtt_ns = -1;
+		int64_t best_host_ns = 0;
+		int64_t best_device_ns = 0;
+		try
+		{
+			for (int i = 0; i < CLOCK_LATCH_TRIES; i++)
+			{
+				ros::Time before = ros::Time::now();
+				m_cam_ptr->TimestampLatch.Execute();
+				ros::Time after = ros::Time::now();
+				int64_t device_ns = m_cam_ptr->TimestampLatchValue.GetValue();
+				int64_t rtt_ns = int64_t(after.toNSec()) - int64_t(before.toNSec());
+				if (best_rtt_ns < 0 || rtt_ns < best_rtt_ns)
+				{
+					best_rtt_ns = rtt_ns;
+					best_host_ns = int64_t(before.toNSec()) + rtt_ns / 2;
+					best_device_ns = device_ns;
+				}
+			}
+		}
+		catch (Spinnaker::Exception &ex)
 		{
-			ROS_ERROR("Unable to set Buffer Handling mode (Entry retrieval). Aborting...");
+			ROS_WARN_THROTTLE(10.0, "Blackfly Nodelet: Failed to latch the clock of camera %s: %s", m_cam_settings.cam_name.c_str(), ex.what());
+			return false;
 		}
+		m_clock_estimator.add_sample(best_device_ns, best_host_ns, best_rtt_ns / 2);
+		return true;
+	}
+	void clock_sync_loop()
+	{
+		std::unique_lock<std::mutex> lock(m_clock_sync_mutex);
+		while (!m_clock_sync_stop)
+		{
+			lock.unlock();
+			if (latch_device_clock() && m_clock_estimator.valid())
+			{
+				// drift in ppm and fit residual in microseconds, to watch the sync quality
+				std_msgs::Float64 drift_msg;
+				drift_msg.data = m_clock_estimator.drift_ppm();
+				m_clock_drift_pub.publish(drift_msg);
+				std_msgs::Float64 residual_msg;
+				residual_msg.data = m_clock_estimator.residual_rms_ns() / 1000.0;
+				m_clock_residual_pub.publish(residual_msg);
+			}
+			lock.lock();
+			m_clock_sync_cond.wait_for(lock, std::chrono::duration<double>(m_cam_settings.clock_sync_period), [this]() { return m_clock_sync_stop; });
+		}
+	}
+	// This function sets the internal buffersize of spinnaker -> By default it allocates memory based on the frame rate of the camera.
+	// This may require very large memory when using multiple cameras, and may cause additional issues.
+	// Returns false and leaves the camera default when a node is missing. Counts above the camera maximum are clamped.
+	bool set_buffer_size(unsigned int &buff_size)
+	{
+		// Retrieve Stream Parameters device nodemap
+		Spinnaker::GenApi::INodeMap &sNodeMap = m_cam_ptr->GetTLStreamNodeMap();
 		// Set stream buffer Count Mode to manual
 		CEnumerationPtr ptrStreamBufferCountMode = sNodeMap.GetNode("StreamBufferCountMode");
 		if (!IsAvailable(ptrStreamBufferCountMode) || !IsWritable(ptrStreamBufferCountMode))
 		{
 			ROS_ERROR("Unable to set Buffer Count Mode (node retrieval). Aborting...");
+			return false;
 		}
 		CEnumEntryPtr ptrStreamBufferCountModeManual = ptrStreamBufferCountMode->GetEntryByName("Manual");
 		if (!IsAvailable(ptrStreamBufferCountModeManual) || !IsReadable(ptrStreamBufferCountModeManual))
 		{
 			ROS_ERROR("Unable to set Buffer Count Mode entry (Entry retrieval). Aborting...");
+			return false;
 		}
-		ptrStreamBufferCountMode->SetIntValue(ptrStreamBufferCountModeManual->GetValue());
 		// Retrieve and modify Stream Buffer Count
 		CIntegerPtr ptrBufferCount = sNodeMap.GetNode("StreamBufferCountManual");
-		if (!IsAvailable(ptrBufferCount) || !IsWritable(ptrBufferCount))
+		if (!IsAvailable(ptrBufferCount))
+		{
+			ROS_ERROR("Unable to set Buffer Count (Integer node retrieval). Aborting...");
+			return false;
+		}
+		ptrStreamBufferCountMode->SetIntValue(ptrStreamBufferCountModeManual->GetValue());
+		if (!IsWritable(ptrBufferCount))
 		{
 			ROS_ERROR("Unable to set Buffer Count (Integer node retrieval). Aborting...");
+			return false;
+		}
+		if (int64_t(buff_size) > ptrBufferCount->GetMax())
+		{
+			ROS_WARN("Blackfly Nodelet: Camera %s supports at most %ld stream buffers, requested %u", m_cam_settings.cam_name.c_str(), (long)ptrBufferCount->GetMax(), buff_size);
+			buff_size = (unsigned int)ptrBufferCount->GetMax();
 		}
-		// Display Buffer Info
 		ptrBufferCount->SetValue(buff_size);
+		return true;
 	}
-	void setup_camera()
+	// NewestOnly always hands out the latest frame, OldestFirst delivers every frame in order and stalls when all buffers are full,
+	// OldestFirstOverwrite delivers in order but lets the camera overwrite the oldest undelivered frame
+	bool set_buffer_handling_mode(const std::string &mode)
+	{
+		Spinnaker::GenApi::INodeMap &sNodeMap = m_cam_ptr->GetTLStreamNodeMap();
+		// Retrieve Buffer Handling Mode Information
+		CEnumerationPtr ptrHandlingMode = sNodeMap.GetNode("StreamBufferHandlingMode");
+		if (!IsAvailable(ptrHandlingMode) || !IsWritable(ptrHandlingMode))
+		{
+			ROS_ERROR("Unable to set Buffer Handling mode (node retrieval). Aborting...");
+			return false;
+		}
+		CEnumEntryPtr ptrHandlingModeEntry = ptrHandlingMode->GetEntryByName(mode.c_str());
+		if (!IsAvailable(ptrHandlingModeEntry) || !IsReadable(ptrHandlingModeEntry))
+		{
+			ROS_ERROR("Unable to set Buffer Handling mode %s (Entry retrieval). Aborting...", mode.c_str());
+			return false;
+		}
+		ptrHandlingMode->SetIntValue(ptrHandlingModeEntry->GetValue());
+		return true;
+	}
+	// Enough buffers to hold buffer_latency_budget seconds of frames plus the ones queued or on loan, bounded by buffer_memory_cap.
+	// Needs the pixel format, binning and chunk data to be set already, they decide the payload size.
+	unsigned int auto_buffer_count()
+	{
+		double frame_bytes = double(m_cam_ptr->PayloadSize.GetValue());
+		unsigned int count = (unsigned int)std::ceil(m_cam_settings.fps * m_cam_settings.buffer_latency_budget) + 1;
+		count += m_cam_settings.queue_depth > 0 ? (unsigned int)frame_queue_capacity(size_t(m_cam_settings.queue_depth), m_cam_settings.queue_overflow) : 0;
+		count = std::max<unsigned int>(count, MIN_AUTO_BUFFER_COUNT);
+		unsigned int cap = frame_bytes > 0 ? (unsigned int)(m_cam_settings.buffer_memory_cap * 1024.0 * 1024.0 / frame_bytes) : count;
+		if (count > cap)
+		{
+			ROS_WARN("Blackfly Nodelet: Camera %s needs %u stream buffers for its latency budget, the memory cap allows %u", m_cam_settings.cam_name.c_str(), count, cap);
+			count = std::max<unsigned int>(cap, MIN_AUTO_BUFFER_COUNT);
+		}
+		ROS_INFO("Blackfly Nodelet: Camera %s uses %u stream buffers of %.1f MB", m_cam_settings.cam_name.c_str(), count, frame_bytes / (1024.0 * 1024.0));
+		return count;
+	}
+	// Hands spinnaker one preallocated region holding all m_buffer_count stream buffers, sized from the payload with chunk data.
+	// Falls back to spinnaker owned buffers when the region cannot be mapped or the camera refuses it.
+	void setup_buffer_memory()
 	{
 		try
 		{
-			// initialize the camera
-			m_cam_ptr->Init();
+			size_t payload_size = size_t(m_cam_ptr->PayloadSize.GetValue());
+			size_t buffer_size = ((payload_size + USB3_PACKET_SIZE - 1) / USB3_PACKET_SIZE) * USB3_PACKET_SIZE;
+			boost::shared_ptr<AcquisitionMemory> memory_ptr = boost::make_shared<AcquisitionMemory>(buffer_size * m_buffer_count);
+			if (!memory_ptr->valid())
+			{
+				ROS_WARN("Blackfly Nodelet: Camera %s uses spinnaker owned stream buffers", m_cam_settings.cam_name.c_str());
+				return;
+			}
+			// fewer buffers in the region than counted would let the loans take the last free ones of the stream
+			if (payload_size == 0 || memory_ptr->size() / payload_size < m_buffer_count)
+			{
+				ROS_WARN("Blackfly Nodelet: Camera %s stream buffer region holds fewer than %u payloads of %lu bytes, using spinnaker owned stream buffers",
+							m_cam_settings.cam_name.c_str(), m_buffer_count, (unsigned long)payload_size);
+				return;
+			}
+			m_cam_ptr->SetBufferOwnership(BUFFER_OWNERSHIP_USER);
+			m_cam_ptr->SetUserBuffers(memory_ptr->data(), memory_ptr->size());
+			m_buffer_memory_ptr = memory_ptr;
+			ROS_INFO("Blackfly Nodelet: Camera %s stream buffers: %u x %.2f MB in %.1f MB, %s pages, %s", m_cam_settings.cam_name.c_str(), m_buffer_count,
+						buffer_size / (1024.0 * 1024.0), memory_ptr->mapped_size() / (1024.0 * 1024.0),
+						memory_ptr->huge_pages() ? "huge" : "transparent huge", memory_ptr->locked() ? "locked" : "not locked");
+		}
+		catch (Spinnaker::Exception &ex)
+		{
+			ROS_WARN("Blackfly Nodelet: Camera %s refused user stream buffers, using spinnaker owned ones: %s", m_cam_settings.cam_name.c_str(), ex.what());
+			try
+			{
+				m_cam_ptr->SetBufferOwnership(BUFFER_OWNERSHIP_SYSTEM);
+			}
+			catch (Spinnaker::Exception &)
+			{
+			}
+		}
+	}
+	// Hands a dynamic reconfigure request to the control thread of this camera and returns right away.
+	// Requests arriving while a batch is applied replace each other, only the newest one is applied next.
+	void request_reconfigure(const blackfly::BlackFlyConfig &config)
+	{
+		{
+			std::lock_guard<std::mutex> lock(m_control_mutex);
+			m_pending_config = config;
+			m_config_pending = true;
+		}
+		m_control_cond.notify_all();
+	}
+	// Hands an ROI change to the control thread and waits until it is applied, so it never interleaves with a reconfigure batch.
+	void set_roi(const blackfly::SetRoi::Request &request, blackfly::SetRoi::Response &response)
+	{
+		std::future<blackfly::SetRoi::Response> done;
+		{
+			std::lock_guard<std::mutex> lock(m_control_mutex);
+			if (!m_control_thread.joinable() || m_control_stop)
+			{
+				response.success = false;
+				response.message = "camera is not acquiring";
+				return;
+			}
+			if (m_roi_pending)
+			{
+				response.success = false;
+				response.message = "another ROI change is waiting";
+				return;
+			}
+			m_roi_request = request;
+			m_roi_done = std::promise<blackfly::SetRoi::Response>();
+			done = m_roi_done.get_future();
+			m_roi_pending = true;
+		}
+		m_control_cond.notify_all();
+		response = done.get();
+	}
+	void control_loop()
+	{
+		std::unique_lock<std::mutex> lock(m_control_mutex);
+		while (true)
+		{
+			m_control_cond.wait(lock, [this]() { return m_control_stop || m_config_pending || m_roi_pending; });
+			if (m_control_stop)
+			{
+				if (m_roi_pending)
+				{
+					blackfly::SetRoi::Response response;
+					response.message = "camera is shutting down";
+					m_roi_done.set_value(response);
+					m_roi_pending = false;
+				}
+				return;
+			}
+			if (m_roi_pending)
+			{
+				blackfly::SetRoi::Request request = m_roi_request;
+				std::promise<blackfly::SetRoi::Response> done = std::move(m_roi_done);
+				m_roi_pending = false;
+				lock.unlock();
+				blackfly::SetRoi::Response response;
+				apply_roi(request, response);
+				done.set_value(response);
+				lock.lock();
+				continue;
+			}
+			blackfly::BlackFlyConfig config = m_pending_config;
+			m_config_pending = false;
+			lock.unlock();
+			ros::WallTime batch_start = ros::WallTime::now();
+			size_t writes = apply_config(config);
+			uint64_t batch_us = uint64_t((ros::WallTime::now() - batch_start).toSec() * 1e6);
+			m_reconf_batches++;
+			m_reconf_last_us = batch_us;
+			if (batch_us > m_reconf_max_us.load())
+			{
+				m_reconf_max_us = batch_us;
+			}
+			ROS_INFO("Blackfly Nodelet: Reconfigured camera %s with %zu writes in %.1f ms", m_cam_settings.cam_name.c_str(), writes, batch_us / 1000.0);
+			lock.lock();
+		}
+	}
+	// Applies a dynamic reconfigure request through the node cache, only settings that changed reach the camera.
+	// Binning needs the stream stopped, it is only applied while acquisition_stop is set.
+	// Stopping and starting acquisition happen when their flag is switched on. Returns the number of device writes.
+	size_t apply_config(const blackfly::BlackFlyConfig &config)
+	{
+		size_t writes = 0;
+		if (m_node_cache_ptr == nullptr)
+		{
+			return writes;
+		}
+		bool stop_requested = config.acquisition_stop && !m_applied_config.acquisition_stop;
+		bool start_requested = config.acquisition_start && !m_applied_config.acquisition_start;
+		m_applied_config = config;
+		try
+		{
+			m_node_cache_ptr->stage_float(NODE_ACQUISITION_FRAME_RATE, config.fps);
+			m_node_cache_ptr->stage_bool(NODE_GAMMA_ENABLE, config.enable_gamma);
+			m_node_cache_ptr->stage_float(NODE_GAMMA, config.gamma);
+			switch (config.exposure_auto)
+			{
+			case 0:
+				m_node_cache_ptr->stage_enum(NODE_EXPOSURE_AUTO, "Off");
+				m_node_cache_ptr->stage_float(NODE_EXPOSURE_TIME, config.exposure_time);
+				break;
+			case 1:
+				m_node_cache_ptr->stage_enum(NODE_EXPOSURE_AUTO, "Once");
+				break;
+			default:
+				m_node_cache_ptr->stage_enum(NODE_EXPOSURE_AUTO, "Continuous");
+				break;
+			}
+			switch (config.gain_auto)
+			{
+			case 0:
+				m_node_cache_ptr->stage_enum(NODE_GAIN_AUTO, "Off");
+				m_node_cache_ptr->stage_float(NODE_GAIN, config.gain);
+				break;
+			case 1:
+				m_node_cache_ptr->stage_enum(NODE_GAIN_AUTO, "Once");
+				break;
+			default:
+				m_node_cache_ptr->stage_enum(NODE_GAIN_AUTO, "Continuous");
+				break;
+			}
+			switch (config.lighting_mode)
+			{
+			case 1:
+				m_node_cache_ptr->stage_enum(NODE_AUTO_EXPOSURE_LIGHTING_MODE, "Backlight");
+				break;
+			case 2:
+				m_node_cache_ptr->stage_enum(NODE_AUTO_EXPOSURE_LIGHTING_MODE, "Frontlight");
+				break;
+			default:
+				m_node_cache_ptr->stage_enum(NODE_AUTO_EXPOSURE_LIGHTING_MODE, "Normal");
+				break;
+			}
+			switch (config.auto_exposure_priority)
+			{
+			case 1:
+				m_node_cache_ptr->stage_enum(NODE_AUTO_EXPOSURE_CONTROL_PRIORITY, "ExposureTime");
+				break;
+			default:
+				m_node_cache_ptr->stage_enum(NODE_AUTO_EXPOSURE_CONTROL_PRIORITY, "Gain");
+				break;
+			}
+			writes += m_node_cache_ptr->commit();
 
-			m_cam_ptr->AcquisitionStop();
+			if (stop_requested)
+			{
+				ROS_INFO("Blackfly Nodelet: Stopping acquisition of camera %s", m_cam_settings.cam_name.c_str());
+				m_cam_ptr->AcquisitionStop();
+				m_cam_ptr->TLParamsLocked = 0;
+				m_acquisition_stopped = true;
+				writes += 2;
+			}
+			if (config.acquisition_stop)
+			{
+				m_node_cache_ptr->stage_int(NODE_BINNING_HORIZONTAL, config.binning);
+				m_node_cache_ptr->stage_int(NODE_BINNING_VERTICAL, config.binning);
+				if (config.binning_mode == 0)
+				{
+					m_node_cache_ptr->stage_enum(NODE_BINNING_HORIZONTAL_MODE, "Average");
+					m_node_cache_ptr->stage_enum(NODE_BINNING_VERTICAL_MODE, "Average");
+				}
+				else
+				{
+					m_node_cache_ptr->stage_enum(NODE_BINNING_HORIZONTAL_MODE, "Sum");
+					m_node_cache_ptr->stage_enum(NODE_BINNING_VERTICAL_MODE, "Sum");
+				}
+				size_t binning_writes = m_node_cache_ptr->commit();
+				if (binning_writes > 0)
+				{
+					// the camera refits the window to the new sensor size
+					m_node_cache_ptr->forget(NODE_WIDTH);
+					m_node_cache_ptr->forget(NODE_HEIGHT);
+					m_node_cache_ptr->forget(NODE_OFFSET_X);
+					m_node_cache_ptr->forget(NODE_OFFSET_Y);
+					m_node_cache_ptr->forget(NODE_ACQUISITION_FRAME_RATE);
+					window_changed();
+				}
+				writes += binning_writes;
+			}
+			if (start_requested)
+			{
+				ROS_INFO("Blackfly Nodelet: Starting acquisition of camera %s", m_cam_settings.cam_name.c_str());
+				m_cam_ptr->TLParamsLocked = 1;
+				m_device_event_handler_ptr->acquisition_restarted();
+				m_cam_ptr->AcquisitionStart();
+				m_acquisition_stopped = false;
+				writes += 2;
+			}
+		}
+		catch (Spinnaker::Exception &ex)
+		{
+			ROS_ERROR("Blackfly Nodelet: Dynamic reconfigure of camera %s failed: %s", m_cam_settings.cam_name.c_str(), ex.what());
+		}
+		return writes;
+	}
+	// Writes the requested window on the control thread. A move that keeps the size is sent while the camera streams when the
+	// offsets are writable then, anything else stops acquisition around the writes like a binning change. The stream and its
+	// buffers keep running through the change, a window whose payload exceeds the buffers sized at startup is refused.
+	void apply_roi(const blackfly::SetRoi::Request &request, blackfly::SetRoi::Response &response)
+	{
+		response.success = false;
+		if (m_node_cache_ptr == nullptr)
+		{
+			response.message = "camera is not initialized";
+			return;
+		}
+		try
+		{
+			int64_t offset_x = request.offset_x;
+			int64_t offset_y = request.offset_y;
+			int64_t width = request.width;
+			int64_t height = request.height;
+			bool fits = fit_roi(offset_x, offset_y, width, height);
+			int64_t previous_offset_x = m_cam_ptr->OffsetX.GetValue();
+			int64_t previous_offset_y = m_cam_ptr->OffsetY.GetValue();
+			int64_t previous_width = m_cam_ptr->Width.GetValue();
+			int64_t previous_height = m_cam_ptr->Height.GetValue();
+			bool resize = width != previous_width || height != previous_height;
+			bool move = offset_x != previous_offset_x || offset_y != previous_offset_y;
+			bool live = !resize && IsWritable(m_cam_ptr->OffsetX) && IsWritable(m_cam_ptr->OffsetY);
+			bool stop = (resize || move) && !live && !m_acquisition_stopped;
+			bool too_large = false;
+			ros::WallTime stop_time = ros::WallTime::now();
+			if (stop)
+			{
+				m_cam_ptr->AcquisitionStop();
+				m_cam_ptr->TLParamsLocked = 0;
+			}
+			try
+			{
+				stage_roi(offset_x, offset_y, width, height);
+				m_node_cache_ptr->commit();
+				too_large = uint64_t(m_cam_ptr->PayloadSize.GetValue()) > m_stream_payload;
+				if (too_large)
+				{
+					stage_roi(previous_offset_x, previous_offset_y, previous_width, previous_height);
+					m_node_cache_ptr->commit();
+				}
+			}
+			catch (Spinnaker::Exception &)
+			{
+				// never leave the camera stopped behind a failed write
+				if (stop)
+				{
+					m_cam_ptr->TLParamsLocked = 1;
+					m_device_event_handler_ptr->acquisition_restarted();
+					m_cam_ptr->AcquisitionStart();
+				}
+				throw;
+			}
+			if (stop)
+			{
+				m_cam_ptr->TLParamsLocked = 1;
+				m_device_event_handler_ptr->acquisition_restarted();
+				m_cam_ptr->AcquisitionStart();
+			}
+			double gap = stop ? (ros::WallTime::now() - stop_time).toSec() : 0.0;
+			// the frame rate limit moved with the window, the camera may have lowered the rate by itself
+			m_node_cache_ptr->forget(NODE_ACQUISITION_FRAME_RATE);
+			window_changed();
 
-			// Set up pixel format
-			if (m_cam_settings.mono)
+			response.offset_x = uint32_t(m_cam_ptr->OffsetX.GetValue());
+			response.offset_y = uint32_t(m_cam_ptr->OffsetY.GetValue());
+			response.width = uint32_t(m_cam_ptr->Width.GetValue());
+			response.height = uint32_t(m_cam_ptr->Height.GetValue());
+			response.max_fps = m_max_fps.load();
+			response.resulting_fps = IsReadable(m_cam_ptr->AcquisitionResultingFrameRate) ? m_cam_ptr->AcquisitionResultingFrameRate.GetValue() : 0.0;
+			response.stopped = stop;
+			response.gap = gap;
+			response.success = !too_large;
+			if (too_large)
+			{
+				response.message = "window needs larger stream buffers than the camera started with, start it with that roi instead";
+			}
+			else if (!fits)
 			{
-				m_cam_ptr->PixelFormat = PixelFormat_Mono8;
+				response.message = "window clamped to the sensor and rounded to the camera increments";
+			}
+			m_roi_changes++;
+			m_roi_last_gap_us = uint64_t(gap * 1e6);
+		}
+		catch (Spinnaker::Exception &ex)
+		{
+			response.success = false;
+			response.message = ex.what();
+			ROS_ERROR("Blackfly Nodelet: ROI change of camera %s failed: %s", m_cam_settings.cam_name.c_str(), ex.what());
+			return;
+		}
+		ROS_INFO("Blackfly Nodelet: Camera %s ROI %ux%u at %u,%u, up to %.1f fps, acquisition stopped for %.1f ms", m_cam_settings.cam_name.c_str(),
+					response.width, response.height, response.offset_x, response.offset_y, response.max_fps, response.gap * 1000.0);
+	}
+	void stage_roi(int64_t offset_x, int64_t offset_y, int64_t width, int64_t height)
+	{
+		m_node_cache_ptr->stage_int(NODE_WIDTH, width);
+		m_node_cache_ptr->stage_int(NODE_HEIGHT, height);
+		m_node_cache_ptr->stage_int(NODE_OFFSET_X, offset_x);
+		m_node_cache_ptr->stage_int(NODE_OFFSET_Y, offset_y);
+	}
+	// Clamps a window to the sensor at the current binning and rounds it down to the camera increments,
+	// a width or height of 0 extends it from its offset to the sensor edge. Returns false when the window had to move or shrink.
+	bool fit_roi(int64_t &offset_x, int64_t &offset_y, int64_t &width, int64_t &height)
+	{
+		bool fits = fit_roi_axis(offset_x, width, m_cam_ptr->WidthMax.GetValue(), m_cam_ptr->Width.GetMin(), m_cam_ptr->Width.GetInc(), m_cam_ptr->OffsetX.GetInc());
+		return fit_roi_axis(offset_y, height, m_cam_ptr->HeightMax.GetValue(), m_cam_ptr->Height.GetMin(), m_cam_ptr->Height.GetInc(), m_cam_ptr->OffsetY.GetInc()) && fits;
+	}
+	static bool fit_roi_axis(int64_t &offset, int64_t &size, int64_t size_max, int64_t size_min, int64_t size_inc, int64_t offset_inc)
+	{
+		int64_t requested_offset = offset;
+		offset = std::max<int64_t>(0, std::min(offset, size_max - size_min));
+		offset -= offset % std::max<int64_t>(offset_inc, 1);
+		int64_t requested_size = size > 0 ? size : size_max - offset;
+		size = std::max(size_min, std::min(requested_size, size_max - offset));
+		size = size_min + (size - size_min) / std::max<int64_t>(size_inc, 1) * std::max<int64_t>(size_inc, 1);
+		return offset == requested_offset && size == requested_size;
+	}
+	// Hands the current window to the CameraInfo, all zeros when it covers the whole sensor, and keeps the highest frame rate
+	// the camera allows with it. The window stays in pixels at the configured binning: the calibration was taken at that
+	// binning and the CameraInfo keeps its binning fields, so image_geometry and the pyramid levels see one coordinate frame.
+	void window_changed()
+	{
+		sensor_msgs::RegionOfInterest roi;
+		int64_t width = m_cam_ptr->Width.GetValue();
+		int64_t height = m_cam_ptr->Height.GetValue();
+		if (width < m_cam_ptr->WidthMax.GetValue() || height < m_cam_ptr->HeightMax.GetValue())
+		{
+			roi.x_offset = uint32_t(m_cam_ptr->OffsetX.GetValue());
+			roi.y_offset = uint32_t(m_cam_ptr->OffsetY.GetValue());
+			roi.width = uint32_t(width);
+			roi.height = uint32_t(height);
+		}
+		if (m_image_event_handler_ptr != nullptr)
+		{
+			m_image_event_handler_ptr->set_camera_info_roi(roi);
+		}
+		m_max_fps = IsReadable(m_cam_ptr->AcquisitionFrameRate) ? m_cam_ptr->AcquisitionFrameRate.GetMax() : 0.0;
+	}
+	// Staging slots are sized for the payload at startup, larger frames after a reconfigure are left out of the recording.
+	// A recorder that fails to start leaves the camera running without recording.
+	void setup_recorder()
+	{
+		size_t max_payload = size_t(m_cam_ptr->PayloadSize.GetValue());
+		size_t slots = m_cam_settings.record_slots > 0 ? size_t(m_cam_settings.record_slots) : 1;
+		m_recorder_ptr = new FrameRecorder(m_cam_settings.cam_name, m_cam_settings.record_dir, max_payload, slots, m_cam_settings.record_segment_size);
+		if (!m_recorder_ptr->start())
+		{
+			ROS_ERROR("Blackfly Nodelet: Recording of camera %s could not be started", m_cam_settings.cam_name.c_str());
+			delete m_recorder_ptr;
+			m_recorder_ptr = nullptr;
+		}
+	}
+	// Enables the chunks listed in frame_metadata_chunks, returns false when the camera has no chunk mode.
+	// The chunks are part of the payload, so this runs before anything is sized from PayloadSize.
+	bool setup_chunk_data()
+	{
+		INodeMap &node_map = m_cam_ptr->GetNodeMap();
+		CBooleanPtr ptrChunkModeActive = node_map.GetNode("ChunkModeActive");
+		if (!IsAvailable(ptrChunkModeActive) || !IsWritable(ptrChunkModeActive))
+		{
+			ROS_ERROR("Blackfly Nodelet: Unable to activate chunk mode. Frame metadata not available");
+			return false;
+		}
+		ptrChunkModeActive->SetValue(true);
+		// Retrieve the selector node
+		CEnumerationPtr ptrChunkSelector = node_map.GetNode("ChunkSelector");
+
+		if (!IsAvailable(ptrChunkSelector) || !IsReadable(ptrChunkSelector))
+		{
+			ROS_ERROR("Blackfly Nodelet: Unable to activate chunk mode. Frame metadata not available");
+			return false;
+		}
+		for (size_t i = 0; i < sizeof(frame_metadata_chunks) / sizeof(frame_metadata_chunks[0]); i++)
+		{
+			// Select entry to be enabled
+			CEnumEntryPtr ptrChunkSelectorEntry = ptrChunkSelector->GetEntryByName(frame_metadata_chunks[i]);
+
+			// Go to next node if problem occurs
+			if (!IsAvailable(ptrChunkSelectorEntry) || !IsReadable(ptrChunkSelectorEntry))
+			{
+				ROS_WARN("Blackfly Nodelet: Chunk Data: %s not available", frame_metadata_chunks[i]);
+				continue;
+			}
+
+			ptrChunkSelector->SetIntValue(ptrChunkSelectorEntry->GetValue());
+
+			// Retrieve corresponding boolean
+			CBooleanPtr ptrChunkEnable = node_map.GetNode("ChunkEnable");
+			// Enable the boolean, thus enabling the corresponding chunk data
+			if (!IsAvailable(ptrChunkEnable))
+			{
+				ROS_WARN("Blackfly Nodelet: Chunk Data: %s not available", frame_metadata_chunks[i]);
+			}
+			else if (ptrChunkEnable->GetValue())
+			{
+				//ROS_INFO("Blackfly Nodelet: Chunk Data: %s enabled", frame_metadata_chunks[i]);
+			}
+			else if (IsWritable(ptrChunkEnable))
+			{
+				ptrChunkEnable->SetValue(true);
+				//ROS_INFO("Blackfly Nodelet: Chunk Data: %s enabled", frame_metadata_chunks[i]);
 			}
 			else
 			{
-				m_cam_ptr->PixelFormat = PixelFormat_BGR8;
+				ROS_WARN("Blackfly Nodelet: Chunk Data: %s not writable", frame_metadata_chunks[i]);
+			}
+		}
+		ROS_INFO("Blackfly Nodelet: Successfully Configured Chunk Data");
+		return true;
+	}
+	// Stream buffers live in the host side transport layer, they are not part of a user set and are set up on every start
+	void setup_stream_buffers()
+	{
+		try
+		{
+			m_buffer_count = m_cam_settings.buffer_count > 0 ? m_cam_settings.buffer_count : auto_buffer_count();
+			if (!set_buffer_size(m_buffer_count))
+			{
+				// the camera keeps its own count, assume the fewest buffers when limiting loans
+				m_buffer_count = MIN_AUTO_BUFFER_COUNT;
+			}
+			if (!m_cam_settings.buffer_handling_mode.empty())
+			{
+				set_buffer_handling_mode(m_cam_settings.buffer_handling_mode);
+			}
+		}
+		catch (Spinnaker::Exception &ex)
+		{
+			ROS_ERROR("Blackfly Nodelet: Failed to set up the stream buffers of camera %s: %s", m_cam_settings.cam_name.c_str(), ex.what());
+		}
+		if (m_cam_settings.queue_depth > 0 && (unsigned int)frame_queue_capacity(size_t(m_cam_settings.queue_depth), m_cam_settings.queue_overflow) + 1 >= m_buffer_count)
+		{
+			ROS_WARN("Blackfly Nodelet: Frame queue of camera %s can hold every stream buffer (%u), the camera may stall", m_cam_settings.cam_name.c_str(), m_buffer_count);
+		}
+	}
+	// hash of every setting setup_camera writes to the device, floats with all their digits so any change is seen
+	uint64_t settings_hash() const
+	{
+		std::ostringstream ss;
+		ss << std::setprecision(17);
+		ss << USER_SET_LAYOUT_VERSION << ";" << m_cam_settings.pixel_format << ";" << m_cam_settings.mono << ";" << m_cam_settings.binning << ";"
+		   << m_cam_settings.binning_mode << ";" << m_cam_settings.lighting_mode << ";" << m_cam_settings.is_auto_exp << ";"
+		   << m_cam_settings.max_auto_exp_time << ";" << m_cam_settings.min_auto_exp_time << ";" << m_cam_settings.fixed_exp_time << ";"
+		   << m_cam_settings.auto_gain << ";" << m_cam_settings.gain << ";" << m_cam_settings.max_gain << ";" << m_cam_settings.min_gain << ";"
+		   << m_cam_settings.enable_gamma << ";" << m_cam_settings.gamma << ";" << m_cam_settings.is_triggered << ";" << m_cam_settings.fps << ";"
+		   << m_cam_settings.roi_offset_x << ";" << m_cam_settings.roi_offset_y << ";" << m_cam_settings.roi_width << ";" << m_cam_settings.roi_height;
+		return fnv1a_hash(ss.str());
+	}
+	bool select_user_set()
+	{
+		CEnumerationPtr ptrUserSetSelector = m_cam_ptr->GetNodeMap().GetNode("UserSetSelector");
+		if (!IsAvailable(ptrUserSetSelector) || !IsWritable(ptrUserSetSelector))
+		{
+			ROS_WARN("Blackfly Nodelet: Camera %s has no user sets, warm start disabled", m_cam_settings.cam_name.c_str());
+			return false;
+		}
+		CEnumEntryPtr ptrUserSet = ptrUserSetSelector->GetEntryByName(m_cam_settings.user_set.c_str());
+		if (!IsAvailable(ptrUserSet) || !IsReadable(ptrUserSet))
+		{
+			ROS_WARN("Blackfly Nodelet: Camera %s has no user set %s, warm start disabled", m_cam_settings.cam_name.c_str(), m_cam_settings.user_set.c_str());
+			return false;
+		}
+		ptrUserSetSelector->SetIntValue(ptrUserSet->GetValue());
+		return true;
+	}
+	// one UserSetLoad instead of the individual writes of setup_camera, false when the user set was saved from other settings
+	bool load_user_set()
+	{
+		try
+		{
+			std::string serial = m_cam_ptr->TLDevice.DeviceSerialNumber.GetValue().c_str();
+			if (!user_set_matches(serial, m_cam_settings.user_set, settings_hash()))
+			{
+				return false;
+			}
+			m_cam_ptr->AcquisitionStop();
+			if (!select_user_set())
+			{
+				return false;
+			}
+			m_cam_ptr->UserSetLoad.Execute();
+			m_node_cache_ptr->invalidate();
+			if (!user_set_verified())
+			{
+				ROS_WARN("Blackfly Nodelet: %s on camera %s was changed outside the driver, writing the settings instead", m_cam_settings.user_set.c_str(), m_cam_settings.cam_name.c_str());
+				return false;
 			}
-			m_cam_ptr->BinningVertical = m_cam_settings.binning;
-			m_cam_ptr->BinningHorizontal = m_cam_settings.binning;
+		}
+		catch (Spinnaker::Exception &ex)
+		{
+			ROS_WARN("Blackfly Nodelet: Failed to load %s on camera %s, writing the settings instead: %s", m_cam_settings.user_set.c_str(), m_cam_settings.cam_name.c_str(), ex.what());
+			return false;
+		}
+		ROS_INFO("Blackfly Nodelet: Camera %s configured from %s", m_cam_settings.cam_name.c_str(), m_cam_settings.user_set.c_str());
+		return true;
+	}
+	// The hash only covers saves by the driver. A few key nodes of the loaded user set are compared with the settings, so a user set
+	// overwritten by another tool is caught, changes to other nodes are not.
+	bool user_set_verified()
+	{
+		return m_cam_ptr->PixelFormat.GetCurrentEntry()->GetSymbolic() == pixel_format_name() &&
+				m_cam_ptr->BinningHorizontal.GetValue() == m_cam_settings.binning &&
+				(m_cam_ptr->TriggerMode.GetValue() == TriggerMode_On) == m_cam_settings.is_triggered &&
+				(m_cam_ptr->ExposureAuto.GetValue() == ExposureAuto_Continuous) == m_cam_settings.is_auto_exp;
+	}
+	// PixelFormat entry setup_camera selects, bayer modes send the raw mosaic which is a third of the bgr bandwidth
+	const char *pixel_format_name() const
+	{
+		if (m_cam_settings.pixel_format == "bayer_rg8")
+		{
+			return "BayerRG8";
+		}
+		else if (m_cam_settings.pixel_format == "bayer_rg16")
+		{
+			return "BayerRG16";
+		}
+		return m_cam_settings.mono ? "Mono8" : "BGR8";
+	}
+	// stores the state written by setup_camera in the user set and remembers the settings it came from
+	void save_user_set()
+	{
+		try
+		{
+			std::string serial = m_cam_ptr->TLDevice.DeviceSerialNumber.GetValue().c_str();
+			clear_user_set_hash(serial);
+			if (!select_user_set())
+			{
+				return;
+			}
+			m_cam_ptr->UserSetSave.Execute();
+			if (!save_user_set_hash(serial, m_cam_settings.user_set, settings_hash()))
+			{
+				ROS_WARN("Blackfly Nodelet: Failed to write the user set cache in %s", user_set_cache_dir().c_str());
+			}
+		}
+		catch (Spinnaker::Exception &ex)
+		{
+			ROS_WARN("Blackfly Nodelet: Failed to save %s on camera %s: %s", m_cam_settings.user_set.c_str(), m_cam_settings.cam_name.c_str(), ex.what());
+		}
+	}
+	// seconds since phase_start, which moves on to now
+	static double lap(ros::WallTime &phase_start)
+	{
+		ros::WallTime now = ros::WallTime::now();
+		double seconds = (now - phase_start).toSec();
+		phase_start = now;
+		return seconds;
+	}
+	// applies the camera settings to an initialized camera, returns false if any of them failed
+	bool setup_camera()
+	{
+		try
+		{
+			m_cam_ptr->AcquisitionStop();
 
-			m_cam_ptr->BinningHorizontal = m_cam_settings.binning;
+			// Set up pixel format
+			m_node_cache_ptr->stage_enum(NODE_PIXEL_FORMAT, pixel_format_name());
+			m_node_cache_ptr->stage_int(NODE_BINNING_VERTICAL, m_cam_settings.binning);
+			m_node_cache_ptr->stage_int(NODE_BINNING_HORIZONTAL, m_cam_settings.binning);
 
 			// set binning type 0=Average, 1=Sum
 			if (m_cam_settings.binning_mode == 0)
 			{
-				m_cam_ptr->BinningHorizontalMode.SetValue(BinningHorizontalModeEnums::BinningHorizontalMode_Average);
-				m_cam_ptr->BinningVerticalMode.SetValue(BinningVerticalModeEnums::BinningVerticalMode_Average);
+				m_node_cache_ptr->stage_enum(NODE_BINNING_HORIZONTAL_MODE, "Average");
+				m_node_cache_ptr->stage_enum(NODE_BINNING_VERTICAL_MODE, "Average");
 			}
 			else if (m_cam_settings.binning_mode == 1)
 			{
-				m_cam_ptr->BinningHorizontalMode.SetValue(BinningHorizontalModeEnums::BinningHorizontalMode_Sum);
-				m_cam_ptr->BinningVerticalMode.SetValue(BinningVerticalModeEnums::BinningVerticalMode_Sum);
+				m_node_cache_ptr->stage_enum(NODE_BINNING_HORIZONTAL_MODE, "Sum");
+				m_node_cache_ptr->stage_enum(NODE_BINNING_VERTICAL_MODE, "Sum");
+			}
+			// the window is bounded by the sensor at this binning, which has to reach the camera first
+			m_node_cache_ptr->commit();
+			int64_t roi_offset_x = m_cam_settings.roi_offset_x;
+			int64_t roi_offset_y = m_cam_settings.roi_offset_y;
+			int64_t roi_width = m_cam_settings.roi_width;
+			int64_t roi_height = m_cam_settings.roi_height;
+			if (!fit_roi(roi_offset_x, roi_offset_y, roi_width, roi_height))
+			{
+				ROS_WARN("Blackfly Nodelet: ROI of camera %s clamped to %ldx%ld at %ld,%ld", m_cam_settings.cam_name.c_str(), (long)roi_width, (long)roi_height, (long)roi_offset_x, (long)roi_offset_y);
 			}
+			stage_roi(roi_offset_x, roi_offset_y, roi_width, roi_height);
 
 			// set lighting type 0=Normal, 1=Backlight, 2=Frontlight
 			if (m_cam_settings.lighting_mode == 1)
 			{
-				m_cam_ptr->AutoExposureLightingMode.SetValue(AutoExposureLightingModeEnums::AutoExposureLightingMode_Backlight);
+				m_node_cache_ptr->stage_enum(NODE_AUTO_EXPOSURE_LIGHTING_MODE, "Backlight");
 			}
 			else if (m_cam_settings.lighting_mode == 2)
 			{
-				m_cam_ptr->AutoExposureLightingMode.SetValue(AutoExposureLightingModeEnums::AutoExposureLightingMode_Frontlight);
+				m_node_cache_ptr->stage_enum(NODE_AUTO_EXPOSURE_LIGHTING_MODE, "Frontlight");
 			}
 
 			// set acquisition mode, Continuous instead of single frame or burst modes
-			m_cam_ptr->AcquisitionMode = AcquisitionMode_Continuous;
+			m_node_cache_ptr->stage_enum(NODE_ACQUISITION_MODE, "Continuous");
 
 			// setup exposure
 			if (m_cam_settings.is_auto_exp)
 			{
-				m_cam_ptr->ExposureAuto = ExposureAuto_Continuous;
-				m_cam_ptr->AutoExposureExposureTimeUpperLimit = m_cam_settings.max_auto_exp_time;
-				m_cam_ptr->AutoExposureExposureTimeLowerLimit = m_cam_settings.min_auto_exp_time;
+				m_node_cache_ptr->stage_enum(NODE_EXPOSURE_AUTO, "Continuous");
+				m_node_cache_ptr->stage_float(NODE_AUTO_EXPOSURE_TIME_UPPER_LIMIT, m_cam_settings.max_auto_exp_time);
+				m_node_cache_ptr->stage_float(NODE_AUTO_EXPOSURE_TIME_LOWER_LIMIT, m_cam_settings.min_auto_exp_time);
 			}
 			else
 			{
-				m_cam_ptr->ExposureAuto = ExposureAuto_Off;
-				m_cam_ptr->ExposureTime = m_cam_settings.fixed_exp_time;
+				m_node_cache_ptr->stage_enum(NODE_EXPOSURE_AUTO, "Off");
+				m_node_cache_ptr->stage_float(NODE_EXPOSURE_TIME, m_cam_settings.fixed_exp_time);
 			}
 			// setup gain
-			m_cam_ptr->GainAuto = GainAuto_Off;
 			if (m_cam_settings.auto_gain)
 			{
-				m_cam_ptr->GainAuto = GainAuto_Continuous;
-				m_cam_ptr->AutoExposureGainUpperLimit = m_cam_settings.max_gain;
-				m_cam_ptr->AutoExposureGainLowerLimit = m_cam_settings.min_gain;
+				m_node_cache_ptr->stage_enum(NODE_GAIN_AUTO, "Continuous");
+				m_node_cache_ptr->stage_float(NODE_AUTO_EXPOSURE_GAIN_UPPER_LIMIT, m_cam_settings.max_gain);
+				m_node_cache_ptr->stage_float(NODE_AUTO_EXPOSURE_GAIN_LOWER_LIMIT, m_cam_settings.min_gain);
 			}
 			else
 			{
-				m_cam_ptr->Gain.SetValue(m_cam_settings.gain);
+				m_node_cache_ptr->stage_enum(NODE_GAIN_AUTO, "Off");
+				m_node_cache_ptr->stage_float(NODE_GAIN, m_cam_settings.gain);
 			}
 			// setup gamma
+			m_node_cache_ptr->stage_bool(NODE_GAMMA_ENABLE, m_cam_settings.enable_gamma);
 			if (m_cam_settings.enable_gamma)
 			{
-				m_cam_ptr->GammaEnable = true;
-				m_cam_ptr->Gamma.SetValue(m_cam_settings.gamma);
+				m_node_cache_ptr->stage_float(NODE_GAMMA, m_cam_settings.gamma);
 			}
-			else
-			{
-				m_cam_ptr->GammaEnable = false;
-			}
-			// setup trigger parameters
+			// setup trigger parameters, the node cache switches the trigger off while its source is changed
 			if (m_cam_settings.is_triggered)
 			{
-				m_cam_ptr->TriggerMode = TriggerMode_Off;
-				m_cam_ptr->TriggerSource = TriggerSource_Line0;
-				// m_cam_ptr->TriggerSource = TriggerSource_Line1;
-				// m_cam_ptr->TriggerSource = TriggerSource_Line2;
-				// m_cam_ptr->TriggerSource = TriggerSource_Line2;
-				// m_cam_ptr->TriggerSource = TriggerSource_Counter0End;
-				m_cam_ptr->TriggerActivation = TriggerActivation_RisingEdge;
-				m_cam_ptr->TriggerMode = TriggerMode_On;
-				// m_cam_ptr->Counter = ;
+				m_node_cache_ptr->stage_enum(NODE_TRIGGER_SOURCE, "Line0");
+				m_node_cache_ptr->stage_enum(NODE_TRIGGER_ACTIVATION, "RisingEdge");
+				m_node_cache_ptr->stage_enum(NODE_TRIGGER_MODE, "On");
 			}
 			else
 			{
-				m_cam_ptr->TriggerMode = TriggerMode_Off;
-				m_cam_ptr->AcquisitionFrameRateEnable = true;
-				m_cam_ptr->AcquisitionFrameRate = m_cam_settings.fps;
+				m_node_cache_ptr->stage_enum(NODE_TRIGGER_MODE, "Off");
+				m_node_cache_ptr->stage_bool(NODE_ACQUISITION_FRAME_RATE_ENABLE, true);
+				m_node_cache_ptr->stage_float(NODE_ACQUISITION_FRAME_RATE, m_cam_settings.fps);
 			}
-			m_cam_ptr->ExposureMode = ExposureMode_Timed;
-			set_buffer_size(5);
+			m_node_cache_ptr->stage_enum(NODE_EXPOSURE_MODE, "Timed");
+			// one batch in dependency order, values the camera already has are not sent
+			m_node_cache_ptr->commit();
 		}
 		catch (Spinnaker::Exception &ex)
 		{
 			ROS_ERROR("ERROR SETTING CAMERA SETTINGS!!!");
 			std::cout << "Error: " << ex.what() << std::endl;
 			std::cout << "Error code " << ex.GetError() << " raised in function " << ex.GetFunctionName() << " at line " << ex.GetLineNumber() << "." << std::endl;
+			return false;
 		}
+		return true;
 	}
 
 private:
-	size_t total_size = sizeof(int8_t) * 1024;
-	void *user_buffer = malloc(total_size);
-	// void* buffer = nullptr;
+	unsigned int m_buffer_count = 5;
+	boost::shared_ptr<AcquisitionMemory> m_buffer_memory_ptr;
+	camera_startup_timing m_startup_timing;
+	CameraNodeCache *m_node_cache_ptr;
+	FrameRecorder *m_recorder_ptr;
+	// dynamic reconfigure, the newest request waits in m_pending_config for the control thread
+	std::thread m_control_thread;
+	std::mutex m_control_mutex;
+	std::condition_variable m_control_cond;
+	bool m_control_stop;
+	bool m_config_pending;
+	blackfly::BlackFlyConfig m_pending_config;
+	// last request applied, only touched by the control thread
+	blackfly::BlackFlyConfig m_applied_config;
+	// acquisition_stop switched on and not started again, ROI changes then leave acquisition alone
+	bool m_acquisition_stopped;
+	// ROI change waiting for the control thread, set_roi blocks on m_roi_done
+	bool m_roi_pending;
+	blackfly::SetRoi::Request m_roi_request;
+	std::promise<blackfly::SetRoi::Response> m_roi_done;
+	std::atomic<uint64_t> m_roi_changes;
+	std::atomic<uint64_t> m_roi_last_gap_us;
+	// highest frame rate the current window allows
+	std::atomic<double> m_max_fps;
+	// payload the stream buffers were sized for
+	uint64_t m_stream_payload;
+	std::atomic<uint64_t> m_reconf_batches;
+	std::atomic<uint64_t> m_reconf_last_us;
+	std::atomic<uint64_t> m_reconf_max_us;
+	bool m_initialized;
+	bool m_image_event_registered;
+	bool m_device_event_registered;
+	bool m_acquiring;
 	CameraPtr m_cam_ptr;
 	camera_settings m_cam_settings;
 	ImageEventHandler *m_image_event_handler_ptr;
+	AcquisitionThread *m_acquisition_thread_ptr;
 	DeviceEventHandler *m_device_event_handler_ptr;
-	image_transport::ImageTransport *m_image_transport_ptr;
-	image_transport::CameraPublisher m_cam_pub;
-	boost::shared_ptr<camera_info_manager::CameraInfoManager> m_cam_info_mgr_ptr;
-};
\ No newline at end of file
+	CameraOutputs m_outputs;
+	ros::Publisher m_clock_drift_pub;
+	ros::Publisher m_clock_residual_pub;
+	ClockEstimator m_clock_estimator;
+	std::thread m_clock_sync_thread;
+	std::mutex m_clock_sync_mutex;
+	std::condition_variable m_clock_sync_cond;
+	bool m_clock_sync_stop;
+};
+#endif // CAMERA_
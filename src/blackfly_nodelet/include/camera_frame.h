@@ -0,0 +1,88 @@
+#ifndef CAMERA_FRAME_
+#define CAMERA_FRAME_
+#include <boost/shared_ptr.hpp>
+#include <ros/ros.h>
+
+#include "Spinnaker.h"
+
+#include "frame_metadata.h"
+
+using namespace Spinnaker;
+
+// One acquired frame as the image event handler sees it, independent of the backend that produced it.
+// The pixels stay valid until release() hands the buffer back to its source, which may happen on any thread.
+class CameraFrame
+{
+	public:
+		virtual ~CameraFrame() {}
+		virtual bool incomplete() const = 0;
+		virtual PixelFormatEnums pixel_format() const = 0;
+		virtual int width() const = 0;
+		virtual int height() const = 0;
+		// bytes per row
+		virtual int stride() const = 0;
+		virtual const void *data() const = 0;
+		// chunk data sent with the frame, valid is false when there is none
+		virtual frame_metadata metadata() const = 0;
+		virtual void release() = 0;
+		// Host stamp the frame already carries, like a recorded frame, which is published as it is. False for live frames,
+		// those are stamped from the exposure end by the image event handler.
+		virtual bool host_stamp(ros::Time &p_stamp) const
+		{
+			return false;
+		}
+};
+typedef boost::shared_ptr<CameraFrame> FramePtr;
+
+// a frame acquired through spinnaker, the buffer goes back to the stream on release
+class SpinnakerFrame : public CameraFrame
+{
+	public:
+		SpinnakerFrame() {}
+		SpinnakerFrame(ImagePtr p_image) : m_image(p_image) {}
+		// reuses a pooled frame for the next image, the previous one has been released
+		void assign(ImagePtr p_image)
+		{
+			m_image = p_image;
+		}
+		bool incomplete() const
+		{
+			return m_image->IsIncomplete();
+		}
+		PixelFormatEnums pixel_format() const
+		{
+			return m_image->GetPixelFormat();
+		}
+		int width() const
+		{
+			return int(m_image->GetWidth());
+		}
+		int height() const
+		{
+			return int(m_image->GetHeight());
+		}
+		int stride() const
+		{
+			return int(m_image->GetStride());
+		}
+		const void *data() const
+		{
+			return m_image->GetData();
+		}
+		frame_metadata metadata() const
+		{
+			return read_frame_metadata(m_image);
+		}
+		void release()
+		{
+			if (m_image)
+			{
+				m_image->Release();
+				m_image = nullptr;
+			}
+		}
+
+	private:
+		ImagePtr m_image;
+};
+#endif // CAMERA_FRAME_
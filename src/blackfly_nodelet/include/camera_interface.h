@@ -0,0 +1,40 @@
+#ifndef CAMERA_INTERFACE_
+#define CAMERA_INTERFACE_
+#include <string>
+
+#include <diagnostic_msgs/DiagnosticStatus.h>
+#include <blackfly/BlackFlyConfig.h>
+#include <blackfly/SetRoi.h>
+
+// seconds spent in each startup phase of one camera
+struct camera_startup_timing
+{
+	camera_startup_timing() : enumerate(0.0), init(0.0), configure(0.0), register_events(0.0), start(0.0), ok(false), warm_start(false) {}
+	double enumerate;
+	double init;
+	double configure;
+	double register_events;
+	double start;
+	bool ok;
+	// configured with a single UserSetLoad
+	bool warm_start;
+	// why the camera failed to start, or a warning when it started anyway
+	std::string error;
+};
+
+// What the nodelet needs from one camera, whichever backend produces its frames.
+// A backend brings the camera up in its constructor and publishes through its own ImageEventHandler.
+class camera_interface
+{
+public:
+	virtual ~camera_interface() {}
+	// true when the camera is acquiring
+	virtual bool started() const = 0;
+	virtual const camera_startup_timing &get_startup_timing() const = 0;
+	virtual void fill_stats(diagnostic_msgs::DiagnosticStatus &status) = 0;
+	// applies a dynamic reconfigure request asynchronously, returns right away
+	virtual void request_reconfigure(const blackfly::BlackFlyConfig &config) = 0;
+	// moves or resizes the readout window, returns once it is applied with the window and frame rate the camera ended up with
+	virtual void set_roi(const blackfly::SetRoi::Request &request, blackfly::SetRoi::Response &response) = 0;
+};
+#endif // CAMERA_INTERFACE_
@@ -0,0 +1,204 @@
+#ifndef CLOCK_ESTIMATOR_
+#define CLOCK_ESTIMATOR_
+#include <vector>
+#include <deque>
+#include <mutex>
+#include <cmath>
+#include <cstdint>
+#include <algorithm>
+
+// Maps the camera's hardware clock onto host time.
+// Every sample pairs a device timestamp with the host time it was observed at (e.g. the midpoint of a TimestampLatch round trip).
+// Over a sliding window the estimator fits host = device + offset + drift * device with weighted least squares,
+// drops samples whose residual is more than CLOCK_OUTLIER_SIGMA robust standard deviations off and fits again.
+// All times are in nanoseconds.
+
+// samples needed before the fit is used
+#define CLOCK_MIN_SAMPLES 4
+// residual threshold for outlier rejection, in units of the median absolute deviation scaled to a standard deviation
+#define CLOCK_OUTLIER_SIGMA 3.0
+// lower bound of the rejection threshold so a near perfect fit does not reject everything [ns]
+#define CLOCK_OUTLIER_FLOOR_NS 20000.0
+
+class ClockEstimator
+{
+	public:
+		ClockEstimator(size_t p_window = 32) : m_window(p_window) {}
+
+		// uncertainty_ns is half the round trip of the observation, samples are weighted with its inverse square
+		void add_sample(int64_t device_ns, int64_t host_ns, int64_t uncertainty_ns)
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			// the camera clock was reset, the old samples no longer apply
+			if (!m_samples.empty() && device_ns <= m_samples.back().device_ns)
+			{
+				m_samples.clear();
+			}
+			clock_sample sample;
+			sample.device_ns = device_ns;
+			sample.host_ns = host_ns;
+			sample.uncertainty_ns = std::max<int64_t>(uncertainty_ns, 1000);
+			m_samples.push_back(sample);
+			while (m_samples.size() > m_window)
+			{
+				m_samples.pop_front();
+			}
+			fit();
+		}
+		bool valid()
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			return m_fit.valid;
+		}
+		// host time of a device timestamp, only meaningful while valid()
+		int64_t to_host(int64_t device_ns)
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			int64_t dd = device_ns - m_fit.device_ref_ns;
+			return m_fit.host_ref_ns + dd + int64_t(std::llround(m_fit.offset_ns + m_fit.drift * double(dd)));
+		}
+		// rate difference between the clocks [ppm], positive when the camera clock runs slow
+		double drift_ppm()
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			return m_fit.drift * 1e6;
+		}
+		// root mean square of the inlier residuals [ns]
+		double residual_rms_ns()
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			return m_fit.residual_rms_ns;
+		}
+		size_t inliers()
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			return m_fit.inliers;
+		}
+
+	private:
+		struct clock_sample
+		{
+			int64_t device_ns;
+			int64_t host_ns;
+			int64_t uncertainty_ns;
+		};
+		struct clock_fit
+		{
+			clock_fit() : valid(false), device_ref_ns(0), host_ref_ns(0), offset_ns(0.0), drift(0.0), residual_rms_ns(0.0), inliers(0) {}
+			bool valid;
+			// the fit is expressed relative to the newest sample to keep the doubles small
+			int64_t device_ref_ns;
+			int64_t host_ref_ns;
+			double offset_ns;
+			double drift;
+			double residual_rms_ns;
+			size_t inliers;
+		};
+		// weighted least squares of y = offset + drift * x over the used samples, false when degenerate
+		static bool solve(const std::vector<double> &x, const std::vector<double> &y, const std::vector<double> &w,
+							const std::vector<bool> &used, double &offset, double &drift)
+		{
+			double sw = 0, sx = 0, sy = 0;
+			for (size_t i = 0; i < x.size(); i++)
+			{
+				if (used[i])
+				{
+					sw += w[i];
+					sx += w[i] * x[i];
+					sy += w[i] * y[i];
+				}
+			}
+			if (sw <= 0)
+			{
+				return false;
+			}
+			double mx = sx / sw;
+			double my = sy / sw;
+			double sxx = 0, sxy = 0;
+			for (size_t i = 0; i < x.size(); i++)
+			{
+				if (used[i])
+				{
+					sxx += w[i] * (x[i] - mx) * (x[i] - mx);
+					sxy += w[i] * (x[i] - mx) * (y[i] - my);
+				}
+			}
+			drift = sxx > 0 ? sxy / sxx : 0.0;
+			offset = my - drift * mx;
+			return true;
+		}
+		static double median(std::vector<double> values)
+		{
+			size_t mid = values.size() / 2;
+			std::nth_element(values.begin(), values.begin() + mid, values.end());
+			return values[mid];
+		}
+		void fit()
+		{
+			size_t n = m_samples.size();
+			if (n < CLOCK_MIN_SAMPLES)
+			{
+				m_fit.valid = false;
+				return;
+			}
+			const clock_sample &ref = m_samples.back();
+			std::vector<double> x(n), y(n), w(n);
+			std::vector<bool> used(n, true);
+			for (size_t i = 0; i < n; i++)
+			{
+				x[i] = double(m_samples[i].device_ns - ref.device_ns);
+				y[i] = double((m_samples[i].host_ns - ref.host_ns) - (m_samples[i].device_ns - ref.device_ns));
+				w[i] = 1.0 / (double(m_samples[i].uncertainty_ns) * double(m_samples[i].uncertainty_ns));
+			}
+			double offset, drift;
+			if (!solve(x, y, w, used, offset, drift))
+			{
+				m_fit.valid = false;
+				return;
+			}
+			// reject outliers using the median absolute deviation of the first fit, then refit on the inliers
+			std::vector<double> residuals(n), deviations(n);
+			for (size_t i = 0; i < n; i++)
+			{
+				residuals[i] = y[i] - (offset + drift * x[i]);
+			}
+			double med = median(residuals);
+			for (size_t i = 0; i < n; i++)
+			{
+				deviations[i] = std::fabs(residuals[i] - med);
+			}
+			double threshold = std::max(CLOCK_OUTLIER_SIGMA * 1.4826 * median(deviations), CLOCK_OUTLIER_FLOOR_NS);
+			size_t inliers = 0;
+			for (size_t i = 0; i < n; i++)
+			{
+				used[i] = std::fabs(residuals[i] - med) <= threshold;
+				inliers += used[i] ? 1 : 0;
+			}
+			if (inliers < CLOCK_MIN_SAMPLES || !solve(x, y, w, used, offset, drift))
+			{
+				m_fit.valid = false;
+				return;
+			}
+			double sum_sq = 0;
+			for (size_t i = 0; i < n; i++)
+			{
+				if (used[i])
+				{
+					double r = y[i] - (offset + drift * x[i]);
+					sum_sq += r * r;
+				}
+			}
+			m_fit.valid = true;
+			m_fit.device_ref_ns = ref.device_ns;
+			m_fit.host_ref_ns = ref.host_ns;
+			m_fit.offset_ns = offset;
+			m_fit.drift = drift;
+			m_fit.residual_rms_ns = std::sqrt(sum_sq / inliers);
+			m_fit.inliers = inliers;
+		}
+		std::mutex m_mutex;
+		size_t m_window;
+		std::deque<clock_sample> m_samples;
+		clock_fit m_fit;
+};
+#endif // CLOCK_ESTIMATOR_
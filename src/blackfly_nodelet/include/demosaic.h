@@ -0,0 +1,228 @@
+#ifndef DEMOSAIC_
+#define DEMOSAIC_
+#include <vector>
+#include <cstdint>
+#include <cstdlib>
+#include <algorithm>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#include "worker_pool.h"
+
+// Host side demosaicing of the RGGB mosaic sent by the camera in bayer mode, output is interleaved BGR8.
+// The interior of every row runs through SSE2 or AVX2 kernels (whichever the build enables), borders are mirrored
+// and handled by the scalar path. Rows are split into bands which are processed on the worker pool.
+
+enum demosaic_method
+{
+	DEMOSAIC_NONE = 0,
+	// average of the nearest samples of each colour
+	DEMOSAIC_BILINEAR = 1,
+	// green is interpolated along the direction with the smaller gradient, reduces zippering on edges
+	DEMOSAIC_EDGE_AWARE = 2
+};
+
+// rows handed to one worker at a time
+#define DEMOSAIC_BAND_ROWS 32
+
+namespace demosaic
+{
+	// mirror an index into [0, n) keeping its bayer parity
+	inline int reflect(int i, int n)
+	{
+		if (i < 0)
+		{
+			return -i;
+		}
+		if (i >= n)
+		{
+			return 2 * (n - 1) - i;
+		}
+		return i;
+	}
+
+	// scalar kernel for pixels [x0, x1) of one row, a/c/b are the rows above, at and below
+	inline void row_scalar(const uint8_t *a, const uint8_t *c, const uint8_t *b, int width, int x0, int x1, bool even_row, bool edge_aware,
+							uint8_t *r_out, uint8_t *g_out, uint8_t *b_out)
+	{
+		for (int x = x0; x < x1; x++)
+		{
+			int xl = reflect(x - 1, width);
+			int xr = reflect(x + 1, width);
+			int h2 = (c[xl] + c[xr] + 1) >> 1;
+			int v2 = (a[x] + b[x] + 1) >> 1;
+			int cross = (c[xl] + c[xr] + a[x] + b[x] + 2) >> 2;
+			int diag = (a[xl] + a[xr] + b[xl] + b[xr] + 2) >> 2;
+			int green = cross;
+			if (edge_aware)
+			{
+				int dh = std::abs(c[xl] - c[xr]);
+				int dv = std::abs(a[x] - b[x]);
+				green = dh < dv ? h2 : (dv < dh ? v2 : cross);
+			}
+			bool even_col = (x & 1) == 0;
+			if (even_row)
+			{
+				r_out[x] = even_col ? c[x] : h2;
+				g_out[x] = even_col ? green : c[x];
+				b_out[x] = even_col ? diag : v2;
+			}
+			else
+			{
+				r_out[x] = even_col ? v2 : diag;
+				g_out[x] = even_col ? c[x] : green;
+				b_out[x] = even_col ? h2 : c[x];
+			}
+		}
+	}
+
+#if defined(__AVX2__)
+	#define DEMOSAIC_VECTOR_PIXELS 16
+	typedef __m256i vec16;
+	inline vec16 load16(const uint8_t *p)
+	{
+		return _mm256_cvtepu8_epi16(_mm_loadu_si128(reinterpret_cast<const __m128i *>(p)));
+	}
+	inline void store8(uint8_t *p, vec16 v)
+	{
+		__m256i packed = _mm256_permute4x64_epi64(_mm256_packus_epi16(v, v), 0x08);
+		_mm_storeu_si128(reinterpret_cast<__m128i *>(p), _mm256_castsi256_si128(packed));
+	}
+	inline vec16 add(vec16 a, vec16 b) { return _mm256_add_epi16(a, b); }
+	inline vec16 shr(vec16 a, int n) { return _mm256_srli_epi16(a, n); }
+	inline vec16 set1(short v) { return _mm256_set1_epi16(v); }
+	inline vec16 absdiff(vec16 a, vec16 b) { return _mm256_sub_epi16(_mm256_max_epi16(a, b), _mm256_min_epi16(a, b)); }
+	inline vec16 less(vec16 a, vec16 b) { return _mm256_cmpgt_epi16(b, a); }
+	inline vec16 select(vec16 m, vec16 a, vec16 b) { return _mm256_or_si256(_mm256_and_si256(m, a), _mm256_andnot_si256(m, b)); }
+	inline vec16 even_lanes() { return _mm256_set_epi16(0, -1, 0, -1, 0, -1, 0, -1, 0, -1, 0, -1, 0, -1, 0, -1); }
+#elif defined(__SSE2__)
+	#define DEMOSAIC_VECTOR_PIXELS 8
+	typedef __m128i vec16;
+	inline vec16 load16(const uint8_t *p)
+	{
+		return _mm_unpacklo_epi8(_mm_loadl_epi64(reinterpret_cast<const __m128i *>(p)), _mm_setzero_si128());
+	}
+	inline void store8(uint8_t *p, vec16 v)
+	{
+		_mm_storel_epi64(reinterpret_cast<__m128i *>(p), _mm_packus_epi16(v, v));
+	}
+	inline vec16 add(vec16 a, vec16 b) { return _mm_add_epi16(a, b); }
+	inline vec16 shr(vec16 a, int n) { return _mm_srli_epi16(a, n); }
+	inline vec16 set1(short v) { return _mm_set1_epi16(v); }
+	inline vec16 absdiff(vec16 a, vec16 b) { return _mm_sub_epi16(_mm_max_epi16(a, b), _mm_min_epi16(a, b)); }
+	inline vec16 less(vec16 a, vec16 b) { return _mm_cmplt_epi16(a, b); }
+	inline vec16 select(vec16 m, vec16 a, vec16 b) { return _mm_or_si128(_mm_and_si128(m, a), _mm_andnot_si128(m, b)); }
+	inline vec16 even_lanes() { return _mm_set_epi16(0, -1, 0, -1, 0, -1, 0, -1); }
+#endif
+
+#ifdef DEMOSAIC_VECTOR_PIXELS
+	// vector kernel, x0 must be even and the pixels [x0 - 1, x1 + 1) inside the row. Returns the first pixel not processed.
+	inline int row_vector(const uint8_t *a, const uint8_t *c, const uint8_t *b, int x0, int x1, bool even_row, bool edge_aware,
+							uint8_t *r_out, uint8_t *g_out, uint8_t *b_out)
+	{
+		const vec16 one = set1(1);
+		const vec16 two = set1(2);
+		const vec16 even = even_lanes();
+		int x = x0;
+		for (; x + DEMOSAIC_VECTOR_PIXELS <= x1; x += DEMOSAIC_VECTOR_PIXELS)
+		{
+			vec16 cl = load16(c + x - 1);
+			vec16 cc = load16(c + x);
+			vec16 cr = load16(c + x + 1);
+			vec16 al = load16(a + x - 1);
+			vec16 ac = load16(a + x);
+			vec16 ar = load16(a + x + 1);
+			vec16 bl = load16(b + x - 1);
+			vec16 bc = load16(b + x);
+			vec16 br = load16(b + x + 1);
+			vec16 hsum = add(cl, cr);
+			vec16 vsum = add(ac, bc);
+			vec16 h2 = shr(add(hsum, one), 1);
+			vec16 v2 = shr(add(vsum, one), 1);
+			vec16 cross = shr(add(add(hsum, vsum), two), 2);
+			vec16 diag = shr(add(add(add(al, ar), add(bl, br)), two), 2);
+			vec16 green = cross;
+			if (edge_aware)
+			{
+				vec16 dh = absdiff(cl, cr);
+				vec16 dv = absdiff(ac, bc);
+				green = select(less(dh, dv), h2, select(less(dv, dh), v2, cross));
+			}
+			if (even_row)
+			{
+				store8(r_out + x, select(even, cc, h2));
+				store8(g_out + x, select(even, green, cc));
+				store8(b_out + x, select(even, diag, v2));
+			}
+			else
+			{
+				store8(r_out + x, select(even, v2, diag));
+				store8(g_out + x, select(even, cc, green));
+				store8(b_out + x, select(even, h2, cc));
+			}
+		}
+		return x;
+	}
+#endif
+
+	// demosaic rows [y0, y1) of an RGGB8 mosaic into BGR8
+	inline void rggb8_rows(const uint8_t *src, size_t src_step, uint8_t *dst, size_t dst_step, int width, int height, int y0, int y1, bool edge_aware)
+	{
+		// per thread planar scratch rows, only grow when the resolution does
+		static thread_local std::vector<uint8_t> planes;
+		if (planes.size() < size_t(width) * 3)
+		{
+			planes.resize(size_t(width) * 3);
+		}
+		uint8_t *r_row = &planes[0];
+		uint8_t *g_row = r_row + width;
+		uint8_t *b_row = g_row + width;
+		for (int y = y0; y < y1; y++)
+		{
+			const uint8_t *a = src + reflect(y - 1, height) * src_step;
+			const uint8_t *c = src + y * src_step;
+			const uint8_t *b = src + reflect(y + 1, height) * src_step;
+			bool even_row = (y & 1) == 0;
+			int x = 0;
+#ifdef DEMOSAIC_VECTOR_PIXELS
+			row_scalar(a, c, b, width, 0, 2, even_row, edge_aware, r_row, g_row, b_row);
+			x = row_vector(a, c, b, 2, width - 1, even_row, edge_aware, r_row, g_row, b_row);
+#endif
+			row_scalar(a, c, b, width, x, width, even_row, edge_aware, r_row, g_row, b_row);
+			uint8_t *out = dst + y * dst_step;
+			for (int i = 0; i < width; i++)
+			{
+				out[3 * i] = b_row[i];
+				out[3 * i + 1] = g_row[i];
+				out[3 * i + 2] = r_row[i];
+			}
+		}
+	}
+} // namespace demosaic
+
+// Demosaic a full RGGB8 frame into BGR8. Without a pool (or for tiny frames) everything runs on the calling thread.
+inline void demosaic_rggb8(const uint8_t *src, size_t src_step, uint8_t *dst, size_t dst_step, int width, int height,
+							demosaic_method method, WorkerPool *pool)
+{
+	if (width < 2 || height < 2 || method == DEMOSAIC_NONE)
+	{
+		return;
+	}
+	bool edge_aware = method == DEMOSAIC_EDGE_AWARE;
+	int bands = (height + DEMOSAIC_BAND_ROWS - 1) / DEMOSAIC_BAND_ROWS;
+	if (pool == nullptr || bands == 1)
+	{
+		demosaic::rggb8_rows(src, src_step, dst, dst_step, width, height, 0, height, edge_aware);
+		return;
+	}
+	pool->parallel_for(bands, [=](size_t band) {
+		int y0 = int(band) * DEMOSAIC_BAND_ROWS;
+		int y1 = std::min(height, y0 + DEMOSAIC_BAND_ROWS);
+		demosaic::rggb8_rows(src, src_step, dst, dst_step, width, height, y0, y1, edge_aware);
+	});
+}
+#endif // DEMOSAIC_
@@ -7,6 +7,7 @@
 #include <ros/ros.h>
 #include <deque>
 #include <mutex>
+#include "exposure_event_ring.h"
 
 using namespace Spinnaker;
 using namespace Spinnaker::GenApi;
@@ -15,10 +16,17 @@ using namespace Spinnaker::GenICam;
 class DeviceEventHandler : public DeviceEvent
 {
 	public:
-		DeviceEventHandler(CameraPtr cam_ptr)
+		DeviceEventHandler(CameraPtr cam_ptr, double match_tolerance = 0.002)
 		{
 			// save the camera pointer
 			m_cam_ptr = cam_ptr;
+			m_match_tolerance = std::chrono::microseconds(int64_t(match_tolerance * 1e6));
+			m_frame_ids_valid = true;
+			// a backend without a spinnaker camera reports its events through exposure_end
+			if (!m_cam_ptr)
+			{
+				return;
+			}
 			// get the GENAPI node map
 			INodeMap &node_map = m_cam_ptr->GetNodeMap();
 			try
@@ -73,39 +81,74 @@ class DeviceEventHandler : public DeviceEvent
 		{
 			if(eventName == "EventExposureEnd")
 			{
-				// lock the mutex to prevent changes to member timestamp object
-				timestamp_mutex.lock();
 				// get the now time as the end of the exposure
-				m_last_frame_time = ros::Time::now();
-				// unlock the mutex 
-				timestamp_mutex.unlock();
+				ros::Time now = ros::Time::now();
+				// the frame id comes with the event data, it is what the image is matched against
+				uint64_t frame_id = 0;
+				if(m_frame_ids_valid)
+				{
+					try
+					{
+						frame_id = m_cam_ptr->EventExposureEndFrameID.GetValue();
+					}
+					catch (Spinnaker::Exception &e)
+					{
+						ROS_WARN("Blackfly Nodelet: Exposure end events carry no frame id, matching images to the newest event");
+						m_frame_ids_valid = false;
+					}
+				}
+				exposure_end(frame_id, now.toNSec());
 			}
 		}
-		ros::Time get_last_exposure_end()
+		// records the end of the exposure of frame_id at stamp_ns
+		void exposure_end(uint64_t frame_id, int64_t stamp_ns)
+		{
+			m_event_ring.push(frame_id, stamp_ns);
+		}
+		// Stamp of the exposure end event of frame_id. If the image arrived first this waits up to the match tolerance for the event, unless wait is false.
+		// Returns false when there is no event for the frame, or the events carry no frame ids.
+		bool get_exposure_end(uint64_t frame_id, ros::Time &stamp, bool wait = true)
 		{
-			if(m_last_frame_time.toSec() == 0.0)
+			int64_t stamp_ns;
+			if(!m_frame_ids_valid || !m_event_ring.match(frame_id, wait ? m_match_tolerance : std::chrono::microseconds(0), stamp_ns))
 			{
-				return ros::Time(0,0);
+				return false;
 			}
-			else
+			stamp.fromNSec(stamp_ns);
+			return true;
+		}
+		// newest exposure end event not yet reported, ros::Time(0,0) if there is none. For images without a frame id.
+		ros::Time get_last_exposure_end()
+		{
+			int64_t stamp_ns;
+			if(!m_event_ring.take_newest(stamp_ns))
 			{
-				// lock the mutex to prevent changes to the member timestamp object
-				timestamp_mutex.lock();
-				// get the last frame time
-				ros::Time stamp = m_last_frame_time;
-				// assign the member timestamp to 0 to indicate it's already been reported
-				m_last_frame_time = ros::Time(0,0);
-				// unlock the mutex 
-				timestamp_mutex.unlock();
-				// return the stamp
-				return stamp;
+				return ros::Time(0,0);
 			}
+			ros::Time stamp;
+			stamp.fromNSec(stamp_ns);
+			return stamp;
+		}
+		// call right before AcquisitionStart, the frame ids start over and the events of the last run are stale
+		void acquisition_restarted()
+		{
+			m_event_ring.restart();
+		}
+		bool frame_ids_valid()
+		{
+			return m_frame_ids_valid;
+		}
+		const ExposureEventRing &get_event_ring()
+		{
+			return m_event_ring;
 		}
 	private:
-		// member mutex to lock the timestamp member when is set/get
-		std::mutex timestamp_mutex; 
-		// initialize the timestamp member to 0.0 to indicate it has not been set
-		ros::Time m_last_frame_time = ros::Time(0,0);
+		// exposure end events waiting for their image, written by the event thread and read by the image thread
+		ExposureEventRing m_event_ring;
+		// how long an image waits for an event delivered after it
+		std::chrono::microseconds m_match_tolerance;
+		// cleared if the camera does not report the frame id with its events
+		std::atomic<bool> m_frame_ids_valid;
 		// Camera pointer to spinnaker camera object (used to get the current exposure time)
 		CameraPtr m_cam_ptr;
 };
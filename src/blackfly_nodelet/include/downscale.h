@@ -0,0 +1,150 @@
+#ifndef DOWNSCALE_
+#define DOWNSCALE_
+#include <cstdint>
+#include <cstddef>
+#include <algorithm>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#include "worker_pool.h"
+
+// Halving of 8 bit frames for the image pyramid topics. Every output pixel is the rounded mean of a 2x2 block
+// (area filter), odd last rows and columns are left out. Single channel rows run through SSE2 or AVX2 kernels
+// (whichever the build enables), interleaved BGR rows and the tails through the scalar path.
+// An RGGB mosaic is halved by turning every 2x2 cell into one BGR pixel, the half level of a bayer camera is colour.
+// Rows are split into bands which are processed on the worker pool.
+
+// output rows handed to one worker at a time
+#define DOWNSCALE_BAND_ROWS 32
+
+namespace downscale
+{
+	// scalar 2x2 mean of output pixels [x0, x1) of one row, a and b are the two source rows
+	inline void row_scalar(const uint8_t *a, const uint8_t *b, uint8_t *out, int channels, int x0, int x1)
+	{
+		for (int x = x0; x < x1; x++)
+		{
+			for (int c = 0; c < channels; c++)
+			{
+				int i = 2 * x * channels + c;
+				out[x * channels + c] = uint8_t((a[i] + a[i + channels] + b[i] + b[i + channels] + 2) >> 2);
+			}
+		}
+	}
+
+#if defined(__AVX2__)
+	#define DOWNSCALE_VECTOR_PIXELS 16
+	// 2x2 mean of 16 output pixels from 32 bytes of each source row. Returns the first pixel not processed.
+	inline int row_vector(const uint8_t *a, const uint8_t *b, uint8_t *out, int width_out)
+	{
+		const __m256i low = _mm256_set1_epi16(0x00ff);
+		const __m256i two = _mm256_set1_epi16(2);
+		int x = 0;
+		for (; x + DOWNSCALE_VECTOR_PIXELS <= width_out; x += DOWNSCALE_VECTOR_PIXELS)
+		{
+			__m256i va = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(a + 2 * x));
+			__m256i vb = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(b + 2 * x));
+			// even and odd bytes as 16 bit lanes, one lane per output pixel
+			__m256i sum = _mm256_add_epi16(_mm256_add_epi16(_mm256_and_si256(va, low), _mm256_srli_epi16(va, 8)),
+											_mm256_add_epi16(_mm256_and_si256(vb, low), _mm256_srli_epi16(vb, 8)));
+			sum = _mm256_srli_epi16(_mm256_add_epi16(sum, two), 2);
+			__m256i packed = _mm256_permute4x64_epi64(_mm256_packus_epi16(sum, sum), 0x08);
+			_mm_storeu_si128(reinterpret_cast<__m128i *>(out + x), _mm256_castsi256_si128(packed));
+		}
+		return x;
+	}
+#elif defined(__SSE2__)
+	#define DOWNSCALE_VECTOR_PIXELS 8
+	// 2x2 mean of 8 output pixels from 16 bytes of each source row. Returns the first pixel not processed.
+	inline int row_vector(const uint8_t *a, const uint8_t *b, uint8_t *out, int width_out)
+	{
+		const __m128i low = _mm_set1_epi16(0x00ff);
+		const __m128i two = _mm_set1_epi16(2);
+		int x = 0;
+		for (; x + DOWNSCALE_VECTOR_PIXELS <= width_out; x += DOWNSCALE_VECTOR_PIXELS)
+		{
+			__m128i va = _mm_loadu_si128(reinterpret_cast<const __m128i *>(a + 2 * x));
+			__m128i vb = _mm_loadu_si128(reinterpret_cast<const __m128i *>(b + 2 * x));
+			// even and odd bytes as 16 bit lanes, one lane per output pixel
+			__m128i sum = _mm_add_epi16(_mm_add_epi16(_mm_and_si128(va, low), _mm_srli_epi16(va, 8)),
+										_mm_add_epi16(_mm_and_si128(vb, low), _mm_srli_epi16(vb, 8)));
+			sum = _mm_srli_epi16(_mm_add_epi16(sum, two), 2);
+			_mm_storel_epi64(reinterpret_cast<__m128i *>(out + x), _mm_packus_epi16(sum, sum));
+		}
+		return x;
+	}
+#endif
+
+	inline void half_rows(const uint8_t *src, size_t src_step, uint8_t *dst, size_t dst_step, int width_out, int channels, int y0, int y1)
+	{
+		for (int y = y0; y < y1; y++)
+		{
+			const uint8_t *a = src + size_t(2 * y) * src_step;
+			const uint8_t *b = a + src_step;
+			uint8_t *out = dst + size_t(y) * dst_step;
+			int x = 0;
+#ifdef DOWNSCALE_VECTOR_PIXELS
+			if (channels == 1)
+			{
+				x = row_vector(a, b, out, width_out);
+			}
+#endif
+			row_scalar(a, b, out, channels, x, width_out);
+		}
+	}
+
+	// one BGR pixel per RGGB cell, the two greens averaged
+	inline void rggb8_half_rows(const uint8_t *src, size_t src_step, uint8_t *dst, size_t dst_step, int width_out, int y0, int y1)
+	{
+		for (int y = y0; y < y1; y++)
+		{
+			const uint8_t *a = src + size_t(2 * y) * src_step;
+			const uint8_t *b = a + src_step;
+			uint8_t *out = dst + size_t(y) * dst_step;
+			for (int x = 0; x < width_out; x++)
+			{
+				out[3 * x] = b[2 * x + 1];
+				out[3 * x + 1] = uint8_t((a[2 * x + 1] + b[2 * x] + 1) >> 1);
+				out[3 * x + 2] = a[2 * x];
+			}
+		}
+	}
+
+	template <typename F>
+	inline void for_bands(int height_out, WorkerPool *pool, F rows)
+	{
+		int bands = (height_out + DOWNSCALE_BAND_ROWS - 1) / DOWNSCALE_BAND_ROWS;
+		if (pool == nullptr || bands <= 1)
+		{
+			rows(0, height_out);
+			return;
+		}
+		pool->parallel_for(bands, [=](size_t band) {
+			int y0 = int(band) * DOWNSCALE_BAND_ROWS;
+			rows(y0, std::min(height_out, y0 + DOWNSCALE_BAND_ROWS));
+		});
+	}
+} // namespace downscale
+
+// Halve a width x height frame of 1 or 3 interleaved 8 bit channels into dst, which holds width / 2 x height / 2 pixels.
+inline void downscale_half8(const uint8_t *src, size_t src_step, uint8_t *dst, size_t dst_step, int width, int height, int channels, WorkerPool *pool)
+{
+	int width_out = width / 2;
+	downscale::for_bands(height / 2, pool, [=](int y0, int y1) {
+		downscale::half_rows(src, src_step, dst, dst_step, width_out, channels, y0, y1);
+	});
+}
+
+// Halve an RGGB8 mosaic into BGR8 with width / 2 x height / 2 pixels.
+inline void downscale_half_rggb8(const uint8_t *src, size_t src_step, uint8_t *dst, size_t dst_step, int width, int height, WorkerPool *pool)
+{
+	int width_out = width / 2;
+	downscale::for_bands(height / 2, pool, [=](int y0, int y1) {
+		downscale::rggb8_half_rows(src, src_step, dst, dst_step, width_out, y0, y1);
+	});
+}
+#endif // DOWNSCALE_
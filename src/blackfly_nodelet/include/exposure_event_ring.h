@@ -0,0 +1,205 @@
+#ifndef EXPOSURE_EVENT_RING_
+#define EXPOSURE_EVENT_RING_
+#include <atomic>
+#include <cstdint>
+#include <chrono>
+#include <thread>
+
+// Fixed size ring of exposure end events written by the device event thread and matched by the image thread.
+// The writer never blocks: when the reader falls behind by more than the ring size the oldest events are overwritten.
+// Each slot is guarded by a sequence number so the reader detects a slot being rewritten underneath it.
+
+// must be a power of two
+#define EXPOSURE_EVENT_RING_SIZE 64
+
+struct exposure_event
+{
+	uint64_t frame_id;
+	// host time the event was delivered [ns]
+	int64_t stamp_ns;
+};
+
+class ExposureEventRing
+{
+	public:
+		ExposureEventRing() : m_head(0), m_restart(0), m_tail(0), m_last_frame_id(0), m_last_frame_id_valid(false), m_matched(0), m_late(0), m_missed(0), m_dropped(0)
+		{
+			for (size_t i = 0; i < EXPOSURE_EVENT_RING_SIZE; i++)
+			{
+				m_slots[i].seq.store(0);
+			}
+		}
+		// device event thread only
+		void push(uint64_t frame_id, int64_t stamp_ns)
+		{
+			uint64_t pos = m_head.load(std::memory_order_relaxed);
+			event_slot &slot = m_slots[pos & (EXPOSURE_EVENT_RING_SIZE - 1)];
+			slot.seq.store(2 * pos + 1, std::memory_order_relaxed);
+			std::atomic_thread_fence(std::memory_order_release);
+			slot.frame_id.store(frame_id, std::memory_order_relaxed);
+			slot.stamp_ns.store(stamp_ns, std::memory_order_relaxed);
+			slot.seq.store(2 * pos + 2, std::memory_order_release);
+			m_head.store(pos + 1, std::memory_order_release);
+		}
+		// Any thread, before acquisition starts again. The camera counts frame ids from 0 after a restart, so the events
+		// still in the ring would never match an image again. The image thread skips them on its next match.
+		void restart()
+		{
+			m_restart.store(m_head.load(std::memory_order_acquire), std::memory_order_release);
+		}
+		// Image thread only. Finds the event of frame_id, events of older frames that never got an image are skipped.
+		// When the image arrived before its event, waits up to tolerance for it. Returns false if there is no match,
+		// right away once an event at or after frame_id went by, since events arrive in frame order.
+		bool match(uint64_t frame_id, std::chrono::microseconds tolerance, int64_t &stamp_ns)
+		{
+			apply_restart();
+			std::chrono::steady_clock::time_point deadline = std::chrono::steady_clock::now() + tolerance;
+			bool waited = false;
+			while (true)
+			{
+				exposure_event event;
+				while (peek(event))
+				{
+					if (event.frame_id == frame_id)
+					{
+						consume(event);
+						stamp_ns = event.stamp_ns;
+						m_matched++;
+						if (waited)
+						{
+							m_late++;
+						}
+						return true;
+					}
+					if (event.frame_id > frame_id)
+					{
+						// the event of this frame was lost, keep the newer one for its own image
+						m_missed++;
+						return false;
+					}
+					// frame of this event was dropped or incomplete
+					consume(event);
+					m_dropped++;
+				}
+				if ((m_last_frame_id_valid && m_last_frame_id >= frame_id) || std::chrono::steady_clock::now() >= deadline)
+				{
+					m_missed++;
+					return false;
+				}
+				waited = true;
+				std::this_thread::sleep_for(std::chrono::microseconds(50));
+			}
+		}
+		// Image thread only. Takes the newest event and discards everything before it, for frames without a frame id.
+		bool take_newest(int64_t &stamp_ns)
+		{
+			apply_restart();
+			exposure_event event;
+			bool found = false;
+			while (peek(event))
+			{
+				if (found)
+				{
+					m_dropped++;
+				}
+				consume(event);
+				stamp_ns = event.stamp_ns;
+				found = true;
+			}
+			if (!found)
+			{
+				m_missed++;
+			}
+			return found;
+		}
+		// frames matched with their event
+		uint64_t matched() const
+		{
+			return m_matched.load();
+		}
+		// matches for which the image arrived before its event
+		uint64_t late() const
+		{
+			return m_late.load();
+		}
+		// frames without an event, stamped with their arrival time
+		uint64_t missed() const
+		{
+			return m_missed.load();
+		}
+		// events never claimed by an image or overwritten before the image thread got to them
+		uint64_t dropped() const
+		{
+			return m_dropped.load();
+		}
+
+	private:
+		struct event_slot
+		{
+			std::atomic<uint64_t> seq;
+			std::atomic<uint64_t> frame_id;
+			std::atomic<int64_t> stamp_ns;
+		};
+		void consume(const exposure_event &event)
+		{
+			m_tail++;
+			m_last_frame_id = event.frame_id;
+			m_last_frame_id_valid = true;
+		}
+		// skips the events from before the last restart, they are not counted as dropped
+		void apply_restart()
+		{
+			uint64_t restart = m_restart.load(std::memory_order_acquire);
+			if (restart > m_tail)
+			{
+				m_tail = restart;
+				m_last_frame_id_valid = false;
+			}
+		}
+		// reads the event at the tail without consuming it, skipping whatever the writer has lapped
+		bool peek(exposure_event &event)
+		{
+			while (true)
+			{
+				uint64_t head = m_head.load(std::memory_order_acquire);
+				if (m_tail >= head)
+				{
+					return false;
+				}
+				if (head - m_tail > EXPOSURE_EVENT_RING_SIZE)
+				{
+					m_dropped += head - m_tail - EXPOSURE_EVENT_RING_SIZE;
+					m_tail = head - EXPOSURE_EVENT_RING_SIZE;
+				}
+				const event_slot &slot = m_slots[m_tail & (EXPOSURE_EVENT_RING_SIZE - 1)];
+				uint64_t seq = slot.seq.load(std::memory_order_acquire);
+				event.frame_id = slot.frame_id.load(std::memory_order_relaxed);
+				event.stamp_ns = slot.stamp_ns.load(std::memory_order_relaxed);
+				std::atomic_thread_fence(std::memory_order_acquire);
+				if (seq == 2 * m_tail + 2 && slot.seq.load(std::memory_order_relaxed) == seq)
+				{
+					return true;
+				}
+				// overwritten while reading, the writer has moved on so the next pass skips ahead
+				if (seq > 2 * m_tail + 2)
+				{
+					m_tail++;
+					m_dropped++;
+				}
+			}
+		}
+		event_slot m_slots[EXPOSURE_EVENT_RING_SIZE];
+		std::atomic<uint64_t> m_head;
+		// head at the last restart, the image thread starts from there
+		std::atomic<uint64_t> m_restart;
+		// only touched by the image thread
+		uint64_t m_tail;
+		// newest event consumed, an image with an id up to it will not get an event any more
+		uint64_t m_last_frame_id;
+		bool m_last_frame_id_valid;
+		std::atomic<uint64_t> m_matched;
+		std::atomic<uint64_t> m_late;
+		std::atomic<uint64_t> m_missed;
+		std::atomic<uint64_t> m_dropped;
+};
+#endif // EXPOSURE_EVENT_RING_
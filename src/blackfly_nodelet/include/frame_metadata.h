@@ -0,0 +1,54 @@
+#ifndef FRAME_METADATA_
+#define FRAME_METADATA_
+#include <cstdint>
+
+#include "Spinnaker.h"
+#include "SpinGenApi/SpinnakerGenApi.h"
+
+using namespace Spinnaker;
+
+// Values the camera attaches to every frame as chunk data. Reading them only parses the image payload,
+// unlike the GenICam nodes which cost a USB round trip and report the current setting instead of the one used.
+struct frame_metadata
+{
+	frame_metadata()
+	{
+		valid = false;
+		frame_id = 0;
+		device_timestamp = 0;
+		exposure_time = 0.0;
+		gain = 0.0;
+	}
+	// false when the frame carries no chunk data
+	bool valid;
+	uint64_t frame_id;
+	// camera clock [ns]
+	int64_t device_timestamp;
+	// [us]
+	double exposure_time;
+	// [dB]
+	double gain;
+};
+
+// chunks the camera enables, the image itself has to stay on
+static const char *const frame_metadata_chunks[] = {"Image", "FrameID", "Timestamp", "ExposureTime", "Gain"};
+
+inline frame_metadata read_frame_metadata(ImagePtr image)
+{
+	frame_metadata meta;
+	try
+	{
+		const ChunkData &chunk = image->GetChunkData();
+		meta.frame_id = chunk.GetFrameID();
+		meta.device_timestamp = chunk.GetTimestamp();
+		meta.exposure_time = chunk.GetExposureTime();
+		meta.gain = chunk.GetGain();
+		meta.valid = true;
+	}
+	catch (Spinnaker::Exception &e)
+	{
+		meta.valid = false;
+	}
+	return meta;
+}
+#endif // FRAME_METADATA_
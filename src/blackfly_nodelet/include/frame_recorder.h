@@ -0,0 +1,404 @@
+#ifndef FRAME_RECORDER_
+#define FRAME_RECORDER_
+#include <string>
+#include <cstring>
+#include <cerrno>
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <chrono>
+#include <condition_variable>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include <ros/ros.h>
+#include <diagnostic_msgs/DiagnosticStatus.h>
+
+#include "recording_format.h"
+#include "acquisition_memory.h"
+#include "frame_metadata.h"
+#include "latency_histogram.h"
+#include "spsc_queue.h"
+#include "stats.h"
+
+// Writes the raw frames of one camera to preallocated segment files, see recording_format.h for the layout.
+// The image thread only copies the frame into a free staging slot and queues it, a writer thread per camera
+// writes the slot with O_DIRECT and then appends its index entry. Staging slots are allocated once, page aligned and locked.
+// When the disk stalls and every slot is still waiting, new frames are left out of the recording and counted,
+// acquisition and publishing never wait for the disk.
+
+class FrameRecorder
+{
+	public:
+		FrameRecorder(const std::string &p_cam_name, const std::string &p_dir, size_t p_max_payload, size_t p_slots, uint64_t p_segment_size)
+			: m_free_slots(p_slots > 0 ? p_slots : 1), m_pending(p_slots > 0 ? p_slots : 1)
+		{
+			m_cam_name = p_cam_name;
+			m_dir = p_dir;
+			m_num_slots = p_slots > 0 ? p_slots : 1;
+			m_slot_size = recorded_frame_size(p_max_payload);
+			m_max_payload = m_slot_size - sizeof(recorded_frame);
+			// at least one record per segment, whole alignment blocks so every record offset stays aligned
+			m_segment_size = std::max<uint64_t>(p_segment_size, m_slot_size) / RECORD_ALIGNMENT * RECORD_ALIGNMENT;
+			m_memory_ptr = nullptr;
+			m_segment_fd = -1;
+			m_next_segment_fd = -1;
+			m_index_fd = -1;
+			m_segment = 0;
+			m_offset = 0;
+			m_sequence = 0;
+			m_direct_io = true;
+			m_stop = false;
+			m_frames = 0;
+			m_dropped = 0;
+			m_oversized = 0;
+			m_bytes = 0;
+			m_write_errors = 0;
+			m_stalled = false;
+		}
+		~FrameRecorder()
+		{
+			stop();
+			delete m_memory_ptr;
+		}
+		// creates the recording directory, the first segments and the index, then starts the writer thread
+		bool start()
+		{
+			mkdir(m_dir.c_str(), 0755);
+			m_memory_ptr = new AcquisitionMemory(m_slot_size * m_num_slots);
+			if (!m_memory_ptr->valid())
+			{
+				return false;
+			}
+			for (size_t i = 0; i < m_num_slots; i++)
+			{
+				m_free_slots.push(i);
+			}
+			m_index_fd = open(recording_index_path(m_dir).c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+			if (m_index_fd < 0)
+			{
+				ROS_ERROR("Blackfly Nodelet: Failed to create the recording index in %s: %s", m_dir.c_str(), std::strerror(errno));
+				return false;
+			}
+			recording_index_header header;
+			std::memset(&header, 0, sizeof(header));
+			header.magic = RECORDING_INDEX_MAGIC;
+			header.version = RECORDING_VERSION;
+			header.entry_size = sizeof(recorded_frame);
+			header.alignment = RECORD_ALIGNMENT;
+			header.segment_size = m_segment_size;
+			strncpy(header.cam_name, m_cam_name.c_str(), sizeof(header.cam_name) - 1);
+			if (!write_all(m_index_fd, &header, sizeof(header)))
+			{
+				return false;
+			}
+			m_next_segment_fd = open_segment(0);
+			if (m_next_segment_fd < 0)
+			{
+				return false;
+			}
+			if (!next_segment())
+			{
+				return false;
+			}
+			m_writer_thread = std::thread(&FrameRecorder::writer_loop, this);
+			ROS_INFO("Blackfly Nodelet: Recording camera %s to %s (%zu staging slots of %.1f MB%s)", m_cam_name.c_str(), m_dir.c_str(), m_num_slots,
+						m_slot_size / 1048576.0, m_direct_io ? "" : ", buffered io");
+			return true;
+		}
+		// Writes out everything queued, trims the last segment to its records and closes the files.
+		void stop()
+		{
+			if (m_writer_thread.joinable())
+			{
+				{
+					std::lock_guard<std::mutex> lock(m_mutex);
+					m_stop = true;
+				}
+				m_cond.notify_all();
+				m_writer_thread.join();
+			}
+			// the prepared segment follows the one in use, or is the first one when none was opened
+			uint32_t prepared_segment = m_segment_fd >= 0 ? m_segment + 1 : m_segment;
+			if (m_segment_fd >= 0)
+			{
+				if (ftruncate(m_segment_fd, m_offset) != 0)
+				{
+					ROS_WARN("Blackfly Nodelet: Failed to trim recording segment of camera %s: %s", m_cam_name.c_str(), std::strerror(errno));
+				}
+				close(m_segment_fd);
+				m_segment_fd = -1;
+			}
+			if (m_next_segment_fd >= 0)
+			{
+				// prepared but never written
+				close(m_next_segment_fd);
+				m_next_segment_fd = -1;
+				unlink(recording_segment_path(m_dir, prepared_segment).c_str());
+			}
+			if (m_index_fd >= 0)
+			{
+				fsync(m_index_fd);
+				close(m_index_fd);
+				m_index_fd = -1;
+			}
+		}
+		// Copies one frame into a staging slot for the writer, called by the image thread of the camera only.
+		// Returns false when the frame is left out of the recording.
+		bool record(const void *p_data, size_t p_payload_size, const std::string &p_encoding, uint32_t p_width, uint32_t p_height, uint32_t p_step,
+					ros::Time p_stamp, ros::Time p_arrival, const frame_metadata &p_metadata)
+		{
+			if (p_payload_size > m_max_payload)
+			{
+				m_oversized++;
+				ROS_WARN_THROTTLE(1.0, "Blackfly Nodelet: Frame of %zu bytes does not fit the recording slots of camera %s", p_payload_size, m_cam_name.c_str());
+				return false;
+			}
+			size_t slot;
+			if (!m_free_slots.pop(slot))
+			{
+				m_dropped++;
+				ROS_WARN_THROTTLE(1.0, "Blackfly Nodelet: Recording of camera %s falls behind, frame left out", m_cam_name.c_str());
+				return false;
+			}
+			uint8_t *record = slot_data(slot);
+			recorded_frame *header = reinterpret_cast<recorded_frame *>(record);
+			std::memset(header, 0, sizeof(recorded_frame));
+			header->magic = RECORDING_MAGIC;
+			header->version = RECORDING_VERSION;
+			header->stamp_ns = int64_t(p_stamp.toNSec());
+			header->arrival_ns = int64_t(p_arrival.toNSec());
+			header->metadata_valid = p_metadata.valid ? 1 : 0;
+			header->frame_id = p_metadata.frame_id;
+			header->device_timestamp = p_metadata.device_timestamp;
+			header->exposure_time = p_metadata.exposure_time;
+			header->gain = p_metadata.gain;
+			header->payload_size = uint32_t(p_payload_size);
+			header->width = p_width;
+			header->height = p_height;
+			header->step = p_step;
+			strncpy(header->encoding, p_encoding.c_str(), sizeof(header->encoding) - 1);
+			std::memcpy(record + sizeof(recorded_frame), p_data, p_payload_size);
+			m_pending.push(slot);
+			m_cond.notify_one();
+			return true;
+		}
+		void fill_stats(diagnostic_msgs::DiagnosticStatus &status)
+		{
+			add_stat(status, "record_frames", m_frames.load());
+			add_stat(status, "record_dropped", m_dropped.load());
+			add_stat(status, "record_oversized", m_oversized.load());
+			add_stat(status, "record_write_errors", m_write_errors.load());
+			add_stat(status, "record_stalled", m_stalled.load());
+			if (m_stalled)
+			{
+				status.level = diagnostic_msgs::DiagnosticStatus::ERROR;
+				status.message = "recording stalled, no segment could be created";
+			}
+			add_stat(status, "record_mb", m_bytes.load() / 1048576.0);
+			add_stat(status, "record_backlog", m_pending.size());
+			latency_summary summary = m_latency.take();
+			add_stat(status, "record_write_p50_us", summary.p50);
+			add_stat(status, "record_write_p99_us", summary.p99);
+			add_stat(status, "record_write_max_us", summary.max);
+		}
+
+	private:
+		uint8_t *slot_data(size_t slot)
+		{
+			return static_cast<uint8_t *>(m_memory_ptr->data()) + slot * m_slot_size;
+		}
+		static bool write_all(int fd, const void *data, size_t size)
+		{
+			const uint8_t *pos = static_cast<const uint8_t *>(data);
+			while (size > 0)
+			{
+				ssize_t written = write(fd, pos, size);
+				if (written < 0 && errno == EINTR)
+				{
+					continue;
+				}
+				if (written <= 0)
+				{
+					return false;
+				}
+				pos += written;
+				size -= size_t(written);
+			}
+			return true;
+		}
+		static bool pwrite_all(int fd, const void *data, size_t size, uint64_t offset)
+		{
+			const uint8_t *pos = static_cast<const uint8_t *>(data);
+			while (size > 0)
+			{
+				ssize_t written = pwrite(fd, pos, size, off_t(offset));
+				if (written < 0 && errno == EINTR)
+				{
+					continue;
+				}
+				if (written <= 0)
+				{
+					return false;
+				}
+				pos += written;
+				offset += uint64_t(written);
+				size -= size_t(written);
+			}
+			return true;
+		}
+		// creates a segment with all of its blocks allocated up front, so writing it never extends the file
+		int open_segment(uint32_t segment)
+		{
+			std::string path = recording_segment_path(m_dir, segment);
+			int fd = -1;
+			if (m_direct_io)
+			{
+				fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_DIRECT, 0644);
+				if (fd < 0 && errno == EINVAL)
+				{
+					// tmpfs and some network file systems refuse O_DIRECT
+					ROS_WARN("Blackfly Nodelet: %s does not support O_DIRECT, recording camera %s with buffered io", m_dir.c_str(), m_cam_name.c_str());
+					m_direct_io = false;
+				}
+			}
+			if (!m_direct_io)
+			{
+				fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+			}
+			if (fd < 0)
+			{
+				ROS_ERROR_THROTTLE(1.0, "Blackfly Nodelet: Failed to create recording segment %s: %s", path.c_str(), std::strerror(errno));
+				return -1;
+			}
+			int error = posix_fallocate(fd, 0, off_t(m_segment_size));
+			if (error != 0)
+			{
+				ROS_WARN("Blackfly Nodelet: Failed to preallocate recording segment %s: %s", path.c_str(), std::strerror(error));
+			}
+			return fd;
+		}
+		// Switches to the segment prepared in advance and prepares the one after it. A segment that could not be prepared is
+		// created here instead, on every record until it succeeds, so a full disk that frees up again resumes the recording.
+		bool next_segment()
+		{
+			if (m_segment_fd >= 0)
+			{
+				close(m_segment_fd);
+				m_segment_fd = -1;
+				m_segment++;
+			}
+			if (m_next_segment_fd < 0)
+			{
+				m_next_segment_fd = open_segment(m_segment);
+			}
+			m_segment_fd = m_next_segment_fd;
+			m_next_segment_fd = -1;
+			m_offset = 0;
+			if (m_segment_fd < 0)
+			{
+				m_stalled = true;
+				return false;
+			}
+			m_stalled = false;
+			m_next_segment_fd = open_segment(m_segment + 1);
+			return true;
+		}
+		void writer_loop()
+		{
+			std::unique_lock<std::mutex> lock(m_mutex);
+			while (true)
+			{
+				// the image thread notifies without the lock, the timeout bounds a missed wake up
+				m_cond.wait_for(lock, std::chrono::milliseconds(5), [this]() { return m_stop || !m_pending.empty(); });
+				bool stopping = m_stop;
+				lock.unlock();
+				size_t slot;
+				while (m_pending.pop(slot))
+				{
+					write_record(slot);
+					m_free_slots.push(slot);
+				}
+				if (stopping)
+				{
+					return;
+				}
+				lock.lock();
+			}
+		}
+		void write_record(size_t slot)
+		{
+			uint8_t *record = slot_data(slot);
+			recorded_frame *header = reinterpret_cast<recorded_frame *>(record);
+			uint64_t size = recorded_frame_size(header->payload_size);
+			if (m_segment_fd < 0 || m_offset + size > m_segment_size)
+			{
+				if (m_segment_fd >= 0 && ftruncate(m_segment_fd, m_offset) != 0)
+				{
+					ROS_WARN("Blackfly Nodelet: Failed to trim recording segment of camera %s: %s", m_cam_name.c_str(), std::strerror(errno));
+				}
+				if (!next_segment())
+				{
+					m_write_errors++;
+					return;
+				}
+			}
+			header->sequence = m_sequence;
+			header->segment = m_segment;
+			header->offset = m_offset;
+			// the padding behind the payload goes out with it, O_DIRECT writes whole blocks
+			std::chrono::steady_clock::time_point write_start = std::chrono::steady_clock::now();
+			if (!pwrite_all(m_segment_fd, record, size, m_offset))
+			{
+				m_write_errors++;
+				ROS_ERROR_THROTTLE(1.0, "Blackfly Nodelet: Failed to write recording of camera %s: %s", m_cam_name.c_str(), std::strerror(errno));
+				return;
+			}
+			m_latency.record(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - write_start).count());
+			// the index only points to records that made it to the segment
+			if (!write_all(m_index_fd, header, sizeof(recorded_frame)))
+			{
+				m_write_errors++;
+				ROS_ERROR_THROTTLE(1.0, "Blackfly Nodelet: Failed to write recording index of camera %s: %s", m_cam_name.c_str(), std::strerror(errno));
+			}
+			m_offset += size;
+			m_sequence++;
+			m_frames++;
+			m_bytes += size;
+		}
+		FrameRecorder(const FrameRecorder &);
+		FrameRecorder &operator=(const FrameRecorder &);
+		std::string m_cam_name;
+		std::string m_dir;
+		size_t m_num_slots;
+		uint64_t m_slot_size;
+		uint64_t m_max_payload;
+		uint64_t m_segment_size;
+		AcquisitionMemory *m_memory_ptr;
+		// slots ready for the image thread, and slots waiting for the writer
+		SpscQueue<size_t> m_free_slots;
+		SpscQueue<size_t> m_pending;
+		// only used by the writer thread once it runs
+		int m_segment_fd;
+		int m_next_segment_fd;
+		int m_index_fd;
+		uint32_t m_segment;
+		uint64_t m_offset;
+		uint64_t m_sequence;
+		bool m_direct_io;
+		std::thread m_writer_thread;
+		std::mutex m_mutex;
+		std::condition_variable m_cond;
+		bool m_stop;
+		std::atomic<uint64_t> m_frames;
+		std::atomic<uint64_t> m_dropped;
+		std::atomic<uint64_t> m_oversized;
+		std::atomic<uint64_t> m_bytes;
+		std::atomic<uint64_t> m_write_errors;
+		// no segment to write to, frames are left out until one can be created
+		std::atomic<bool> m_stalled;
+		LatencyHistogram m_latency;
+};
+#endif // FRAME_RECORDER_
@@ -0,0 +1,480 @@
+#ifndef FRAME_SYNCHRONIZER_
+#define FRAME_SYNCHRONIZER_
+#include <string>
+#include <vector>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <condition_variable>
+
+#include <ros/ros.h>
+#include <diagnostic_msgs/DiagnosticStatus.h>
+
+#include "stats.h"
+#include "worker_pool.h"
+
+// Groups the frames of hardware triggered cameras that belong to the same trigger pulse into bundles,
+// so every camera publishes the frames of one pulse with the same stamp.
+// Frames are matched on their exposure start, which is the trigger pulse whatever exposure a camera runs with. A frame joins
+// the newest bundle of its camera's future whose exposure start is within the tolerance, or opens a new one.
+// Frame ids keep a camera from joining the same pulse twice and count the pulses a camera missed.
+// No thread waits for a bundle: each frame is parked with its bundle and handed on once the last camera joined, by that
+// camera's thread, or once the bundle's wait expired, by the sync thread. Deliveries run on the worker pool, one at a time
+// and in bundle order per camera. A camera that is missing from SYNC_ABSENT_BUNDLES expired bundles in a row, because it
+// was disconnected or stopped, is no longer waited for until its next frame arrives.
+
+// bundles remembered for late frames, a few pulses are plenty at any frame rate the bounded wait allows
+#define SYNC_MAX_BUNDLES 32
+// one bit per camera in the member masks
+#define SYNC_MAX_CAMERAS 64
+// expired bundles a camera may miss in a row before bundles stop waiting for it
+#define SYNC_ABSENT_BUNDLES 3
+
+// publishes a parked frame with the stamp of its bundle
+typedef std::function<void(ros::Time)> sync_delivery;
+
+class FrameSynchronizer
+{
+	public:
+		// p_worker_pool_ptr runs the deliveries and has to outlive the synchronizer's stop()
+		FrameSynchronizer(const std::vector<std::string> &p_cam_names, double p_tolerance, double p_max_wait, WorkerPool *p_worker_pool_ptr)
+		{
+			m_cam_names = p_cam_names;
+			if (m_cam_names.size() > SYNC_MAX_CAMERAS)
+			{
+				ROS_WARN("Blackfly Nodelet: Only the first %d cameras can be synchronized", SYNC_MAX_CAMERAS);
+				m_cam_names.resize(SYNC_MAX_CAMERAS);
+			}
+			m_tolerance_ns = int64_t(p_tolerance * 1e9);
+			m_max_wait = std::chrono::microseconds(int64_t(p_max_wait * 1e6));
+			m_worker_pool_ptr = p_worker_pool_ptr;
+			m_active_mask = 0;
+			for (size_t i = 0; i < m_cam_names.size(); i++)
+			{
+				m_active_mask |= uint64_t(1) << i;
+			}
+			m_slots.resize(m_cam_names.size());
+			m_next_seq = 1;
+			m_stopped = false;
+			m_bundles_complete = 0;
+			m_bundles_incomplete = 0;
+			m_last_incomplete = 0;
+			m_frames_late = 0;
+			m_frames_unmatched = 0;
+			m_pulses_missed = 0;
+			m_cameras_dropped = 0;
+			m_max_spread_ns = 0;
+			m_expiry_thread = std::thread(&FrameSynchronizer::expiry_loop, this);
+		}
+		~FrameSynchronizer()
+		{
+			stop();
+			if (m_expiry_thread.joinable())
+			{
+				m_expiry_thread.join();
+			}
+		}
+		// slot of the camera, -1 if it is not synchronized
+		int slot(const std::string &cam_name) const
+		{
+			for (size_t i = 0; i < m_cam_names.size(); i++)
+			{
+				if (m_cam_names[i] == cam_name)
+				{
+					return int(i);
+				}
+			}
+			return -1;
+		}
+		// stop waiting for a camera for good, used for cameras that failed to start
+		void remove(const std::string &cam_name)
+		{
+			int index = slot(cam_name);
+			if (index < 0)
+			{
+				return;
+			}
+			std::lock_guard<std::mutex> lock(m_mutex);
+			m_slots[index].removed = true;
+			m_active_mask &= ~(uint64_t(1) << index);
+			release_complete();
+		}
+		// Stops bundling before the cameras are torn down. Parked frames are delivered with the stamps of their bundles and
+		// later frames go straight through once their camera's parked frames are out. Returns once every delivery finished.
+		void stop()
+		{
+			std::unique_lock<std::mutex> lock(m_mutex);
+			if (!m_stopped)
+			{
+				m_stopped = true;
+				for (size_t i = 0; i < m_bundles.size(); i++)
+				{
+					if (!m_bundles[i].released)
+					{
+						release(m_bundles[i]);
+					}
+				}
+				m_cond.notify_all();
+			}
+			m_idle_cond.wait(lock, [this]() { return deliveries_idle(); });
+		}
+		// Parks the frame of camera p_slot with its bundle and returns right away, p_deliver is called with the bundle's stamp
+		// once the bundle is complete or its wait expired. p_match_stamp is the exposure start the frames are matched on,
+		// p_stamp the stamp the frame would be published with, the first frame's stamp becomes the bundle's.
+		// p_frame_id_valid is false when the camera has no chunk data.
+		void submit(int p_slot, ros::Time p_match_stamp, ros::Time p_stamp, bool p_frame_id_valid, int64_t p_frame_id, sync_delivery p_deliver)
+		{
+			std::unique_lock<std::mutex> lock(m_mutex);
+			if (p_slot < 0 || p_slot >= int(m_slots.size()))
+			{
+				lock.unlock();
+				p_deliver(p_stamp);
+				return;
+			}
+			if (m_stopped)
+			{
+				slot_state &stopped_state = m_slots[p_slot];
+				if (stopped_state.delivering || !stopped_state.parked.empty())
+				{
+					// Behind the frames parked before stop(), the camera's delivery task publishes it after them. Waiting for
+					// that task here could block the only worker it would run on.
+					parked_frame parked;
+					parked.seq = 0;
+					parked.stamp = p_stamp;
+					parked.deliver = p_deliver;
+					parked.released = true;
+					stopped_state.parked.push_back(parked);
+					schedule(p_slot);
+					return;
+				}
+				// nothing of this camera is in flight, marked busy so no pool task publishes alongside it
+				stopped_state.delivering = true;
+				lock.unlock();
+				p_deliver(p_stamp);
+				lock.lock();
+				stopped_state.delivering = false;
+				m_idle_cond.notify_all();
+				return;
+			}
+			uint64_t bit = uint64_t(1) << p_slot;
+			int64_t match_ns = int64_t(p_match_stamp.toNSec());
+			slot_state &state = m_slots[p_slot];
+			state.absent = 0;
+			if (!state.removed && (m_active_mask & bit) == 0)
+			{
+				m_active_mask |= bit;
+				ROS_INFO("Blackfly Nodelet: Camera %s delivers frames again, frame sync waits for it", m_cam_names[p_slot].c_str());
+			}
+			if (p_frame_id_valid && state.frame_id_valid && p_frame_id > state.last_frame_id + 1)
+			{
+				m_pulses_missed += uint64_t(p_frame_id - state.last_frame_id - 1);
+			}
+			state.frame_id_valid = p_frame_id_valid;
+			state.last_frame_id = p_frame_id;
+
+			bundle *match = nullptr;
+			int64_t match_diff = 0;
+			for (size_t i = 0; i < m_bundles.size(); i++)
+			{
+				bundle &candidate = m_bundles[i];
+				if (candidate.seq <= state.last_seq || (candidate.members & bit) != 0)
+				{
+					continue;
+				}
+				int64_t diff = match_ns > candidate.match_ns ? match_ns - candidate.match_ns : candidate.match_ns - match_ns;
+				if (diff <= m_tolerance_ns && (match == nullptr || diff < match_diff))
+				{
+					match = &candidate;
+					match_diff = diff;
+				}
+			}
+			if (match == nullptr)
+			{
+				if (m_bundles.size() >= SYNC_MAX_BUNDLES)
+				{
+					retire_oldest();
+				}
+				bundle fresh;
+				fresh.seq = m_next_seq++;
+				fresh.match_ns = match_ns;
+				fresh.stamp_ns = int64_t(p_stamp.toNSec());
+				fresh.min_ns = match_ns;
+				fresh.max_ns = match_ns;
+				fresh.members = 0;
+				fresh.released = false;
+				fresh.deadline = std::chrono::steady_clock::now() + m_max_wait;
+				m_bundles.push_back(fresh);
+				match = &m_bundles.back();
+				// the sync thread has a new deadline to watch
+				m_cond.notify_all();
+			}
+			match->members |= bit;
+			match->min_ns = std::min(match->min_ns, match_ns);
+			match->max_ns = std::max(match->max_ns, match_ns);
+			state.last_seq = match->seq;
+			parked_frame parked;
+			parked.seq = match->seq;
+			parked.stamp.fromNSec(uint64_t(match->stamp_ns));
+			parked.deliver = p_deliver;
+			parked.released = match->released;
+			state.parked.push_back(parked);
+			if (match->released)
+			{
+				// the others already went out with this pulse, keep its stamp but do not wait again
+				m_frames_late++;
+				schedule(p_slot);
+			}
+			else if (complete(*match))
+			{
+				release(*match);
+			}
+		}
+		void fill_stats(diagnostic_msgs::DiagnosticStatus &status)
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			status.name = "frame_sync";
+			status.hardware_id = "frame_sync";
+			status.level = m_bundles_incomplete > m_last_incomplete ? diagnostic_msgs::DiagnosticStatus::WARN : diagnostic_msgs::DiagnosticStatus::OK;
+			status.message = status.level == diagnostic_msgs::DiagnosticStatus::OK ? "OK" : "incomplete bundles";
+			m_last_incomplete = m_bundles_incomplete;
+			add_stat(status, "cameras", popcount(m_active_mask));
+			add_stat(status, "bundles_complete", m_bundles_complete);
+			add_stat(status, "bundles_incomplete", m_bundles_incomplete);
+			add_stat(status, "frames_late", m_frames_late);
+			add_stat(status, "frames_unmatched", m_frames_unmatched);
+			add_stat(status, "pulses_missed", m_pulses_missed);
+			// cameras no longer waited for after missing bundles in a row
+			add_stat(status, "cameras_dropped", m_cameras_dropped);
+			// largest difference between the exposure starts of one bundle since the last report
+			add_stat(status, "max_spread_us", m_max_spread_ns / 1000.0);
+			m_max_spread_ns = 0;
+		}
+
+	private:
+		struct parked_frame
+		{
+			uint64_t seq;
+			ros::Time stamp;
+			sync_delivery deliver;
+			// its bundle is complete or expired, it goes out once the frames parked before it did
+			bool released;
+		};
+		struct slot_state
+		{
+			slot_state() : last_seq(0), frame_id_valid(false), last_frame_id(0), removed(false), absent(0), delivering(false) {}
+			// newest bundle the camera joined, it never joins an older one again
+			uint64_t last_seq;
+			bool frame_id_valid;
+			int64_t last_frame_id;
+			// failed to start, never waited for again
+			bool removed;
+			// expired bundles missed in a row
+			int absent;
+			// frames in bundle order
+			std::deque<parked_frame> parked;
+			// a delivery task of this camera is queued or running
+			bool delivering;
+		};
+		struct bundle
+		{
+			uint64_t seq;
+			// exposure start of the first frame, the others are matched against it
+			int64_t match_ns;
+			// stamp of the first frame, published by every member
+			int64_t stamp_ns;
+			int64_t min_ns;
+			int64_t max_ns;
+			uint64_t members;
+			// complete or expired, later members go out without waiting
+			bool released;
+			std::chrono::steady_clock::time_point deadline;
+		};
+		bool complete(const bundle &p_bundle) const
+		{
+			return (p_bundle.members & m_active_mask) == m_active_mask;
+		}
+		// counts the bundle and hands its parked frames on, called with the mutex held
+		void release(bundle &p_bundle)
+		{
+			p_bundle.released = true;
+			if (complete(p_bundle))
+			{
+				m_bundles_complete++;
+			}
+			else
+			{
+				m_bundles_incomplete++;
+				ROS_WARN_THROTTLE(1.0, "Blackfly Nodelet: Incomplete frame bundle, %d of %d cameras within %.1f ms", popcount(p_bundle.members & m_active_mask),
+									popcount(m_active_mask), std::chrono::duration<double, std::milli>(m_max_wait).count());
+			}
+			m_max_spread_ns = std::max(m_max_spread_ns, p_bundle.max_ns - p_bundle.min_ns);
+			for (size_t i = 0; i < m_slots.size(); i++)
+			{
+				if ((p_bundle.members >> i) & 1)
+				{
+					std::deque<parked_frame> &parked = m_slots[i].parked;
+					for (size_t j = 0; j < parked.size(); j++)
+					{
+						if (parked[j].seq == p_bundle.seq)
+						{
+							parked[j].released = true;
+						}
+					}
+					schedule(int(i));
+				}
+			}
+		}
+		// the wait of the bundle ran out, cameras missing from too many of these in a row are not waited for any more
+		void expire(bundle &p_bundle)
+		{
+			release(p_bundle);
+			bool dropped = false;
+			for (size_t i = 0; i < m_slots.size(); i++)
+			{
+				uint64_t bit = uint64_t(1) << i;
+				if ((m_active_mask & bit) == 0 || (p_bundle.members & bit) != 0)
+				{
+					continue;
+				}
+				if (++m_slots[i].absent >= SYNC_ABSENT_BUNDLES)
+				{
+					m_active_mask &= ~bit;
+					m_cameras_dropped++;
+					dropped = true;
+					ROS_WARN("Blackfly Nodelet: Camera %s missed %d frame bundles in a row, frame sync stops waiting for it", m_cam_names[i].c_str(), SYNC_ABSENT_BUNDLES);
+				}
+			}
+			if (dropped)
+			{
+				release_complete();
+			}
+		}
+		// bundles that only waited for cameras which are not waited for any more
+		void release_complete()
+		{
+			for (size_t i = 0; i < m_bundles.size(); i++)
+			{
+				if (!m_bundles[i].released && complete(m_bundles[i]))
+				{
+					release(m_bundles[i]);
+				}
+			}
+		}
+		// posts the delivery task of the camera when its oldest parked frame is released and no task is in flight
+		void schedule(int p_slot)
+		{
+			slot_state &state = m_slots[p_slot];
+			if (state.delivering || state.parked.empty() || !state.parked.front().released)
+			{
+				return;
+			}
+			state.delivering = true;
+			m_worker_pool_ptr->post([this, p_slot]() { deliver(p_slot); });
+		}
+		// publishes the released frames of one camera in bundle order, outside of the mutex
+		void deliver(int p_slot)
+		{
+			std::unique_lock<std::mutex> lock(m_mutex);
+			slot_state &state = m_slots[p_slot];
+			while (!state.parked.empty() && state.parked.front().released)
+			{
+				parked_frame parked = state.parked.front();
+				state.parked.pop_front();
+				lock.unlock();
+				parked.deliver(parked.stamp);
+				// the frame and its stream buffer go with the delivery, not under the mutex
+				parked.deliver = nullptr;
+				lock.lock();
+			}
+			state.delivering = false;
+			m_idle_cond.notify_all();
+		}
+		bool deliveries_idle() const
+		{
+			for (size_t i = 0; i < m_slots.size(); i++)
+			{
+				if (m_slots[i].delivering || !m_slots[i].parked.empty())
+				{
+					return false;
+				}
+			}
+			return true;
+		}
+		// releases the bundles whose wait ran out, sleeping until the next deadline
+		void expiry_loop()
+		{
+			std::unique_lock<std::mutex> lock(m_mutex);
+			while (!m_stopped)
+			{
+				bool waiting = false;
+				std::chrono::steady_clock::time_point next_deadline;
+				for (size_t i = 0; i < m_bundles.size(); i++)
+				{
+					if (!m_bundles[i].released && (!waiting || m_bundles[i].deadline < next_deadline))
+					{
+						next_deadline = m_bundles[i].deadline;
+						waiting = true;
+					}
+				}
+				if (!waiting)
+				{
+					m_cond.wait(lock);
+					continue;
+				}
+				m_cond.wait_until(lock, next_deadline);
+				std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+				for (size_t i = 0; i < m_bundles.size() && !m_stopped; i++)
+				{
+					if (!m_bundles[i].released && m_bundles[i].deadline <= now)
+					{
+						expire(m_bundles[i]);
+					}
+				}
+			}
+		}
+		void retire_oldest()
+		{
+			bundle &oldest = m_bundles.front();
+			if (!oldest.released)
+			{
+				expire(oldest);
+			}
+			if (popcount(oldest.members) == 1 && popcount(m_active_mask) > 1)
+			{
+				m_frames_unmatched++;
+			}
+			m_bundles.pop_front();
+		}
+		static int popcount(uint64_t p_mask)
+		{
+			return __builtin_popcountll(p_mask);
+		}
+		std::vector<std::string> m_cam_names;
+		int64_t m_tolerance_ns;
+		std::chrono::microseconds m_max_wait;
+		WorkerPool *m_worker_pool_ptr;
+		std::mutex m_mutex;
+		// wakes the sync thread for a new deadline or stop
+		std::condition_variable m_cond;
+		// signalled whenever a camera's deliveries ran dry
+		std::condition_variable m_idle_cond;
+		std::thread m_expiry_thread;
+		bool m_stopped;
+		uint64_t m_active_mask;
+		std::vector<slot_state> m_slots;
+		std::deque<bundle> m_bundles;
+		uint64_t m_next_seq;
+		uint64_t m_bundles_complete;
+		uint64_t m_bundles_incomplete;
+		// incomplete bundles at the last report
+		uint64_t m_last_incomplete;
+		uint64_t m_frames_late;
+		uint64_t m_frames_unmatched;
+		uint64_t m_pulses_missed;
+		uint64_t m_cameras_dropped;
+		int64_t m_max_spread_ns;
+};
+#endif // FRAME_SYNCHRONIZER_
@@ -3,6 +3,7 @@
 #include <sensor_msgs/image_encodings.h>
 #include <sensor_msgs/Image.h>
 #include <sensor_msgs/CameraInfo.h>
+#include <sensor_msgs/CompressedImage.h>
 #include <sensor_msgs/fill_image.h>
 
 #include <image_transport/image_transport.h>
@@ -16,18 +17,71 @@
 #include <ros/ros.h>
 #include <nodelet/nodelet.h>
 
+#include <mutex>
+#include <atomic>
+#include <thread>
+
 #include "device_event_handler.h"
+#include "camera_frame.h"
+#include "image_loan.h"
+#include "message_pool.h"
+#include "demosaic.h"
+#include "downscale.h"
+#include "luminance.h"
+#include "frame_metadata.h"
+#include "clock_estimator.h"
+#include "spsc_queue.h"
+#include "worker_pool.h"
+#include "stats.h"
+#include "latency_histogram.h"
+#include "frame_synchronizer.h"
+#include "jpeg_encoder.h"
+#include "frame_recorder.h"
+#include <blackfly/FrameMetadata.h>
 
 using namespace Spinnaker;
 using namespace Spinnaker::GenApi;
 using namespace Spinnaker::GenICam;
 
+// messages preallocated per camera, matches the queue size of the camera publisher
+#define MESSAGE_POOL_SIZE 10
+// frame wrappers preallocated per camera, the pool grows to the stream buffers in flight
+#define FRAME_POOL_SIZE 16
+// image_half and image_quarter
+#define PYRAMID_LEVELS 2
+
+// What happens to a frame that arrives while the frame queue is full. Drop oldest trims the queue to its depth when the
+// consumer pops, a consumer blocked in one frame for longer than frame_queue_capacity frames still loses the newest ones.
+enum queue_overflow_policy {QUEUE_DROP_OLDEST, QUEUE_DROP_NEWEST};
+
+// Frames the queue holds at most. Drop oldest takes up to twice the depth and trims it on the consumer side,
+// every one of them holds a stream buffer until it is dropped or published.
+inline size_t frame_queue_capacity(size_t p_depth, queue_overflow_policy p_policy)
+{
+	size_t depth = p_depth > 0 ? p_depth : 1;
+	return p_policy == QUEUE_DROP_OLDEST ? 2 * depth : depth;
+}
+
+// Latency histograms kept per camera. Every stage is measured from the previous one, the first two and the last from exposure end.
+// Exposure end is the device clock stamp when device_clock is on, otherwise the arrival of the exposure end event,
+// in which case event_delivery is not recorded.
+enum latency_stage {LATENCY_EVENT_DELIVERY, LATENCY_IMAGE_ARRIVAL, LATENCY_QUEUE_WAIT, LATENCY_COPY, LATENCY_PUBLISH, LATENCY_TOTAL, LATENCY_STAGE_COUNT};
+static const char *const latency_stage_names[LATENCY_STAGE_COUNT] = {"event_delivery", "image_arrival", "queue_wait", "copy", "publish", "exposure_to_publish"};
+
+// frame handed from the spinnaker callback to the worker pool
+struct queued_frame
+{
+	FramePtr image;
+	ros::Time arrival_time;
+};
+
 class ImageEventHandler : public ImageEvent
 {
 	public:
 		ImageEventHandler(std::string p_cam_name, CameraPtr p_cam_ptr, image_transport::CameraPublisher *p_cam_pub_ptr, 
 							boost::shared_ptr<camera_info_manager::CameraInfoManager> p_c_info_mgr_ptr, 
-							DeviceEventHandler* p_device_event_handler_ptr, bool p_exp_time_comp_flag)
+							DeviceEventHandler* p_device_event_handler_ptr, bool p_exp_time_comp_flag,
+							ros::Publisher *p_loan_pub_ptr = nullptr, unsigned int p_max_loans = 1)
 		{
 			m_cam_name = p_cam_name;
 			m_cam_ptr = p_cam_ptr;
@@ -36,39 +90,428 @@ class ImageEventHandler : public ImageEvent
 			m_device_event_handler_ptr = p_device_event_handler_ptr;
 			m_last_image_stamp = ros::Time(0,0);
 			m_exp_time_comp_flag = p_exp_time_comp_flag;
-			image_msg = boost::make_shared<sensor_msgs::Image>();
-			// config_all_chunk_data();
+			m_image_pool_ptr = new MessagePool<sensor_msgs::Image>(MESSAGE_POOL_SIZE);
+			m_cam_info_pool_ptr = new MessagePool<sensor_msgs::CameraInfo>(MESSAGE_POOL_SIZE);
+			m_frame_pool_ptr = new MessagePool<SpinnakerFrame>(FRAME_POOL_SIZE);
+			m_pool_frame_size = 0;
+			m_color_pub_ptr = nullptr;
+			m_color_pool_ptr = nullptr;
+			m_color_frame_size = 0;
+			m_demosaic = DEMOSAIC_NONE;
+			m_worker_pool_ptr = nullptr;
+			// zero copy publishing is enabled by handing in a publisher for the loaned image topic
+			m_loan_pub_ptr = p_loan_pub_ptr;
+			m_loan_state = boost::make_shared<ImageLoanState>(p_max_loans);
+			m_metadata_pub_ptr = nullptr;
+			m_clock_estimator_ptr = nullptr;
+			// frames of a backend without a spinnaker camera bring their metadata along
+			m_chunk_data_enabled = p_cam_ptr ? chunk_mode_active() : true;
+			m_frame_queue_ptr = nullptr;
+			m_queue_depth = 0;
+			m_queue_capacity = 0;
+			m_queue_policy = QUEUE_DROP_OLDEST;
+			m_queue_stopped = false;
+			m_drain_scheduled = false;
+			m_active_drains = 0;
+			m_queue_peak_depth = 0;
+			m_frames_received = 0;
+			m_frames_processed = 0;
+			m_frames_incomplete = 0;
+			m_frames_unknown_format = 0;
+			m_queue_dropped_oldest = 0;
+			m_queue_dropped_newest = 0;
+			m_frame_sync_ptr = nullptr;
+			m_sync_slot = -1;
+			m_jpeg_pub_ptr = nullptr;
+			m_jpeg_encoder_ptr = nullptr;
+			m_jpeg_pool_ptr = nullptr;
+			m_jpeg_frames = 0;
+			m_jpeg_failed = 0;
+			m_recorder_ptr = nullptr;
+			m_mono_pub_ptr = nullptr;
+			m_mono_pool_ptr = nullptr;
+			m_mono_frame_size = 0;
+			m_mono_frames = 0;
+			m_roi_changed = false;
+			for (int i = 0; i < PYRAMID_LEVELS; i++)
+			{
+				m_pyramid_pub_ptr[i] = nullptr;
+				m_pyramid_pool_ptr[i] = nullptr;
+				m_pyramid_frame_size[i] = 0;
+				m_pyramid_frames[i] = 0;
+			}
 		}
 		~ImageEventHandler()
 		{
+			flush_frame_queue();
+			// messages still held by subscribers keep the pool alive until they are dropped
+			delete m_image_pool_ptr;
+			delete m_cam_info_pool_ptr;
+			delete m_frame_pool_ptr;
+			delete m_color_pool_ptr;
+			delete m_jpeg_encoder_ptr;
+			delete m_jpeg_pool_ptr;
+			delete m_frame_queue_ptr;
+			delete m_mono_pool_ptr;
+			for (int i = 0; i < PYRAMID_LEVELS; i++)
+			{
+				delete m_pyramid_pool_ptr[i];
+			}
 			m_cam_ptr = nullptr;
 		}
+		// must be called before acquisition ends, loans still held by subscribers are no longer returned to the stream
+		void close_loans()
+		{
+			m_loan_state->close();
+			if (m_loan_state->outstanding() > 0)
+			{
+				ROS_WARN("Blackfly Nodelet: %u loaned images still held by subscribers on camera: %s", m_loan_state->outstanding(), m_cam_name.c_str());
+			}
+		}
+		// user owned stream buffers, loaned images keep them mapped after the camera is gone
+		void hold_buffer_memory(boost::shared_ptr<void> p_memory)
+		{
+			m_loan_state->keep_alive(p_memory);
+		}
+		// demosaic bayer_rg8 frames on the host and publish them on p_color_pub_ptr, call before registering the handler
+		void enable_color_output(image_transport::Publisher *p_color_pub_ptr, demosaic_method p_method, WorkerPool *p_worker_pool_ptr)
+		{
+			m_color_pub_ptr = p_color_pub_ptr;
+			m_demosaic = p_method;
+			m_worker_pool_ptr = p_worker_pool_ptr;
+			m_color_pool_ptr = new MessagePool<sensor_msgs::Image>(MESSAGE_POOL_SIZE);
+		}
+		// publish the chunk data of every frame on p_metadata_pub_ptr, call before registering the handler
+		void enable_metadata_output(ros::Publisher *p_metadata_pub_ptr)
+		{
+			m_metadata_pub_ptr = p_metadata_pub_ptr;
+		}
+		// stamp frames from their chunk timestamp mapped to host time, the event stamp is used until the estimator has converged
+		void enable_device_clock_stamps(ClockEstimator *p_clock_estimator_ptr)
+		{
+			m_clock_estimator_ptr = p_clock_estimator_ptr;
+		}
+		// Encode the frames to jpeg on the nodelet's side and publish them on p_jpeg_pub_ptr while it has subscribers.
+		// Mono8 and bgr8 frames are encoded straight from the stream buffer, bayer_rg8 frames after demosaicing. Call before registering the handler.
+		void enable_jpeg_output(ros::Publisher *p_jpeg_pub_ptr, int p_quality, int p_slices, WorkerPool *p_worker_pool_ptr)
+		{
+			m_jpeg_pub_ptr = p_jpeg_pub_ptr;
+			unsigned int slices = p_slices > 0 ? (unsigned int)p_slices : (p_worker_pool_ptr != nullptr ? (unsigned int)p_worker_pool_ptr->size() + 1 : 1);
+			m_jpeg_encoder_ptr = new JpegEncoder(p_quality, slices);
+			m_jpeg_pool_ptr = new MessagePool<sensor_msgs::CompressedImage>(MESSAGE_POOL_SIZE);
+			if (m_worker_pool_ptr == nullptr)
+			{
+				m_worker_pool_ptr = p_worker_pool_ptr;
+			}
+		}
+		// Publish the luminance of bgr8 and bayer_rg8 frames as mono8 on p_mono_pub_ptr while it has subscribers, call before registering the handler.
+		void enable_mono_output(image_transport::CameraPublisher *p_mono_pub_ptr, WorkerPool *p_worker_pool_ptr)
+		{
+			m_mono_pub_ptr = p_mono_pub_ptr;
+			m_mono_pool_ptr = new MessagePool<sensor_msgs::Image>(MESSAGE_POOL_SIZE);
+			if (m_worker_pool_ptr == nullptr)
+			{
+				m_worker_pool_ptr = p_worker_pool_ptr;
+			}
+		}
+		// Publish the frames at half and quarter resolution on p_half_pub_ptr and p_quarter_pub_ptr, each level only while it has subscribers.
+		// Bayer_rg8 levels are bgr8. Either publisher may be nullptr, call before registering the handler.
+		void enable_pyramid_output(image_transport::CameraPublisher *p_half_pub_ptr, image_transport::CameraPublisher *p_quarter_pub_ptr, WorkerPool *p_worker_pool_ptr)
+		{
+			m_pyramid_pub_ptr[0] = p_half_pub_ptr;
+			m_pyramid_pub_ptr[1] = p_quarter_pub_ptr;
+			for (int i = 0; i < PYRAMID_LEVELS; i++)
+			{
+				if (m_pyramid_pub_ptr[i] != nullptr)
+				{
+					m_pyramid_pool_ptr[i] = new MessagePool<sensor_msgs::Image>(MESSAGE_POOL_SIZE);
+				}
+			}
+			if (m_worker_pool_ptr == nullptr)
+			{
+				m_worker_pool_ptr = p_worker_pool_ptr;
+			}
+		}
+		// record every complete frame with p_recorder_ptr, which stays owned by the camera. Call before registering the handler.
+		void enable_recording(FrameRecorder *p_recorder_ptr)
+		{
+			m_recorder_ptr = p_recorder_ptr;
+		}
+		// publish every frame with the stamp shared by the frames of the same trigger pulse on the other cameras, call before registering the handler
+		void enable_frame_sync(FrameSynchronizer *p_frame_sync_ptr)
+		{
+			m_sync_slot = p_frame_sync_ptr->slot(m_cam_name);
+			m_frame_sync_ptr = m_sync_slot >= 0 ? p_frame_sync_ptr : nullptr;
+		}
+		// Readout window published in the roi of every CameraInfo from the next frame on, in the pixels of the calibration.
+		// All zeros stands for the full sensor.
+		void set_camera_info_roi(const sensor_msgs::RegionOfInterest &p_roi)
+		{
+			std::lock_guard<std::mutex> lock(m_roi_mutex);
+			m_roi = p_roi;
+			m_roi_changed = true;
+		}
+		// chunk data of the last complete frame
+		frame_metadata get_last_metadata()
+		{
+			std::lock_guard<std::mutex> lock(m_metadata_mutex);
+			return m_last_metadata;
+		}
+		// Convert and publish frames on p_worker_pool_ptr instead of the spinnaker callback thread, which then only queues the frame handle.
+		// At most p_depth frames wait in the queue, call before registering the handler.
+		void enable_frame_queue(size_t p_depth, queue_overflow_policy p_policy, WorkerPool *p_worker_pool_ptr)
+		{
+			m_queue_depth = p_depth > 0 ? p_depth : 1;
+			m_queue_policy = p_policy;
+			m_worker_pool_ptr = p_worker_pool_ptr;
+			// drop oldest needs room for the frames that arrive while the consumer catches up, it trims the queue to the depth on its side
+			m_queue_capacity = frame_queue_capacity(m_queue_depth, p_policy);
+			m_frame_queue_ptr = new SpscQueue<queued_frame>(m_queue_capacity);
+		}
+		// Stops queueing, waits for the running drain task and releases the frames still queued.
+		// Must be called after frames stop arriving and before acquisition ends.
+		void flush_frame_queue()
+		{
+			if (m_frame_queue_ptr == nullptr)
+			{
+				return;
+			}
+			m_queue_stopped = true;
+			while (m_active_drains.load() > 0)
+			{
+				std::this_thread::sleep_for(std::chrono::milliseconds(1));
+			}
+			queued_frame frame;
+			while (m_frame_queue_ptr->pop(frame))
+			{
+				frame.image->release();
+			}
+		}
+		// pipeline counters of this camera, the peak queue depth and the latency histograms are reset on every call
+		void fill_stats(diagnostic_msgs::DiagnosticStatus &status)
+		{
+			add_stat(status, "frames_received", m_frames_received.load());
+			add_stat(status, "frames_processed", m_frames_processed.load());
+			add_stat(status, "dropped_incomplete", m_frames_incomplete.load());
+			add_stat(status, "dropped_unknown_format", m_frames_unknown_format.load());
+			if (m_frame_queue_ptr != nullptr)
+			{
+				add_stat(status, "queue_depth", m_frame_queue_ptr->size());
+				add_stat(status, "queue_peak_depth", m_queue_peak_depth.exchange(0));
+				add_stat(status, "queue_capacity", m_queue_capacity);
+				add_stat(status, "dropped_queue_oldest", m_queue_dropped_oldest.load());
+				add_stat(status, "dropped_queue_newest", m_queue_dropped_newest.load());
+			}
+			add_stat(status, "loan_fallback_copies", m_loan_state->fallback_copies());
+			if (m_jpeg_encoder_ptr != nullptr)
+			{
+				add_stat(status, "jpeg_frames", m_jpeg_frames.load());
+				add_stat(status, "jpeg_failed", m_jpeg_failed.load());
+				latency_summary summary = m_jpeg_latency.take();
+				add_stat(status, "jpeg_encode_p50_us", summary.p50);
+				add_stat(status, "jpeg_encode_p99_us", summary.p99);
+				add_stat(status, "jpeg_encode_max_us", summary.max);
+			}
+			if (m_mono_pub_ptr != nullptr)
+			{
+				add_stat(status, "mono_frames", m_mono_frames.load());
+			}
+			if (m_pyramid_pub_ptr[0] != nullptr)
+			{
+				add_stat(status, "pyramid_half_frames", m_pyramid_frames[0].load());
+			}
+			if (m_pyramid_pub_ptr[1] != nullptr)
+			{
+				add_stat(status, "pyramid_quarter_frames", m_pyramid_frames[1].load());
+			}
+			for (int i = 0; i < LATENCY_STAGE_COUNT; i++)
+			{
+				latency_summary summary = m_latency[i].take();
+				std::string name = latency_stage_names[i];
+				add_stat(status, name + "_count", summary.count);
+				add_stat(status, name + "_p50_us", summary.p50);
+				add_stat(status, name + "_p95_us", summary.p95);
+				add_stat(status, name + "_p99_us", summary.p99);
+				add_stat(status, name + "_max_us", summary.max);
+			}
+			const ExposureEventRing &event_ring = m_device_event_handler_ptr->get_event_ring();
+			add_stat(status, "events_matched", event_ring.matched());
+			add_stat(status, "events_late", event_ring.late());
+			add_stat(status, "events_missed", event_ring.missed());
+			add_stat(status, "events_dropped", event_ring.dropped());
+		}
+		// number of frames which were copied because too many stream buffers were out on loan
+		uint64_t get_loan_fallback_copies()
+		{
+			return m_loan_state->fallback_copies();
+		}
 		void OnImageEvent(ImagePtr image)
+		{
+			// the wrapper and its control block come from the pool, wrapping a frame does not touch the heap
+			boost::shared_ptr<SpinnakerFrame> frame = m_frame_pool_ptr->acquire();
+			frame->assign(image);
+			handle_frame(frame);
+		}
+		// entry point for every frame, spinnaker, synthetic or replayed, on the thread that delivers it
+		void handle_frame(FramePtr image)
 		{
 			ros::Time image_arrival_time = ros::Time::now();
-			// get the last end of exposure envent from the device event handler (exposure time compensated)
-			ros::Time last_event_stamp = m_device_event_handler_ptr->get_last_exposure_end();
-			ros::Time image_stamp;
-			// if the last event stamp is 0, no end of exposure event was received, assign the image arrival time instead
-			if(last_event_stamp.toSec() == 0.0)
+			m_frames_received++;
+			if (m_frame_queue_ptr == nullptr)
 			{
-				image_stamp = image_arrival_time;
-				ROS_WARN("BLACKFLY NODELET: NO EVENT STAMP ON CAMERA: %s", m_cam_name.c_str());
+				process_frame(image, image_arrival_time);
+				return;
 			}
-			else
+			enqueue_frame(image, image_arrival_time);
+		}
+		// Producer side of the frame queue, runs on the spinnaker callback or polling thread and never blocks.
+		void enqueue_frame(FramePtr image, ros::Time image_arrival_time)
+		{
+			if (m_queue_stopped)
+			{
+				image->release();
+				return;
+			}
+			queued_frame frame;
+			frame.image = image;
+			frame.arrival_time = image_arrival_time;
+			// the ring is rounded up to a power of two, the stream buffers were counted for the exact capacity
+			bool full = m_frame_queue_ptr->size() >= m_queue_capacity;
+			if (full || !m_frame_queue_ptr->push(frame))
 			{
-				image_stamp = last_event_stamp;
+				// the buffer goes straight back to the stream
+				m_queue_dropped_newest++;
+				image->release();
+				ROS_WARN_THROTTLE(1.0, "Blackfly Nodelet: Frame queue full on camera: %s, dropped the newest frame", m_cam_name.c_str());
 			}
-			// ROS_INFO("Time Diff b/w arrival time and stamp = %f mSec",  (image_arrival_time.toSec() - image_stamp.toSec()) * 1000.0);
-			if (image->IsIncomplete())
+			size_t depth = m_frame_queue_ptr->size();
+			if (depth > m_queue_peak_depth.load(std::memory_order_relaxed))
 			{
+				m_queue_peak_depth = depth;
+			}
+			// at most one drain task per camera is in flight, which keeps the queue single consumer
+			if (!m_drain_scheduled.exchange(true))
+			{
+				m_active_drains++;
+				m_worker_pool_ptr->post([this]() { drain_frame_queue(); });
+			}
+		}
+		// Consumer side of the frame queue, runs on a worker thread until the queue is empty.
+		void drain_frame_queue()
+		{
+			while (true)
+			{
+				queued_frame frame;
+				while (!m_queue_stopped && m_frame_queue_ptr->pop(frame))
+				{
+					if (m_queue_policy == QUEUE_DROP_OLDEST && m_frame_queue_ptr->size() >= m_queue_depth)
+					{
+						// enough newer frames are waiting, skip this one
+						m_queue_dropped_oldest++;
+						frame.image->release();
+						ROS_WARN_THROTTLE(1.0, "Blackfly Nodelet: Frame queue full on camera: %s, dropped the oldest frame", m_cam_name.c_str());
+						continue;
+					}
+					process_frame(frame.image, frame.arrival_time);
+					frame.image.reset();
+				}
+				m_drain_scheduled = false;
+				// a frame queued after the last pop but before the flag was cleared did not schedule a drain, take it here
+				if (m_queue_stopped || m_frame_queue_ptr->empty() || m_drain_scheduled.exchange(true))
+				{
+					break;
+				}
+			}
+			m_active_drains--;
+		}
+		// stamps one frame and publishes it, through the frame sync when the camera is synchronized
+		void process_frame(FramePtr image, ros::Time image_arrival_time)
+		{
+			ros::Time process_start_time = ros::Time::now();
+			m_latency[LATENCY_QUEUE_WAIT].record(int64_t(process_start_time.toNSec()) - int64_t(image_arrival_time.toNSec()));
+			if (image->incomplete())
+			{
+				m_frames_incomplete++;
 				ROS_ERROR("Blackfly nodelet : Image retrieval failed : image incomplete");
+				image->release();
 				return;
 			}
+			// exposure, gain, frame id and device time come with the image, no register reads on this thread
+			frame_metadata metadata;
+			if(m_chunk_data_enabled)
+			{
+				metadata = image->metadata();
+			}
+			ros::Time image_stamp;
+			if(image->host_stamp(image_stamp))
+			{
+				// stamped and synchronized when it was recorded, there is no exposure end to measure from
+				publish_frame(image, image_stamp, image_arrival_time, ros::Time(0,0), metadata);
+				return;
+			}
+			// zero while the exposure end is not known on the host clock
+			ros::Time exposure_end_time(0,0);
+			if(m_clock_estimator_ptr != nullptr && metadata.valid && m_clock_estimator_ptr->valid())
+			{
+				// the chunk timestamp is taken at the start of exposure, move it to the end like the exposure end event
+				int64_t exposure_end_ns = metadata.device_timestamp + int64_t(metadata.exposure_time * 1000.0);
+				image_stamp.fromNSec(m_clock_estimator_ptr->to_host(exposure_end_ns));
+				exposure_end_time = image_stamp;
+				// the event is only used for the delivery latency here, so do not wait for it
+				ros::Time event_stamp;
+				if(m_device_event_handler_ptr->get_exposure_end(metadata.frame_id, event_stamp, false))
+				{
+					m_latency[LATENCY_EVENT_DELIVERY].record(int64_t(event_stamp.toNSec()) - int64_t(exposure_end_time.toNSec()));
+				}
+			}
+			else
+			{
+				// get the end of exposure event of this frame from the device event handler, by frame id when the image has one
+				ros::Time event_stamp(0,0);
+				if(metadata.valid && m_device_event_handler_ptr->frame_ids_valid())
+				{
+					m_device_event_handler_ptr->get_exposure_end(metadata.frame_id, event_stamp);
+				}
+				else
+				{
+					event_stamp = m_device_event_handler_ptr->get_last_exposure_end();
+				}
+				// if the event stamp is 0, no end of exposure event was received, assign the image arrival time instead
+				if(event_stamp.toSec() == 0.0)
+				{
+					image_stamp = image_arrival_time;
+					ROS_WARN_THROTTLE(1.0, "BLACKFLY NODELET: NO EVENT STAMP ON CAMERA: %s (%lu frames so far)", m_cam_name.c_str(),
+										(unsigned long)m_device_event_handler_ptr->get_event_ring().missed());
+				}
+				else
+				{
+					image_stamp = event_stamp;
+					exposure_end_time = event_stamp;
+				}
+			}
+			if(!exposure_end_time.isZero())
+			{
+				m_latency[LATENCY_IMAGE_ARRIVAL].record(int64_t(image_arrival_time.toNSec()) - int64_t(exposure_end_time.toNSec()));
+			}
+			// frames of one trigger pulse are matched on the exposure start, cameras with different exposures end at different times
+			ros::Time match_stamp = image_stamp;
+			if(!exposure_end_time.isZero() && metadata.valid)
+			{
+				match_stamp -= ros::Duration(metadata.exposure_time / 1000000.0);
+			}
 			if(m_exp_time_comp_flag)
 			{
-				// get the exposure time
-				double exp_time = double(m_cam_ptr->ExposureTime.GetValue());
+				// get the exposure time actually used for this frame
+				double exp_time;
+				if(metadata.valid)
+				{
+					exp_time = metadata.exposure_time;
+				}
+				else
+				{
+					ROS_WARN_ONCE("Blackfly Nodelet: No chunk data on camera: %s, reading the exposure time from the device", m_cam_name.c_str());
+					exp_time = m_cam_ptr ? double(m_cam_ptr->ExposureTime.GetValue()) : 0.0;
+				}
 				// convert to seconds
 				exp_time /= 1000000.0;
 				// get half the exposure time
@@ -76,108 +519,490 @@ class ImageEventHandler : public ImageEvent
 				// subtract from the end of exposure time to get the middle of the exposure
 				image_stamp -= ros::Duration(exp_time);
 			}
+			if(m_frame_sync_ptr != nullptr)
+			{
+				// parked until the other cameras of the rig joined or the sync wait expired, published on the worker pool with the bundle's stamp
+				m_frame_sync_ptr->submit(m_sync_slot, match_stamp, image_stamp, metadata.valid, int64_t(metadata.frame_id),
+					[this, image, image_arrival_time, exposure_end_time, metadata](ros::Time bundle_stamp)
+					{
+						publish_frame(image, bundle_stamp, image_arrival_time, exposure_end_time, metadata);
+					});
+				return;
+			}
+			publish_frame(image, image_stamp, image_arrival_time, exposure_end_time, metadata);
+		}
+		// publishes the stamped frame on every output, the image is released or handed out on loan
+		void publish_frame(FramePtr image, ros::Time image_stamp, ros::Time image_arrival_time, ros::Time exposure_end_time,
+							const frame_metadata &metadata)
+		{
+			if(metadata.valid)
+			{
+				publish_metadata(metadata, image_stamp);
+			}
+			std::string encoding;
+			if(!get_encoding(image->pixel_format(), encoding))
+			{
+				m_frames_unknown_format++;
+				ROS_ERROR("Unknown pixel format");
+				image->release();
+				return;
+			}
+			// the copy stage starts here, after the event match and any sync wait
+			ros::Time copy_start_time = ros::Time::now();
+			if(m_recorder_ptr != nullptr)
+			{
+				// a copy into a staging slot, the writer thread takes it to disk
+				size_t frame_size = size_t(image->stride()) * image->height();
+				m_recorder_ptr->record(image->data(), frame_size, encoding, image->width(), image->height(), image->stride(),
+										image_stamp, image_arrival_time, metadata);
+			}
+			ros::Time copy_done_time(0,0);
 			if(m_cam_pub_ptr->getNumSubscribers() > 0)
 			{
-				int height = image->GetHeight();
-				int width = image->GetWidth();
-				int stride = image->GetStride();
-				int bits_per_px = image->GetBitsPerPixel();
-				PixelFormatEnums pix_format = image->GetPixelFormat();
-				if(pix_format == PixelFormat_BGR8)
-				{
-					sensor_msgs::fillImage(*image_msg, sensor_msgs::image_encodings::BGR8, 
-											height, width, stride,
-											image->GetData());
-				}
-				else if(pix_format == PixelFormat_Mono8)
+				int height = image->height();
+				int width = image->width();
+				int stride = image->stride();
+				size_t frame_size = size_t(stride) * height;
+				if(frame_size != m_pool_frame_size)
 				{
-					sensor_msgs::fillImage(*image_msg, sensor_msgs::image_encodings::MONO8, 
-											height, width, stride,
-											image->GetData());
-				}
-				else
-				{
-					ROS_ERROR("Unknown pixel format");
-					return;
+					// size every pooled payload once, so fillImage neither allocates nor zero fills on the hot path
+					m_image_pool_ptr->prepare([frame_size](sensor_msgs::Image &msg) { msg.data.resize(frame_size); });
+					m_pool_frame_size = frame_size;
 				}
+				sensor_msgs::Image::Ptr image_msg = m_image_pool_ptr->acquire();
+				sensor_msgs::fillImage(*image_msg, encoding, height, width, stride, image->data());
+				copy_done_time = ros::Time::now();
 				image_msg->header.frame_id = m_cam_name;
 				image_msg->header.stamp = image_stamp;
 				
-				// setup the camera info object
-				sensor_msgs::CameraInfo::Ptr cam_info_msg = boost::make_shared<sensor_msgs::CameraInfo>(sensor_msgs::CameraInfo(m_c_info_mgr_ptr->getCameraInfo()));
+				refresh_camera_info(image_arrival_time);
+				sensor_msgs::CameraInfo::Ptr cam_info_msg = m_cam_info_pool_ptr->acquire();
+				*cam_info_msg = m_cam_info;
 				cam_info_msg->header.frame_id = m_cam_name;
 				cam_info_msg->header.stamp = image_msg->header.stamp;
 
-				// publish the image
-				m_cam_pub_ptr->publish(*image_msg, *cam_info_msg, image_msg->header.stamp);
+				// publish the image as shared pointers, intra-process subscribers receive the pooled messages without a copy
+				m_cam_pub_ptr->publish(sensor_msgs::ImageConstPtr(image_msg), sensor_msgs::CameraInfoConstPtr(cam_info_msg));
+			}
+			if(copy_done_time.isZero())
+			{
+				copy_done_time = ros::Time::now();
 			}
-			image->Release();
+			// the colour image is only computed while somebody listens
+			sensor_msgs::ImageConstPtr color_msg;
+			if(m_color_pub_ptr != nullptr && image->pixel_format() == PixelFormat_BayerRG8 && m_color_pub_ptr->getNumSubscribers() > 0)
+			{
+				color_msg = publish_color(image, image_stamp);
+			}
+			bool mono_wanted = m_mono_pub_ptr != nullptr && m_mono_pub_ptr->getNumSubscribers() > 0;
+			bool jpeg_wanted = m_jpeg_pub_ptr != nullptr && m_jpeg_pub_ptr->getNumSubscribers() > 0;
+			// a bayer_rg8 frame is demosaiced at most once, mono and jpeg share the colour image or a single scratch frame
+			const uint8_t *bgr = nullptr;
+			size_t bgr_step = 0;
+			if(encoding == sensor_msgs::image_encodings::BAYER_RGGB8 && (mono_wanted || jpeg_wanted))
+			{
+				bgr = demosaiced(image, color_msg, bgr_step);
+			}
+			if(mono_wanted)
+			{
+				publish_mono(image, encoding, image_stamp, image_arrival_time, bgr, bgr_step);
+			}
+			if(m_pyramid_pub_ptr[0] != nullptr || m_pyramid_pub_ptr[1] != nullptr)
+			{
+				publish_pyramid(image, encoding, image_stamp, image_arrival_time);
+			}
+			if(jpeg_wanted)
+			{
+				publish_jpeg(image, encoding, image_stamp, bgr, bgr_step);
+			}
+			// the loaned image is published last, once it is out a subscriber may hand the buffer back at any time
+			bool image_loaned = false;
+			if(m_loan_pub_ptr != nullptr && m_loan_pub_ptr->getNumSubscribers() > 0)
+			{
+				LoanedImagePtr loaned_msg;
+				if(m_loan_state->exhausted())
+				{
+					// keep enough buffers in the stream for the camera to continue, copy this one instead
+					m_loan_state->count_fallback_copy();
+					ROS_WARN_THROTTLE(1.0, "Blackfly Nodelet: Stream buffers exhausted on camera: %s, copied %lu frames instead of loaning", 
+										m_cam_name.c_str(), (unsigned long)m_loan_state->fallback_copies());
+					loaned_msg = copy_image(image, encoding);
+				}
+				else
+				{
+					loaned_msg = loan_image(image, encoding, m_loan_state);
+					image_loaned = true;
+				}
+				loaned_msg->header.frame_id = m_cam_name.c_str();
+				loaned_msg->header.stamp = image_stamp;
+				m_loan_pub_ptr->publish(LoanedImageConstPtr(loaned_msg));
+			}
+			if(!image_loaned)
+			{
+				image->release();
+			}
+			ros::Time publish_done_time = ros::Time::now();
+			m_latency[LATENCY_COPY].record(int64_t(copy_done_time.toNSec()) - int64_t(copy_start_time.toNSec()));
+			m_latency[LATENCY_PUBLISH].record(int64_t(publish_done_time.toNSec()) - int64_t(copy_done_time.toNSec()));
+			if(!exposure_end_time.isZero())
+			{
+				m_latency[LATENCY_TOTAL].record(int64_t(publish_done_time.toNSec()) - int64_t(exposure_end_time.toNSec()));
+			}
+			m_frames_processed++;
 		}
-		void config_all_chunk_data()
+		void publish_metadata(const frame_metadata &metadata, ros::Time image_stamp)
 		{
-			INodeMap &node_map = m_cam_ptr->GetNodeMap();
-			CBooleanPtr ptrChunkModeActive = node_map.GetNode("ChunkModeActive");
-			if (!IsAvailable(ptrChunkModeActive) || !IsWritable(ptrChunkModeActive))
 			{
-				ROS_ERROR("Blackfly Nodelet: Unable to activate chunk mode. Timestamps not compensating for exp time");
+				std::lock_guard<std::mutex> lock(m_metadata_mutex);
+				m_last_metadata = metadata;
+			}
+			if(m_metadata_pub_ptr == nullptr || m_metadata_pub_ptr->getNumSubscribers() == 0)
+			{
 				return;
 			}
-			ptrChunkModeActive->SetValue(true);
-			// Retrieve the selector node
-			CEnumerationPtr ptrChunkSelector = node_map.GetNode("ChunkSelector");
-
-			if (!IsAvailable(ptrChunkSelector) || !IsReadable(ptrChunkSelector))
+			blackfly::FrameMetadata::Ptr metadata_msg = boost::make_shared<blackfly::FrameMetadata>();
+			metadata_msg->header.frame_id = m_cam_name;
+			metadata_msg->header.stamp = image_stamp;
+			metadata_msg->frame_id = metadata.frame_id;
+			metadata_msg->device_timestamp = metadata.device_timestamp;
+			metadata_msg->exposure_time = metadata.exposure_time;
+			metadata_msg->gain = metadata.gain;
+			m_metadata_pub_ptr->publish(blackfly::FrameMetadata::ConstPtr(metadata_msg));
+		}
+		sensor_msgs::ImageConstPtr publish_color(FramePtr image, ros::Time image_stamp)
+		{
+			int height = image->height();
+			int width = image->width();
+			size_t step = size_t(width) * 3;
+			if(step * height != m_color_frame_size)
+			{
+				m_color_frame_size = step * height;
+				size_t frame_size = m_color_frame_size;
+				m_color_pool_ptr->prepare([frame_size](sensor_msgs::Image &msg) { msg.data.resize(frame_size); });
+			}
+			sensor_msgs::Image::Ptr color_msg = m_color_pool_ptr->acquire();
+			color_msg->data.resize(m_color_frame_size);
+			color_msg->encoding = sensor_msgs::image_encodings::BGR8;
+			color_msg->height = height;
+			color_msg->width = width;
+			color_msg->step = step;
+			color_msg->is_bigendian = 0;
+			color_msg->header.frame_id = m_cam_name;
+			color_msg->header.stamp = image_stamp;
+			demosaic_rggb8(static_cast<const uint8_t *>(image->data()), image->stride(), &color_msg->data[0], step,
+							width, height, m_demosaic, m_worker_pool_ptr);
+			sensor_msgs::ImageConstPtr published(color_msg);
+			m_color_pub_ptr->publish(published);
+			return published;
+		}
+		// The bgr8 image of a bayer_rg8 frame, the published colour image when there is one, otherwise the frame is
+		// demosaiced into the scratch frame kept for the next one.
+		const uint8_t *demosaiced(FramePtr image, const sensor_msgs::ImageConstPtr &color_msg, size_t &step)
+		{
+			if(color_msg)
+			{
+				step = color_msg->step;
+				return &color_msg->data[0];
+			}
+			int height = image->height();
+			int width = image->width();
+			step = size_t(width) * 3;
+			m_bgr_scratch.resize(step * height);
+			demosaic_rggb8(static_cast<const uint8_t *>(image->data()), image->stride(), &m_bgr_scratch[0], step, width, height,
+							m_demosaic != DEMOSAIC_NONE ? m_demosaic : DEMOSAIC_BILINEAR, m_worker_pool_ptr);
+			return &m_bgr_scratch[0];
+		}
+		// Luminance straight from the stream buffer for bgr8, a bayer_rg8 frame is read from its demosaiced image bgr.
+		void publish_mono(FramePtr image, const std::string &encoding, ros::Time image_stamp, ros::Time image_arrival_time,
+							const uint8_t *bgr, size_t bgr_step)
+		{
+			int height = image->height();
+			int width = image->width();
+			const uint8_t *src = static_cast<const uint8_t *>(image->data());
+			size_t src_step = image->stride();
+			if(encoding == sensor_msgs::image_encodings::BAYER_RGGB8)
+			{
+				src = bgr;
+				src_step = bgr_step;
+			}
+			else if(encoding != sensor_msgs::image_encodings::BGR8)
 			{
-				ROS_ERROR("Blackfly Nodelet: Unable to activate chunk mode. Timestamps not compensating for exp time");
+				ROS_WARN_ONCE("Blackfly Nodelet: No mono output for %s frames on camera: %s", encoding.c_str(), m_cam_name.c_str());
 				return;
 			}
-			// Retrieve entries
-        	NodeList_t entries;
-			ptrChunkSelector->GetEntries(entries);
-			for (size_t i = 0; i < entries.size(); i++)
+			size_t frame_size = size_t(width) * height;
+			if(frame_size != m_mono_frame_size)
 			{
-				// Select entry to be enabled
-				CEnumEntryPtr ptrChunkSelectorEntry = entries.at(i);
-
-				// Go to next node if problem occurs
-				if (!IsAvailable(ptrChunkSelectorEntry) || !IsReadable(ptrChunkSelectorEntry))
+				m_mono_pool_ptr->prepare([frame_size](sensor_msgs::Image &msg) { msg.data.resize(frame_size); });
+				m_mono_frame_size = frame_size;
+			}
+			sensor_msgs::Image::Ptr mono_msg = m_mono_pool_ptr->acquire();
+			mono_msg->data.resize(frame_size);
+			mono_msg->encoding = sensor_msgs::image_encodings::MONO8;
+			mono_msg->height = height;
+			mono_msg->width = width;
+			mono_msg->step = width;
+			mono_msg->is_bigendian = 0;
+			mono_msg->header.frame_id = m_cam_name;
+			mono_msg->header.stamp = image_stamp;
+			bgr8_to_mono8(src, src_step, &mono_msg->data[0], width, width, height, m_worker_pool_ptr);
+			refresh_camera_info(image_arrival_time);
+			sensor_msgs::CameraInfo::Ptr cam_info_msg = m_cam_info_pool_ptr->acquire();
+			*cam_info_msg = m_cam_info;
+			cam_info_msg->header = mono_msg->header;
+			m_mono_pub_ptr->publish(sensor_msgs::ImageConstPtr(mono_msg), sensor_msgs::CameraInfoConstPtr(cam_info_msg));
+			m_mono_frames++;
+		}
+		// setup the camera info object from the cached copy, the camera info manager is only queried once a second
+		void refresh_camera_info(ros::Time image_arrival_time)
+		{
+			bool roi_changed = m_roi_changed.exchange(false);
+			if(roi_changed || m_cam_info_stamp.isZero() || (image_arrival_time - m_cam_info_stamp) > ros::Duration(1.0))
+			{
+				m_cam_info = m_c_info_mgr_ptr->getCameraInfo();
+				m_cam_info_stamp = image_arrival_time;
+				std::lock_guard<std::mutex> lock(m_roi_mutex);
+				m_cam_info.roi = m_roi;
+			}
+		}
+		// Camera info of a level downscaled by factor. As REP 104 has it, the calibration and roi stay in full sensor
+		// coordinates and the binning fields carry the scaling, which image_geometry applies on the subscriber's side.
+		static void scale_camera_info(const sensor_msgs::CameraInfo &full, unsigned int factor, sensor_msgs::CameraInfo &scaled)
+		{
+			scaled = full;
+			scaled.binning_x = std::max(full.binning_x, 1u) * factor;
+			scaled.binning_y = std::max(full.binning_y, 1u) * factor;
+		}
+		// Each level is computed from the one above it, the half level also when only the quarter level is subscribed.
+		void publish_pyramid(FramePtr image, const std::string &encoding, ros::Time image_stamp, ros::Time image_arrival_time)
+		{
+			bool wanted[PYRAMID_LEVELS];
+			bool any = false;
+			for (int i = 0; i < PYRAMID_LEVELS; i++)
+			{
+				wanted[i] = m_pyramid_pub_ptr[i] != nullptr && m_pyramid_pub_ptr[i]->getNumSubscribers() > 0;
+				any = any || wanted[i];
+			}
+			if(!any)
+			{
+				return;
+			}
+			int channels;
+			std::string level_encoding;
+			if(encoding == sensor_msgs::image_encodings::MONO8)
+			{
+				channels = 1;
+				level_encoding = sensor_msgs::image_encodings::MONO8;
+			}
+			else if(encoding == sensor_msgs::image_encodings::BGR8 || encoding == sensor_msgs::image_encodings::BAYER_RGGB8)
+			{
+				channels = 3;
+				level_encoding = sensor_msgs::image_encodings::BGR8;
+			}
+			else
+			{
+				ROS_WARN_ONCE("Blackfly Nodelet: No image pyramid for %s frames on camera: %s", encoding.c_str(), m_cam_name.c_str());
+				return;
+			}
+			refresh_camera_info(image_arrival_time);
+			const uint8_t *src = static_cast<const uint8_t *>(image->data());
+			size_t src_step = image->stride();
+			int width = image->width();
+			int height = image->height();
+			for (int i = 0; i < PYRAMID_LEVELS && (width >= 2 && height >= 2); i++)
+			{
+				bool needed_below = false;
+				for (int j = i + 1; j < PYRAMID_LEVELS; j++)
 				{
-					continue;
+					needed_below = needed_below || wanted[j];
 				}
-
-				ptrChunkSelector->SetIntValue(ptrChunkSelectorEntry->GetValue());
-				std::string chunk_entry_name = ptrChunkSelectorEntry->GetSymbolic().c_str();
-				//ROS_INFO("Blackfly Nodelet: Enabling %s", chunk_entry_name.c_str());
-
-				// Retrieve corresponding boolean
-				CBooleanPtr ptrChunkEnable = node_map.GetNode("ChunkEnable");
-				// Enable the boolean, thus enabling the corresponding chunk data
-				if (!IsAvailable(ptrChunkEnable))
+				if(!wanted[i] && !needed_below)
 				{
-					ROS_WARN("Blackfly Nodelet: Chunk Data: %s not available", chunk_entry_name.c_str());
+					break;
 				}
-				else if (ptrChunkEnable->GetValue())
+				int level_width = width / 2;
+				int level_height = height / 2;
+				size_t level_step = size_t(level_width) * channels;
+				size_t level_size = level_step * level_height;
+				sensor_msgs::Image::Ptr level_msg;
+				uint8_t *dst;
+				if(wanted[i])
 				{
-					//ROS_INFO("Blackfly Nodelet: Chunk Data: %s enabled", chunk_entry_name.c_str());
+					if(level_size != m_pyramid_frame_size[i])
+					{
+						m_pyramid_pool_ptr[i]->prepare([level_size](sensor_msgs::Image &msg) { msg.data.resize(level_size); });
+						m_pyramid_frame_size[i] = level_size;
+					}
+					level_msg = m_pyramid_pool_ptr[i]->acquire();
+					level_msg->data.resize(level_size);
+					dst = &level_msg->data[0];
 				}
-				else if (IsWritable(ptrChunkEnable))
+				else
 				{
-					ptrChunkEnable->SetValue(true);
-					//ROS_INFO("Blackfly Nodelet: Chunk Data: %s enabled", chunk_entry_name.c_str());
+					// only a source for the next level
+					m_pyramid_scratch[i].resize(level_size);
+					dst = &m_pyramid_scratch[i][0];
+				}
+				if(i == 0 && encoding == sensor_msgs::image_encodings::BAYER_RGGB8)
+				{
+					downscale_half_rggb8(src, src_step, dst, level_step, width, height, m_worker_pool_ptr);
 				}
 				else
 				{
-					ROS_WARN("Blackfly Nodelet: Chunk Data: %s not writable", chunk_entry_name.c_str());
+					downscale_half8(src, src_step, dst, level_step, width, height, channels, m_worker_pool_ptr);
+				}
+				if(wanted[i])
+				{
+					level_msg->encoding = level_encoding;
+					level_msg->height = level_height;
+					level_msg->width = level_width;
+					level_msg->step = level_step;
+					level_msg->is_bigendian = 0;
+					level_msg->header.frame_id = m_cam_name;
+					level_msg->header.stamp = image_stamp;
+					sensor_msgs::CameraInfo::Ptr cam_info_msg = m_cam_info_pool_ptr->acquire();
+					scale_camera_info(m_cam_info, 2u << i, *cam_info_msg);
+					cam_info_msg->header = level_msg->header;
+					m_pyramid_pub_ptr[i]->publish(sensor_msgs::ImageConstPtr(level_msg), sensor_msgs::CameraInfoConstPtr(cam_info_msg));
+					m_pyramid_frames[i]++;
 				}
+				src = dst;
+				src_step = level_step;
+				width = level_width;
+				height = level_height;
+			}
+		}
+		// Encodes the frame while its stream buffer is still held, the slices of one frame run on the worker pool in parallel.
+		void publish_jpeg(FramePtr image, const std::string &encoding, ros::Time image_stamp, const uint8_t *bgr, size_t bgr_step)
+		{
+			int height = image->height();
+			int width = image->width();
+			const uint8_t *src = static_cast<const uint8_t *>(image->data());
+			size_t step = image->stride();
+			int channels = 3;
+			if(encoding == sensor_msgs::image_encodings::MONO8)
+			{
+				channels = 1;
+			}
+			else if(encoding == sensor_msgs::image_encodings::BAYER_RGGB8)
+			{
+				// jpeg of the mosaic itself would be useless, encode its demosaiced image
+				src = bgr;
+				step = bgr_step;
+			}
+			else if(encoding != sensor_msgs::image_encodings::BGR8)
+			{
+				ROS_WARN_ONCE("Blackfly Nodelet: No jpeg output for %s frames on camera: %s", encoding.c_str(), m_cam_name.c_str());
+				return;
+			}
+			ros::WallTime encode_start = ros::WallTime::now();
+			sensor_msgs::CompressedImage::Ptr jpeg_msg = m_jpeg_pool_ptr->acquire();
+			if(!m_jpeg_encoder_ptr->encode(src, step, width, height, channels, jpeg_msg->data, m_worker_pool_ptr))
+			{
+				m_jpeg_failed++;
+				return;
 			}
-			ROS_INFO("Blackfly Nodelet: Successfully Configured Chunk Data");
+			m_jpeg_latency.record((ros::WallTime::now() - encode_start).toNSec());
+			m_jpeg_frames++;
+			jpeg_msg->header.frame_id = m_cam_name;
+			jpeg_msg->header.stamp = image_stamp;
+			// same format string as the compressed image_transport plugin, so its subscribers decode it as usual
+			jpeg_msg->format = channels == 1 ? "mono8; jpeg compressed mono8" : "bgr8; jpeg compressed bgr8";
+			m_jpeg_pub_ptr->publish(sensor_msgs::CompressedImageConstPtr(jpeg_msg));
+		}
+		bool get_encoding(PixelFormatEnums pix_format, std::string &encoding)
+		{
+			if(pix_format == PixelFormat_BGR8)
+			{
+				encoding = sensor_msgs::image_encodings::BGR8;
+			}
+			else if(pix_format == PixelFormat_Mono8)
+			{
+				encoding = sensor_msgs::image_encodings::MONO8;
+			}
+			else if(pix_format == PixelFormat_BayerRG8)
+			{
+				encoding = sensor_msgs::image_encodings::BAYER_RGGB8;
+			}
+			else if(pix_format == PixelFormat_BayerRG16)
+			{
+				encoding = sensor_msgs::image_encodings::BAYER_RGGB16;
+			}
+			else
+			{
+				return false;
+			}
+			return true;
+		}
+		// chunk mode is switched on by the camera before its stream buffers are sized, the payload grows with it
+		bool chunk_mode_active()
+		{
+			CBooleanPtr ptrChunkModeActive = m_cam_ptr->GetNodeMap().GetNode("ChunkModeActive");
+			return IsAvailable(ptrChunkModeActive) && IsReadable(ptrChunkModeActive) && ptrChunkModeActive->GetValue();
 		}
 		CameraPtr m_cam_ptr;
 	private:
-		sensor_msgs::ImagePtr image_msg;
+		MessagePool<sensor_msgs::Image> *m_image_pool_ptr;
+		MessagePool<SpinnakerFrame> *m_frame_pool_ptr;
+		MessagePool<sensor_msgs::CameraInfo> *m_cam_info_pool_ptr;
+		size_t m_pool_frame_size;
+		sensor_msgs::CameraInfo m_cam_info;
+		ros::Time m_cam_info_stamp;
+		// readout window handed in by the camera, copied into m_cam_info on the next refresh
+		std::mutex m_roi_mutex;
+		sensor_msgs::RegionOfInterest m_roi;
+		std::atomic<bool> m_roi_changed;
 		DeviceEventHandler* m_device_event_handler_ptr;
 		boost::shared_ptr<camera_info_manager::CameraInfoManager> m_c_info_mgr_ptr;
 		image_transport::CameraPublisher *m_cam_pub_ptr;
+		ros::Publisher *m_loan_pub_ptr;
+		boost::shared_ptr<ImageLoanState> m_loan_state;
+		image_transport::Publisher *m_color_pub_ptr;
+		MessagePool<sensor_msgs::Image> *m_color_pool_ptr;
+		size_t m_color_frame_size;
+		demosaic_method m_demosaic;
+		WorkerPool *m_worker_pool_ptr;
+		ros::Publisher *m_metadata_pub_ptr;
+		ClockEstimator *m_clock_estimator_ptr;
+		bool m_chunk_data_enabled;
+		std::mutex m_metadata_mutex;
+		frame_metadata m_last_metadata;
+		SpscQueue<queued_frame> *m_frame_queue_ptr;
+		size_t m_queue_depth;
+		size_t m_queue_capacity;
+		queue_overflow_policy m_queue_policy;
+		std::atomic<bool> m_queue_stopped;
+		std::atomic<bool> m_drain_scheduled;
+		std::atomic<int> m_active_drains;
+		std::atomic<size_t> m_queue_peak_depth;
+		std::atomic<uint64_t> m_frames_received;
+		std::atomic<uint64_t> m_frames_processed;
+		std::atomic<uint64_t> m_frames_incomplete;
+		std::atomic<uint64_t> m_frames_unknown_format;
+		std::atomic<uint64_t> m_queue_dropped_oldest;
+		std::atomic<uint64_t> m_queue_dropped_newest;
+		LatencyHistogram m_latency[LATENCY_STAGE_COUNT];
+		FrameSynchronizer *m_frame_sync_ptr;
+		ros::Publisher *m_jpeg_pub_ptr;
+		JpegEncoder *m_jpeg_encoder_ptr;
+		MessagePool<sensor_msgs::CompressedImage> *m_jpeg_pool_ptr;
+		image_transport::CameraPublisher *m_mono_pub_ptr;
+		MessagePool<sensor_msgs::Image> *m_mono_pool_ptr;
+		size_t m_mono_frame_size;
+		// demosaiced bayer frame for mono and jpeg when the colour topic did not produce one
+		std::vector<uint8_t> m_bgr_scratch;
+		std::atomic<uint64_t> m_mono_frames;
+		image_transport::CameraPublisher *m_pyramid_pub_ptr[PYRAMID_LEVELS];
+		MessagePool<sensor_msgs::Image> *m_pyramid_pool_ptr[PYRAMID_LEVELS];
+		size_t m_pyramid_frame_size[PYRAMID_LEVELS];
+		// levels computed only as the source of a smaller one
+		std::vector<uint8_t> m_pyramid_scratch[PYRAMID_LEVELS];
+		std::atomic<uint64_t> m_pyramid_frames[PYRAMID_LEVELS];
+		std::atomic<uint64_t> m_jpeg_frames;
+		std::atomic<uint64_t> m_jpeg_failed;
+		LatencyHistogram m_jpeg_latency;
+		FrameRecorder *m_recorder_ptr;
+		int m_sync_slot;
 		std::string m_cam_name;
 		ros::Time m_last_image_stamp;
 		bool m_exp_time_comp_flag = false;
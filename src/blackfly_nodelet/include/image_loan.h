@@ -0,0 +1,211 @@
+#ifndef IMAGE_LOAN_
+#define IMAGE_LOAN_
+#include <atomic>
+#include <memory>
+#include <new>
+#include <cstring>
+
+#include <sensor_msgs/Image.h>
+#include <sensor_msgs/image_encodings.h>
+
+#include "Spinnaker.h"
+
+#include "camera_frame.h"
+
+using namespace Spinnaker;
+
+// Allocator which hands a single caller provided buffer to the first allocation that fits in it.
+// A vector built on a loaned allocator therefore aliases the spinnaker acquisition buffer instead of copying it.
+// Without a loan (or once rebound to another type) it behaves like std::allocator, so deserialized messages still own their data.
+template <class T>
+class loan_allocator
+{
+	public:
+		typedef T value_type;
+		typedef T *pointer;
+		typedef const T *const_pointer;
+		typedef std::size_t size_type;
+		typedef std::ptrdiff_t difference_type;
+		typedef std::false_type propagate_on_container_copy_assignment;
+		typedef std::true_type propagate_on_container_move_assignment;
+		typedef std::true_type propagate_on_container_swap;
+		template <class U>
+		struct rebind
+		{
+			typedef loan_allocator<U> other;
+		};
+
+		loan_allocator() : m_loan(nullptr), m_loan_size(0) {}
+		loan_allocator(void *p_loan, size_t p_loan_size) : m_loan(p_loan), m_loan_size(p_loan_size) {}
+		loan_allocator(const loan_allocator &other) : m_loan(other.m_loan), m_loan_size(other.m_loan_size) {}
+		// the loan is never shared across rebinds, strings in the header must not land in the image buffer
+		template <class U>
+		loan_allocator(const loan_allocator<U> &) : m_loan(nullptr), m_loan_size(0) {}
+		// a copied message owns its pixels, only the vector built in loan_image points into the acquisition buffer
+		loan_allocator select_on_container_copy_construction() const
+		{
+			return loan_allocator();
+		}
+
+		T *allocate(size_t n)
+		{
+			if (m_loan != nullptr && n * sizeof(T) <= m_loan_size)
+			{
+				return static_cast<T *>(m_loan);
+			}
+			return static_cast<T *>(::operator new(n * sizeof(T)));
+		}
+		void deallocate(T *p, size_t)
+		{
+			if (p != m_loan)
+			{
+				::operator delete(p);
+			}
+		}
+		// default construction is a no-op so resize() does not overwrite the loaned pixels
+		template <class U>
+		void construct(U *p)
+		{
+			::new (static_cast<void *>(p)) U;
+		}
+		template <class U, class... Args>
+		void construct(U *p, Args &&... args)
+		{
+			::new (static_cast<void *>(p)) U(std::forward<Args>(args)...);
+		}
+		template <class U>
+		void destroy(U *p)
+		{
+			p->~U();
+		}
+		size_t max_size() const
+		{
+			return size_t(-1) / sizeof(T);
+		}
+		void *loan() const
+		{
+			return m_loan;
+		}
+		bool operator==(const loan_allocator &other) const
+		{
+			return m_loan == other.m_loan;
+		}
+		bool operator!=(const loan_allocator &other) const
+		{
+			return m_loan != other.m_loan;
+		}
+
+	private:
+		void *m_loan;
+		size_t m_loan_size;
+};
+
+// Same wire format (and md5sum) as sensor_msgs::Image. Intra-process subscribers declaring this type receive
+// the loaned buffer directly, plain sensor_msgs::Image subscribers get a serialized copy from roscpp.
+typedef sensor_msgs::Image_<loan_allocator<void> > LoanedImage;
+typedef boost::shared_ptr<LoanedImage> LoanedImagePtr;
+typedef boost::shared_ptr<LoanedImage const> LoanedImageConstPtr;
+
+// Book keeping shared between the image event handler and every loaned message it has published.
+// It outlives the handler so late subscribers can still hand their buffers back.
+class ImageLoanState
+{
+	public:
+		ImageLoanState(unsigned int p_max_loans) : m_max_loans(p_max_loans), m_outstanding(0), m_fallback_copies(0), m_open(true) {}
+		// true when lending another buffer would leave the stream without enough free buffers
+		bool exhausted() const
+		{
+			return m_outstanding.load() >= m_max_loans;
+		}
+		unsigned int outstanding() const
+		{
+			return m_outstanding.load();
+		}
+		uint64_t fallback_copies() const
+		{
+			return m_fallback_copies.load();
+		}
+		void count_fallback_copy()
+		{
+			m_fallback_copies++;
+		}
+		// stop returning buffers to the stream, called before the camera ends acquisition
+		void close()
+		{
+			m_open = false;
+		}
+		void lend()
+		{
+			m_outstanding++;
+		}
+		// memory the loaned buffers live in, freed only once the last loan is returned
+		void keep_alive(boost::shared_ptr<void> p_memory)
+		{
+			m_memory = p_memory;
+		}
+		void give_back(FramePtr &image)
+		{
+			if (m_open.load())
+			{
+				image->release();
+			}
+			image.reset();
+			m_outstanding--;
+		}
+
+	private:
+		const unsigned int m_max_loans;
+		std::atomic<unsigned int> m_outstanding;
+		std::atomic<uint64_t> m_fallback_copies;
+		std::atomic<bool> m_open;
+		boost::shared_ptr<void> m_memory;
+};
+
+// shared_ptr deleter keeping the frame alive until the last subscriber drops the message
+class ImageLoanReturn
+{
+	public:
+		ImageLoanReturn(FramePtr p_image, boost::shared_ptr<ImageLoanState> p_state) : m_image(p_image), m_state(p_state) {}
+		void operator()(LoanedImage *msg)
+		{
+			delete msg;
+			m_state->give_back(m_image);
+		}
+
+	private:
+		FramePtr m_image;
+		boost::shared_ptr<ImageLoanState> m_state;
+};
+
+// Wraps the buffer of image in a message without copying. The image must not be released by the caller,
+// it goes back to its source when the returned pointer's reference count drops to zero.
+inline LoanedImagePtr loan_image(FramePtr image, const std::string &encoding, const boost::shared_ptr<ImageLoanState> &state)
+{
+	size_t size = size_t(image->stride()) * image->height();
+	LoanedImage *msg = new LoanedImage();
+	msg->data = LoanedImage::_data_type(loan_allocator<uint8_t>(const_cast<void *>(image->data()), size));
+	msg->data.resize(size);
+	msg->encoding = encoding.c_str();
+	msg->height = image->height();
+	msg->width = image->width();
+	msg->step = image->stride();
+	msg->is_bigendian = 0;
+	state->lend();
+	return LoanedImagePtr(msg, ImageLoanReturn(image, state));
+}
+
+// Fallback when the stream is running low on buffers: an owning copy of the image in the loaned message type
+inline LoanedImagePtr copy_image(FramePtr image, const std::string &encoding)
+{
+	size_t size = size_t(image->stride()) * image->height();
+	LoanedImagePtr msg = boost::make_shared<LoanedImage>();
+	msg->data.resize(size);
+	std::memcpy(&msg->data[0], image->data(), size);
+	msg->encoding = encoding.c_str();
+	msg->height = image->height();
+	msg->width = image->width();
+	msg->step = image->stride();
+	msg->is_bigendian = 0;
+	return msg;
+}
+#endif // IMAGE_LOAN_
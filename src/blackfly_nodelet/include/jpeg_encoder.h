@@ -0,0 +1,245 @@
+#ifndef JPEG_ENCODER_
+#define JPEG_ENCODER_
+#include <cstdio>
+#include <cstdlib>
+#include <cstdint>
+#include <csetjmp>
+#include <vector>
+#include <algorithm>
+
+#include <jpeglib.h>
+
+#include <ros/ros.h>
+
+#include "worker_pool.h"
+
+// JPEG encoder for the compressed image topic, built on libjpeg-turbo.
+// A frame is cut into horizontal slices that are encoded in parallel on the worker pool. Every slice is a whole number
+// of MCU rows and exactly one restart interval, and all slices use the same standard tables (no Huffman optimisation).
+// Their entropy coded data is therefore joined into one baseline JPEG by putting RSTn markers between the slices
+// and taking the headers of the first slice, with the frame height patched in. Any decoder reads the result.
+
+// the restart interval field of the DRI marker is 16 bits, counted in MCUs
+#define JPEG_MAX_RESTART_INTERVAL 65535
+
+class JpegEncoder
+{
+	public:
+		JpegEncoder(int p_quality, unsigned int p_max_slices)
+		{
+			m_quality = std::max(1, std::min(100, p_quality));
+			m_max_slices = p_max_slices > 0 ? p_max_slices : 1;
+		}
+		~JpegEncoder()
+		{
+			for (size_t i = 0; i < m_slices.size(); i++)
+			{
+				jpeg_destroy_compress(&m_slices[i]->cinfo);
+				free(m_slices[i]->buffer);
+				delete m_slices[i];
+			}
+		}
+		// Encodes a mono8 (p_channels 1) or bgr8 (p_channels 3) frame into p_out, returns false if libjpeg failed.
+		// p_out keeps its capacity between frames, pass the data vector of a pooled message.
+		bool encode(const uint8_t *p_src, size_t p_step, int p_width, int p_height, int p_channels, std::vector<uint8_t> &p_out, WorkerPool *p_worker_pool_ptr)
+		{
+			// 4:2:0 colour works on 16x16 MCUs, grey on 8x8
+			int mcu_size = p_channels == 3 ? 16 : 8;
+			int mcus_per_row = (p_width + mcu_size - 1) / mcu_size;
+			int mcu_rows = (p_height + mcu_size - 1) / mcu_size;
+			size_t max_slices = m_max_slices;
+			if (p_worker_pool_ptr != nullptr)
+			{
+				max_slices = std::min(max_slices, p_worker_pool_ptr->size() + 1);
+			}
+			else
+			{
+				max_slices = 1;
+			}
+			int slice_mcu_rows = (mcu_rows + int(max_slices) - 1) / int(max_slices);
+			slice_mcu_rows = std::max(1, std::min(slice_mcu_rows, JPEG_MAX_RESTART_INTERVAL / mcus_per_row));
+			int slice_rows = slice_mcu_rows * mcu_size;
+			size_t num_slices = size_t((p_height + slice_rows - 1) / slice_rows);
+			while (m_slices.size() < num_slices)
+			{
+				m_slices.push_back(new slice_state());
+			}
+			unsigned int restart_interval = (unsigned int)(slice_mcu_rows * mcus_per_row);
+			for (size_t i = 0; i < num_slices; i++)
+			{
+				slice_state &slice = *m_slices[i];
+				slice.src = p_src + i * slice_rows * p_step;
+				slice.step = p_step;
+				slice.width = p_width;
+				slice.height = std::min(slice_rows, p_height - int(i) * slice_rows);
+				slice.channels = p_channels;
+				slice.restart_interval = restart_interval;
+			}
+			if (num_slices > 1)
+			{
+				p_worker_pool_ptr->parallel_for(num_slices, [this](size_t i) { encode_slice(*m_slices[i]); });
+			}
+			else
+			{
+				encode_slice(*m_slices[0]);
+			}
+			for (size_t i = 0; i < num_slices; i++)
+			{
+				if (!m_slices[i]->ok)
+				{
+					return false;
+				}
+			}
+			return stitch(num_slices, p_height, p_out);
+		}
+		int quality() const
+		{
+			return m_quality;
+		}
+
+	private:
+		// libjpeg reports errors by calling error_exit, which would end the process by default
+		struct error_state
+		{
+			jpeg_error_mgr mgr;
+			jmp_buf jump;
+		};
+		struct slice_state
+		{
+			slice_state() : buffer(nullptr), buffer_size(0), dest_buffer(nullptr), dest_size(0), length(0), ok(false), src(nullptr), step(0), width(0), height(0), channels(0), restart_interval(0)
+			{
+				cinfo.err = jpeg_std_error(&error.mgr);
+				error.mgr.error_exit = &JpegEncoder::error_exit;
+				jpeg_create_compress(&cinfo);
+			}
+			jpeg_compress_struct cinfo;
+			error_state error;
+			// output of the slice as a complete jpeg, grown by libjpeg and kept for the next frame
+			unsigned char *buffer;
+			unsigned long buffer_size;
+			unsigned char *dest_buffer;
+			unsigned long dest_size;
+			unsigned long length;
+			bool ok;
+			const uint8_t *src;
+			size_t step;
+			int width;
+			int height;
+			int channels;
+			unsigned int restart_interval;
+		};
+		static void error_exit(j_common_ptr cinfo)
+		{
+			char message[JMSG_LENGTH_MAX];
+			(*cinfo->err->format_message)(cinfo, message);
+			ROS_ERROR_THROTTLE(1.0, "Blackfly Nodelet: JPEG encoding failed: %s", message);
+			error_state *error = reinterpret_cast<error_state *>(cinfo->err);
+			longjmp(error->jump, 1);
+		}
+		void encode_slice(slice_state &slice)
+		{
+			slice.ok = false;
+			jpeg_compress_struct &cinfo = slice.cinfo;
+			// jpeg_mem_dest reallocates when the slice outgrows the buffer, the old block is then ours to free.
+			// The destination lives in the slice and not on the stack, so it is still valid after a longjmp.
+			slice.dest_buffer = slice.buffer;
+			slice.dest_size = slice.buffer_size;
+			if (setjmp(slice.error.jump))
+			{
+				jpeg_abort_compress(&cinfo);
+				if (slice.dest_buffer != slice.buffer)
+				{
+					free(slice.dest_buffer);
+				}
+				return;
+			}
+			jpeg_mem_dest(&cinfo, &slice.dest_buffer, &slice.dest_size);
+			cinfo.image_width = slice.width;
+			cinfo.image_height = slice.height;
+			cinfo.input_components = slice.channels;
+			cinfo.in_color_space = slice.channels == 3 ? JCS_EXT_BGR : JCS_GRAYSCALE;
+			jpeg_set_defaults(&cinfo);
+			jpeg_set_quality(&cinfo, m_quality, TRUE);
+			cinfo.optimize_coding = FALSE;
+			cinfo.restart_interval = slice.restart_interval;
+			cinfo.dct_method = JDCT_ISLOW;
+			jpeg_start_compress(&cinfo, TRUE);
+			while (cinfo.next_scanline < cinfo.image_height)
+			{
+				JSAMPROW row = const_cast<JSAMPROW>(slice.src + cinfo.next_scanline * slice.step);
+				jpeg_write_scanlines(&cinfo, &row, 1);
+			}
+			jpeg_finish_compress(&cinfo);
+			if (slice.dest_buffer != slice.buffer)
+			{
+				free(slice.buffer);
+				slice.buffer = slice.dest_buffer;
+				// dest_size is the length written, the allocation is at least that big
+				slice.buffer_size = slice.dest_size;
+			}
+			slice.length = slice.dest_size;
+			slice.ok = true;
+		}
+		// offset of the SOF segment and of the first byte after the SOS header, false if the slice is not a baseline jpeg
+		static bool find_segments(const unsigned char *data, unsigned long length, unsigned long &sof, unsigned long &scan)
+		{
+			unsigned long pos = 2;
+			sof = 0;
+			while (pos + 4 <= length && data[pos] == 0xFF)
+			{
+				unsigned char marker = data[pos + 1];
+				unsigned long segment = (unsigned long)(data[pos + 2] << 8 | data[pos + 3]);
+				if (marker == 0xC0 || marker == 0xC1)
+				{
+					sof = pos;
+				}
+				else if (marker == 0xDA)
+				{
+					scan = pos + 2 + segment;
+					return sof != 0 && scan <= length;
+				}
+				pos += 2 + segment;
+			}
+			return false;
+		}
+		bool stitch(size_t num_slices, int height, std::vector<uint8_t> &out)
+		{
+			size_t total = 0;
+			for (size_t i = 0; i < num_slices; i++)
+			{
+				total += m_slices[i]->length + 2;
+			}
+			out.resize(total);
+			size_t pos = 0;
+			for (size_t i = 0; i < num_slices; i++)
+			{
+				const slice_state &slice = *m_slices[i];
+				unsigned long sof, scan;
+				if (!find_segments(slice.buffer, slice.length, sof, scan) || slice.length < scan + 2)
+				{
+					ROS_ERROR_THROTTLE(1.0, "Blackfly Nodelet: Unexpected JPEG layout from libjpeg");
+					return false;
+				}
+				// headers only from the first slice, every slice then adds its entropy coded data without the EOI
+				unsigned long begin = i == 0 ? 0 : scan;
+				unsigned long end = slice.length - 2;
+				std::copy(slice.buffer + begin, slice.buffer + end, out.begin() + pos);
+				if (i == 0)
+				{
+					out[pos + sof + 5] = uint8_t(height >> 8);
+					out[pos + sof + 6] = uint8_t(height & 0xFF);
+				}
+				pos += end - begin;
+				out[pos++] = 0xFF;
+				out[pos++] = i + 1 < num_slices ? uint8_t(0xD0 + (i & 7)) : 0xD9;
+			}
+			out.resize(pos);
+			return true;
+		}
+		JpegEncoder(const JpegEncoder &);
+		JpegEncoder &operator=(const JpegEncoder &);
+		int m_quality;
+		unsigned int m_max_slices;
+		std::vector<slice_state *> m_slices;
+};
+#endif // JPEG_ENCODER_
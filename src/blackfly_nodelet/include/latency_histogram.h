@@ -0,0 +1,113 @@
+#ifndef LATENCY_HISTOGRAM_
+#define LATENCY_HISTOGRAM_
+#include <atomic>
+#include <cstdint>
+#include <cstddef>
+
+// Fixed bucket latency histogram in microseconds, recorded by the image thread and read by the stats timer.
+// Recording is a couple of relaxed atomic increments, no locks and no allocation.
+// Buckets are linear up to LATENCY_SUB_BUCKETS us and then split every power of two into LATENCY_SUB_BUCKETS,
+// so percentiles are accurate to 1/LATENCY_SUB_BUCKETS of their value.
+
+#define LATENCY_SUB_BUCKETS 8
+// powers of two above the linear range, 8 us << 24 is a bit over two minutes
+#define LATENCY_OCTAVES 24
+#define LATENCY_BUCKETS (LATENCY_SUB_BUCKETS * (LATENCY_OCTAVES + 1))
+
+struct latency_summary
+{
+	latency_summary() : count(0), p50(0), p95(0), p99(0), max(0) {}
+	uint64_t count;
+	// [us], percentiles are the upper edge of their bucket
+	uint64_t p50;
+	uint64_t p95;
+	uint64_t p99;
+	uint64_t max;
+};
+
+class LatencyHistogram
+{
+	public:
+		LatencyHistogram() : m_max(0)
+		{
+			for (size_t i = 0; i < LATENCY_BUCKETS; i++)
+			{
+				m_buckets[i].store(0);
+			}
+		}
+		void record(int64_t latency_ns)
+		{
+			uint64_t latency_us = latency_ns > 0 ? uint64_t(latency_ns) / 1000 : 0;
+			m_buckets[bucket(latency_us)].fetch_add(1, std::memory_order_relaxed);
+			uint64_t max = m_max.load(std::memory_order_relaxed);
+			while (latency_us > max && !m_max.compare_exchange_weak(max, latency_us, std::memory_order_relaxed))
+			{
+			}
+		}
+		// summary of everything recorded since the last call, the histogram starts over
+		latency_summary take()
+		{
+			uint64_t counts[LATENCY_BUCKETS];
+			latency_summary summary;
+			for (size_t i = 0; i < LATENCY_BUCKETS; i++)
+			{
+				counts[i] = m_buckets[i].exchange(0, std::memory_order_relaxed);
+				summary.count += counts[i];
+			}
+			summary.max = m_max.exchange(0, std::memory_order_relaxed);
+			if (summary.count == 0)
+			{
+				return summary;
+			}
+			summary.p50 = percentile(counts, summary.count, 0.50);
+			summary.p95 = percentile(counts, summary.count, 0.95);
+			summary.p99 = percentile(counts, summary.count, 0.99);
+			return summary;
+		}
+
+	private:
+		static size_t bucket(uint64_t latency_us)
+		{
+			if (latency_us < LATENCY_SUB_BUCKETS)
+			{
+				return latency_us;
+			}
+			// octave of the value above the linear range, then its position within the octave
+			int msb = 63 - __builtin_clzll(latency_us);
+			int octave = msb - 3;
+			if (octave >= LATENCY_OCTAVES)
+			{
+				return LATENCY_BUCKETS - 1;
+			}
+			size_t sub = (latency_us >> octave) - LATENCY_SUB_BUCKETS;
+			return LATENCY_SUB_BUCKETS * (octave + 1) + sub;
+		}
+		static uint64_t upper_edge(size_t index)
+		{
+			if (index < LATENCY_SUB_BUCKETS)
+			{
+				return index;
+			}
+			size_t octave = index / LATENCY_SUB_BUCKETS - 1;
+			size_t sub = index % LATENCY_SUB_BUCKETS;
+			return ((uint64_t(LATENCY_SUB_BUCKETS + sub + 1)) << octave) - 1;
+		}
+		static uint64_t percentile(const uint64_t *counts, uint64_t total, double fraction)
+		{
+			uint64_t rank = uint64_t(fraction * double(total) + 0.5);
+			rank = rank > 0 ? rank : 1;
+			uint64_t seen = 0;
+			for (size_t i = 0; i < LATENCY_BUCKETS; i++)
+			{
+				seen += counts[i];
+				if (seen >= rank)
+				{
+					return upper_edge(i);
+				}
+			}
+			return upper_edge(LATENCY_BUCKETS - 1);
+		}
+		std::atomic<uint64_t> m_buckets[LATENCY_BUCKETS];
+		std::atomic<uint64_t> m_max;
+};
+#endif // LATENCY_HISTOGRAM_
@@ -0,0 +1,109 @@
+#ifndef LUMINANCE_
+#define LUMINANCE_
+#include <cstdint>
+#include <cstddef>
+#include <algorithm>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#include "worker_pool.h"
+
+// Luminance of interleaved BGR8 frames for the mono topic of colour cameras, Y = 0.114 B + 0.587 G + 0.299 R
+// (BT.601) in 8 bit fixed point. The interior of every row runs through an SSE2 kernel, 16 pixels at a time, which
+// AVX2 builds use as well: deinterleaving BGR costs more shuffles across 256 bit lanes than it saves.
+// Rows are split into bands which are processed on the worker pool.
+
+// weights out of 256
+#define LUMA_WEIGHT_B 29
+#define LUMA_WEIGHT_G 150
+#define LUMA_WEIGHT_R 77
+// rows handed to one worker at a time
+#define LUMA_BAND_ROWS 32
+
+namespace luminance
+{
+	inline void row_scalar(const uint8_t *bgr, uint8_t *out, int x0, int x1)
+	{
+		for (int x = x0; x < x1; x++)
+		{
+			out[x] = uint8_t((LUMA_WEIGHT_B * bgr[3 * x] + LUMA_WEIGHT_G * bgr[3 * x + 1] + LUMA_WEIGHT_R * bgr[3 * x + 2] + 128) >> 8);
+		}
+	}
+
+#if defined(__SSE2__)
+	#define LUMA_VECTOR_PIXELS 16
+	// splits 48 interleaved bytes into the 16 bytes of each channel, four rounds of byte unpacking
+	inline void deinterleave3(const uint8_t *p, __m128i &c0, __m128i &c1, __m128i &c2)
+	{
+		__m128i t00 = _mm_loadu_si128(reinterpret_cast<const __m128i *>(p));
+		__m128i t01 = _mm_loadu_si128(reinterpret_cast<const __m128i *>(p + 16));
+		__m128i t02 = _mm_loadu_si128(reinterpret_cast<const __m128i *>(p + 32));
+		for (int round = 0; round < 4; round++)
+		{
+			__m128i t10 = _mm_unpacklo_epi8(t00, _mm_unpackhi_epi64(t01, t01));
+			__m128i t11 = _mm_unpacklo_epi8(_mm_unpackhi_epi64(t00, t00), t02);
+			__m128i t12 = _mm_unpacklo_epi8(t01, _mm_unpackhi_epi64(t02, t02));
+			t00 = t10;
+			t01 = t11;
+			t02 = t12;
+		}
+		c0 = t00;
+		c1 = t01;
+		c2 = t02;
+	}
+	// weighted sum of 8 pixels widened to 16 bit, fits since the weights add up to 256
+	inline __m128i luma16(__m128i b, __m128i g, __m128i r)
+	{
+		__m128i sum = _mm_add_epi16(_mm_add_epi16(_mm_mullo_epi16(b, _mm_set1_epi16(LUMA_WEIGHT_B)), _mm_mullo_epi16(g, _mm_set1_epi16(LUMA_WEIGHT_G))),
+									_mm_add_epi16(_mm_mullo_epi16(r, _mm_set1_epi16(LUMA_WEIGHT_R)), _mm_set1_epi16(128)));
+		return _mm_srli_epi16(sum, 8);
+	}
+	// returns the first pixel not processed
+	inline int row_vector(const uint8_t *bgr, uint8_t *out, int width)
+	{
+		const __m128i zero = _mm_setzero_si128();
+		int x = 0;
+		for (; x + LUMA_VECTOR_PIXELS <= width; x += LUMA_VECTOR_PIXELS)
+		{
+			__m128i b, g, r;
+			deinterleave3(bgr + 3 * x, b, g, r);
+			__m128i lo = luma16(_mm_unpacklo_epi8(b, zero), _mm_unpacklo_epi8(g, zero), _mm_unpacklo_epi8(r, zero));
+			__m128i hi = luma16(_mm_unpackhi_epi8(b, zero), _mm_unpackhi_epi8(g, zero), _mm_unpackhi_epi8(r, zero));
+			_mm_storeu_si128(reinterpret_cast<__m128i *>(out + x), _mm_packus_epi16(lo, hi));
+		}
+		return x;
+	}
+#endif
+
+	inline void bgr8_rows(const uint8_t *src, size_t src_step, uint8_t *dst, size_t dst_step, int width, int y0, int y1)
+	{
+		for (int y = y0; y < y1; y++)
+		{
+			const uint8_t *row = src + size_t(y) * src_step;
+			uint8_t *out = dst + size_t(y) * dst_step;
+			int x = 0;
+#ifdef LUMA_VECTOR_PIXELS
+			x = row_vector(row, out, width);
+#endif
+			row_scalar(row, out, x, width);
+		}
+	}
+} // namespace luminance
+
+// Luminance of a BGR8 frame into a mono8 frame of the same size. Without a pool (or for tiny frames) everything runs on the calling thread.
+inline void bgr8_to_mono8(const uint8_t *src, size_t src_step, uint8_t *dst, size_t dst_step, int width, int height, WorkerPool *pool)
+{
+	int bands = (height + LUMA_BAND_ROWS - 1) / LUMA_BAND_ROWS;
+	if (pool == nullptr || bands <= 1)
+	{
+		luminance::bgr8_rows(src, src_step, dst, dst_step, width, 0, height);
+		return;
+	}
+	pool->parallel_for(bands, [=](size_t band) {
+		int y0 = int(band) * LUMA_BAND_ROWS;
+		luminance::bgr8_rows(src, src_step, dst, dst_step, width, y0, std::min(height, y0 + LUMA_BAND_ROWS));
+	});
+}
+#endif // LUMINANCE_
@@ -0,0 +1,186 @@
+#ifndef MESSAGE_POOL_
+#define MESSAGE_POOL_
+#include <vector>
+#include <mutex>
+#include <atomic>
+#include <new>
+
+#include <boost/shared_ptr.hpp>
+#include <boost/make_shared.hpp>
+
+// Recycles the shared_ptr control blocks of one pool, so handing out a pooled message does not touch the heap either.
+// All control blocks of a pool have the same type, the first block returned fixes the size which is cached.
+class control_block_cache
+{
+	public:
+		~control_block_cache()
+		{
+			for (size_t i = 0; i < m_free.size(); i++)
+			{
+				::operator delete(m_free[i]);
+			}
+		}
+		void *get(size_t size)
+		{
+			{
+				std::lock_guard<std::mutex> lock(m_mutex);
+				if (size == m_block_size && !m_free.empty())
+				{
+					void *block = m_free.back();
+					m_free.pop_back();
+					return block;
+				}
+			}
+			return ::operator new(size);
+		}
+		void put(void *block, size_t size)
+		{
+			{
+				std::lock_guard<std::mutex> lock(m_mutex);
+				if (m_block_size == 0)
+				{
+					m_block_size = size;
+				}
+				if (size == m_block_size)
+				{
+					m_free.push_back(block);
+					return;
+				}
+			}
+			::operator delete(block);
+		}
+
+	private:
+		std::mutex m_mutex;
+		std::vector<void *> m_free;
+		size_t m_block_size = 0;
+};
+
+template <class T>
+class control_block_allocator
+{
+	public:
+		typedef T value_type;
+		template <class U>
+		struct rebind
+		{
+			typedef control_block_allocator<U> other;
+		};
+		control_block_allocator(boost::shared_ptr<control_block_cache> p_cache) : m_cache(p_cache) {}
+		template <class U>
+		control_block_allocator(const control_block_allocator<U> &other) : m_cache(other.m_cache) {}
+		T *allocate(size_t n)
+		{
+			return static_cast<T *>(m_cache->get(n * sizeof(T)));
+		}
+		void deallocate(T *p, size_t n)
+		{
+			m_cache->put(p, n * sizeof(T));
+		}
+		bool operator==(const control_block_allocator &other) const
+		{
+			return m_cache == other.m_cache;
+		}
+		bool operator!=(const control_block_allocator &other) const
+		{
+			return m_cache != other.m_cache;
+		}
+		boost::shared_ptr<control_block_cache> m_cache;
+};
+
+// Pool of preallocated messages handed out as shared pointers. A message goes back to the pool once its reference count
+// drops to zero, so subscribers can hold on to it as long as they like without racing the next frame.
+// The pool grows when it runs dry, in steady state acquire() neither allocates nor reinitializes the message.
+template <class M>
+class MessagePool
+{
+	public:
+		typedef boost::shared_ptr<M> Ptr;
+
+		MessagePool(size_t p_size) : m_state(boost::make_shared<pool_state>())
+		{
+			m_state->free.reserve(p_size);
+			for (size_t i = 0; i < p_size; i++)
+			{
+				m_state->free.push_back(new M());
+			}
+			m_state->allocated = p_size;
+		}
+		Ptr acquire()
+		{
+			M *msg = m_state->take();
+			return Ptr(msg, message_return(m_state), control_block_allocator<M>(m_state->cache));
+		}
+		// apply fn to every message currently in the pool, used to size the payloads before the first frame
+		template <class F>
+		void prepare(F fn)
+		{
+			std::lock_guard<std::mutex> lock(m_state->mutex);
+			for (size_t i = 0; i < m_state->free.size(); i++)
+			{
+				fn(*m_state->free[i]);
+			}
+		}
+		// number of messages that had to be allocated because the pool was empty
+		uint64_t misses() const
+		{
+			return m_state->misses.load();
+		}
+		size_t size() const
+		{
+			return m_state->allocated.load();
+		}
+
+	private:
+		struct pool_state
+		{
+			pool_state() : cache(boost::make_shared<control_block_cache>()), allocated(0), misses(0) {}
+			~pool_state()
+			{
+				for (size_t i = 0; i < free.size(); i++)
+				{
+					delete free[i];
+				}
+			}
+			M *take()
+			{
+				{
+					std::lock_guard<std::mutex> lock(mutex);
+					if (!free.empty())
+					{
+						M *msg = free.back();
+						free.pop_back();
+						return msg;
+					}
+				}
+				misses++;
+				allocated++;
+				return new M();
+			}
+			void give_back(M *msg)
+			{
+				std::lock_guard<std::mutex> lock(mutex);
+				free.push_back(msg);
+			}
+			std::mutex mutex;
+			std::vector<M *> free;
+			boost::shared_ptr<control_block_cache> cache;
+			std::atomic<size_t> allocated;
+			std::atomic<uint64_t> misses;
+		};
+		// shared_ptr deleter, keeps the pool state alive until every message handed out has come back
+		class message_return
+		{
+			public:
+				message_return(boost::shared_ptr<pool_state> p_state) : m_state(p_state) {}
+				void operator()(M *msg)
+				{
+					m_state->give_back(msg);
+				}
+
+			private:
+				boost::shared_ptr<pool_state> m_state;
+		};
+		boost::shared_ptr<pool_state> m_state;
+};
+#endif // MESSAGE_POOL_
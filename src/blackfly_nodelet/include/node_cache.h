@@ -0,0 +1,367 @@
+#ifndef NODE_CACHE_
+#define NODE_CACHE_
+#include <string>
+#include <vector>
+#include <map>
+#include <mutex>
+#include <atomic>
+#include <algorithm>
+#include <cstdint>
+
+#include <ros/ros.h>
+
+#include "Spinnaker.h"
+#include "SpinGenApi/SpinnakerGenApi.h"
+
+using namespace Spinnaker;
+using namespace Spinnaker::GenApi;
+using namespace Spinnaker::GenICam;
+
+// Every GenICam node the driver configures, resolved once per camera.
+// The order of the enum is the order writes are sent in: modes before the values they unlock, limits before the values they bound.
+enum camera_node
+{
+	// need acquisition stopped
+	NODE_ACQUISITION_MODE,
+	NODE_PIXEL_FORMAT,
+	NODE_BINNING_HORIZONTAL_MODE,
+	NODE_BINNING_VERTICAL_MODE,
+	NODE_BINNING_HORIZONTAL,
+	NODE_BINNING_VERTICAL,
+	// readout window at the binning above, the offsets follow the size they have to fit into
+	NODE_WIDTH,
+	NODE_HEIGHT,
+	NODE_OFFSET_X,
+	NODE_OFFSET_Y,
+	// trigger configuration, only writable while the trigger is off
+	NODE_TRIGGER_SOURCE,
+	NODE_TRIGGER_ACTIVATION,
+	// modes
+	NODE_EXPOSURE_MODE,
+	NODE_EXPOSURE_AUTO,
+	NODE_GAIN_AUTO,
+	NODE_GAMMA_ENABLE,
+	NODE_ACQUISITION_FRAME_RATE_ENABLE,
+	NODE_AUTO_EXPOSURE_LIGHTING_MODE,
+	NODE_AUTO_EXPOSURE_CONTROL_PRIORITY,
+	// limits of the auto modes
+	NODE_AUTO_EXPOSURE_TIME_UPPER_LIMIT,
+	NODE_AUTO_EXPOSURE_TIME_LOWER_LIMIT,
+	NODE_AUTO_EXPOSURE_GAIN_UPPER_LIMIT,
+	NODE_AUTO_EXPOSURE_GAIN_LOWER_LIMIT,
+	// values
+	NODE_ACQUISITION_FRAME_RATE,
+	NODE_EXPOSURE_TIME,
+	NODE_GAIN,
+	NODE_GAMMA,
+	// the trigger is switched on after its configuration
+	NODE_TRIGGER_MODE,
+	NODE_COUNT
+};
+
+static const char *const camera_node_names[NODE_COUNT] = {
+	"AcquisitionMode", "PixelFormat", "BinningHorizontalMode", "BinningVerticalMode", "BinningHorizontal", "BinningVertical",
+	"Width", "Height", "OffsetX", "OffsetY",
+	"TriggerSource", "TriggerActivation",
+	"ExposureMode", "ExposureAuto", "GainAuto", "GammaEnable", "AcquisitionFrameRateEnable", "AutoExposureLightingMode", "AutoExposureControlPriority",
+	"AutoExposureExposureTimeUpperLimit", "AutoExposureExposureTimeLowerLimit", "AutoExposureGainUpperLimit", "AutoExposureGainLowerLimit",
+	"AcquisitionFrameRate", "ExposureTime", "Gain", "Gamma",
+	"TriggerMode"};
+
+// Typed handles of the camera_node list with a shadow copy of the last value written to each.
+// Writes are staged and sent by commit(), which skips values equal to the shadow and orders the rest by their dependencies.
+// Staging and committing may come from different threads, a batch is committed as a whole.
+class CameraNodeCache
+{
+	public:
+		CameraNodeCache(CameraPtr p_cam_ptr) : m_writes(0), m_saved(0)
+		{
+			m_cam_ptr = p_cam_ptr;
+			INodeMap &node_map = m_cam_ptr->GetNodeMap();
+			for (int i = 0; i < NODE_COUNT; i++)
+			{
+				m_nodes[i].node = node_map.GetNode(camera_node_names[i]);
+				m_nodes[i].known = false;
+				m_nodes[i].staged = false;
+				if (!IsAvailable(m_nodes[i].node))
+				{
+					ROS_DEBUG("Blackfly Nodelet: Node %s not available", camera_node_names[i]);
+				}
+			}
+		}
+		~CameraNodeCache()
+		{
+			m_cam_ptr = nullptr;
+		}
+		// enumeration entry by name, the entry value is resolved once as well
+		void stage_enum(camera_node node, const char *entry)
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			node_state &state = m_nodes[node];
+			std::map<std::string, int64_t>::iterator it = state.entries.find(entry);
+			int64_t value;
+			if (it != state.entries.end())
+			{
+				value = it->second;
+			}
+			else
+			{
+				CEnumerationPtr ptrEnum = state.node;
+				if (!IsAvailable(ptrEnum))
+				{
+					ROS_WARN("Blackfly Nodelet: Node %s not available", camera_node_names[node]);
+					return;
+				}
+				CEnumEntryPtr ptrEntry = ptrEnum->GetEntryByName(entry);
+				if (!IsAvailable(ptrEntry) || !IsReadable(ptrEntry))
+				{
+					ROS_WARN("Blackfly Nodelet: Node %s has no entry %s", camera_node_names[node], entry);
+					return;
+				}
+				value = ptrEntry->GetValue();
+				state.entries[entry] = value;
+			}
+			stage(node, double(value));
+		}
+		void stage_float(camera_node node, double value)
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			stage(node, value);
+		}
+		void stage_int(camera_node node, int64_t value)
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			stage(node, double(value));
+		}
+		void stage_bool(camera_node node, bool value)
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			stage(node, value ? 1.0 : 0.0);
+		}
+		// Sends the staged values that differ from the shadow. Throws the spinnaker exception of a failed write,
+		// the shadow then only holds the writes that went through. Returns the number of writes sent.
+		size_t commit()
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			std::vector<int> order;
+			for (int i = 0; i < NODE_COUNT; i++)
+			{
+				if (m_nodes[i].staged)
+				{
+					m_nodes[i].staged = false;
+					if (m_nodes[i].known && m_nodes[i].shadow == m_nodes[i].value)
+					{
+						m_saved++;
+						continue;
+					}
+					order.push_back(i);
+				}
+			}
+			order_bounds(order, NODE_AUTO_EXPOSURE_TIME_LOWER_LIMIT, NODE_AUTO_EXPOSURE_TIME_UPPER_LIMIT);
+			order_bounds(order, NODE_AUTO_EXPOSURE_GAIN_LOWER_LIMIT, NODE_AUTO_EXPOSURE_GAIN_UPPER_LIMIT);
+			// a longer exposure needs the lower frame rate first, a higher frame rate needs the shorter exposure first
+			if (staged_in(order, NODE_ACQUISITION_FRAME_RATE) && staged_in(order, NODE_EXPOSURE_TIME) &&
+				m_nodes[NODE_ACQUISITION_FRAME_RATE].known && m_nodes[NODE_ACQUISITION_FRAME_RATE].value > m_nodes[NODE_ACQUISITION_FRAME_RATE].shadow)
+			{
+				move_before(order, NODE_EXPOSURE_TIME, NODE_ACQUISITION_FRAME_RATE);
+			}
+			// a window growing towards the sensor edge needs its offset moved back first
+			if (staged_in(order, NODE_OFFSET_X) && staged_in(order, NODE_WIDTH) && m_nodes[NODE_WIDTH].value > current(NODE_WIDTH))
+			{
+				move_before(order, NODE_OFFSET_X, NODE_WIDTH);
+			}
+			if (staged_in(order, NODE_OFFSET_Y) && staged_in(order, NODE_HEIGHT) && m_nodes[NODE_HEIGHT].value > current(NODE_HEIGHT))
+			{
+				move_before(order, NODE_OFFSET_Y, NODE_HEIGHT);
+			}
+			// the trigger source and activation can only change while the trigger is off
+			if ((staged_in(order, NODE_TRIGGER_SOURCE) || staged_in(order, NODE_TRIGGER_ACTIVATION)) && !trigger_off())
+			{
+				node_state &trigger = m_nodes[NODE_TRIGGER_MODE];
+				bool restore = !staged_in(order, NODE_TRIGGER_MODE) && trigger.known;
+				double previous = trigger.shadow;
+				write_entry(NODE_TRIGGER_MODE, "Off");
+				if (restore)
+				{
+					// switch the trigger back on after its configuration
+					trigger.value = previous;
+					order.push_back(NODE_TRIGGER_MODE);
+				}
+			}
+			for (size_t i = 0; i < order.size(); i++)
+			{
+				write(camera_node(order[i]));
+			}
+			return order.size();
+		}
+		// the camera state changed behind the cache's back, e.g. a user set was loaded
+		void invalidate()
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			for (int i = 0; i < NODE_COUNT; i++)
+			{
+				m_nodes[i].known = false;
+			}
+		}
+		// the camera moved one node by itself, e.g. the window after a binning change
+		void forget(camera_node node)
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			m_nodes[node].known = false;
+		}
+		// device writes sent
+		uint64_t writes() const
+		{
+			return m_writes.load();
+		}
+		// device writes skipped because the value was already set
+		uint64_t saved() const
+		{
+			return m_saved.load();
+		}
+
+	private:
+		struct node_state
+		{
+			INode *node;
+			// enumerations keep the integer value of their entry, booleans 0 and 1
+			double shadow;
+			bool known;
+			double value;
+			bool staged;
+			std::map<std::string, int64_t> entries;
+		};
+		void stage(camera_node node, double value)
+		{
+			m_nodes[node].value = value;
+			m_nodes[node].staged = true;
+		}
+		static bool staged_in(const std::vector<int> &order, camera_node node)
+		{
+			return std::find(order.begin(), order.end(), int(node)) != order.end();
+		}
+		static void move_before(std::vector<int> &order, camera_node first, camera_node second)
+		{
+			std::vector<int>::iterator it_first = std::find(order.begin(), order.end(), int(first));
+			std::vector<int>::iterator it_second = std::find(order.begin(), order.end(), int(second));
+			if (it_first != order.end() && it_second != order.end() && it_first > it_second)
+			{
+				order.erase(it_first);
+				order.insert(std::find(order.begin(), order.end(), int(second)), int(first));
+			}
+		}
+		// lower before upper when the range moves down, upper before lower otherwise, so the limits never cross in between
+		void order_bounds(std::vector<int> &order, camera_node lower, camera_node upper)
+		{
+			if (m_nodes[lower].known && m_nodes[lower].value < m_nodes[lower].shadow)
+			{
+				move_before(order, lower, upper);
+			}
+			else
+			{
+				move_before(order, upper, lower);
+			}
+		}
+		// value on the camera, read back from an integer node whose shadow is unknown
+		double current(camera_node node)
+		{
+			node_state &state = m_nodes[node];
+			if (state.known)
+			{
+				return state.shadow;
+			}
+			CIntegerPtr ptrInteger = state.node;
+			return IsAvailable(ptrInteger) && IsReadable(ptrInteger) ? double(ptrInteger->GetValue()) : 0.0;
+		}
+		bool trigger_off()
+		{
+			node_state &state = m_nodes[NODE_TRIGGER_MODE];
+			std::map<std::string, int64_t>::iterator it = state.entries.find("Off");
+			return state.known && it != state.entries.end() && state.shadow == double(it->second);
+		}
+		// writes an entry outside of the staged batch, the staged value of the node is kept
+		void write_entry(camera_node node, const char *entry)
+		{
+			CEnumerationPtr ptrEnum = m_nodes[node].node;
+			if (!IsAvailable(ptrEnum))
+			{
+				return;
+			}
+			CEnumEntryPtr ptrEntry = ptrEnum->GetEntryByName(entry);
+			if (!IsAvailable(ptrEntry))
+			{
+				return;
+			}
+			m_nodes[node].entries[entry] = ptrEntry->GetValue();
+			double value = m_nodes[node].value;
+			m_nodes[node].value = double(ptrEntry->GetValue());
+			write(node);
+			m_nodes[node].value = value;
+		}
+		void write(camera_node node)
+		{
+			node_state &state = m_nodes[node];
+			// the shadow is dropped first, a write that throws leaves the node unknown
+			state.known = false;
+			if (!IsAvailable(state.node) || !IsWritable(state.node))
+			{
+				ROS_WARN("Blackfly Nodelet: Node %s not writable", camera_node_names[node]);
+				return;
+			}
+			m_writes++;
+			switch (state.node->GetPrincipalInterfaceType())
+			{
+			case intfIEnumeration:
+			{
+				CEnumerationPtr ptrEnum = state.node;
+				ptrEnum->SetIntValue(int64_t(state.value));
+				break;
+			}
+			case intfIFloat:
+			{
+				CFloatPtr ptrFloat = state.node;
+				ptrFloat->SetValue(state.value);
+				break;
+			}
+			case intfIInteger:
+			{
+				CIntegerPtr ptrInteger = state.node;
+				ptrInteger->SetValue(int64_t(state.value));
+				break;
+			}
+			case intfIBoolean:
+			{
+				CBooleanPtr ptrBoolean = state.node;
+				ptrBoolean->SetValue(state.value != 0.0);
+				break;
+			}
+			default:
+				ROS_WARN("Blackfly Nodelet: Node %s has an unsupported type", camera_node_names[node]);
+				return;
+			}
+			state.shadow = state.value;
+			state.known = true;
+			// auto modes move their values on the camera, and "Once" falls back to "Off" by itself
+			if (node == NODE_EXPOSURE_AUTO)
+			{
+				m_nodes[NODE_EXPOSURE_TIME].known = false;
+				state.known = !is_entry(state, "Once");
+			}
+			else if (node == NODE_GAIN_AUTO)
+			{
+				m_nodes[NODE_GAIN].known = false;
+				state.known = !is_entry(state, "Once");
+			}
+		}
+		static bool is_entry(const node_state &state, const char *entry)
+		{
+			std::map<std::string, int64_t>::const_iterator it = state.entries.find(entry);
+			return it != state.entries.end() && double(it->second) == state.value;
+		}
+		CameraPtr m_cam_ptr;
+		std::mutex m_mutex;
+		node_state m_nodes[NODE_COUNT];
+		std::atomic<uint64_t> m_writes;
+		std::atomic<uint64_t> m_saved;
+};
+#endif // NODE_CACHE_
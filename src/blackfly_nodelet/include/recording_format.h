@@ -0,0 +1,81 @@
+#ifndef RECORDING_FORMAT_
+#define RECORDING_FORMAT_
+#include <cstdint>
+#include <cstdio>
+#include <string>
+
+// On disk layout of the raw recordings, written by FrameRecorder and read by the replay nodelet.
+// Every camera records into <record_dir>/<cam_name>/ :
+//   segment_NNNNN.raw  preallocated segment files, every frame is one record starting on a RECORD_ALIGNMENT boundary,
+//                      a recorded_frame header followed by the raw payload exactly as the camera sent it
+//   index.bin          a recording_index_header followed by one recorded_frame per frame, in recording order,
+//                      appended once the frame's record is on disk
+// The header in front of every record repeats its index entry, so a lost index can be rebuilt from the segments.
+
+#define RECORDING_MAGIC 0x52464c42u // "BLFR"
+#define RECORDING_INDEX_MAGIC 0x58464c42u // "BLFX"
+#define RECORDING_VERSION 1
+// O_DIRECT needs offsets, lengths and buffers aligned to the logical block size, a page covers every NVMe drive
+#define RECORD_ALIGNMENT 4096
+
+struct recorded_frame
+{
+	uint32_t magic;
+	uint32_t version;
+	// frames recorded by this camera before this one
+	uint64_t sequence;
+	// published stamp and host arrival time [ns]
+	int64_t stamp_ns;
+	int64_t arrival_ns;
+	// chunk data, metadata_valid is 0 when the camera sent none
+	uint64_t frame_id;
+	int64_t device_timestamp;
+	double exposure_time;
+	double gain;
+	uint32_t metadata_valid;
+	// segment file and byte offset of the record, the payload starts sizeof(recorded_frame) further
+	uint32_t segment;
+	uint64_t offset;
+	uint32_t payload_size;
+	uint32_t width;
+	uint32_t height;
+	uint32_t step;
+	// sensor_msgs encoding, zero terminated
+	char encoding[24];
+	uint8_t reserved[8];
+};
+static_assert(sizeof(recorded_frame) == 128, "recorded_frame is part of the file format");
+
+struct recording_index_header
+{
+	uint32_t magic;
+	uint32_t version;
+	// recorded_frame entries follow the header
+	uint32_t entry_size;
+	uint32_t alignment;
+	uint64_t segment_size;
+	// camera name, which is also the frame_id of the recorded images
+	char cam_name[64];
+	uint8_t reserved[40];
+};
+static_assert(sizeof(recording_index_header) == 128, "recording_index_header is part of the file format");
+
+inline std::string recording_segment_path(const std::string &dir, uint32_t segment)
+{
+	char name[32];
+	snprintf(name, sizeof(name), "segment_%05u.raw", segment);
+	return dir + "/" + name;
+}
+
+inline std::string recording_index_path(const std::string &dir)
+{
+	return dir + "/index.bin";
+}
+
+// bytes a record of p_payload_size takes in its segment
+inline uint64_t recorded_frame_size(uint64_t p_payload_size)
+{
+	uint64_t size = sizeof(recorded_frame) + p_payload_size;
+	return (size + RECORD_ALIGNMENT - 1) / RECORD_ALIGNMENT * RECORD_ALIGNMENT;
+}
+#endif // RECORDING_FORMAT_
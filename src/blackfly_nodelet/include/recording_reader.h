@@ -0,0 +1,163 @@
+#ifndef RECORDING_READER_
+#define RECORDING_READER_
+#include <string>
+#include <vector>
+#include <cstring>
+#include <cerrno>
+#include <cstdio>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <boost/shared_ptr.hpp>
+#include <boost/make_shared.hpp>
+
+#include <ros/ros.h>
+
+#include "recording_format.h"
+
+// Read side of one camera's recording, see recording_format.h. The index is loaded into memory,
+// the segments are mapped read only the first time a frame in them is asked for and stay mapped.
+// Payload pointers point into the mapping, the shared pointer handed out with them keeps it mapped.
+
+class MappedSegment
+{
+	public:
+		MappedSegment(const std::string &p_path) : m_data(nullptr), m_size(0)
+		{
+			int fd = open(p_path.c_str(), O_RDONLY);
+			if (fd < 0)
+			{
+				ROS_ERROR("Blackfly Replay: Failed to open %s: %s", p_path.c_str(), std::strerror(errno));
+				return;
+			}
+			struct stat info;
+			if (fstat(fd, &info) == 0 && info.st_size > 0)
+			{
+				void *data = mmap(nullptr, size_t(info.st_size), PROT_READ, MAP_SHARED, fd, 0);
+				if (data != MAP_FAILED)
+				{
+					m_data = static_cast<const uint8_t *>(data);
+					m_size = size_t(info.st_size);
+					// replay walks the segment front to back
+					madvise(data, m_size, MADV_SEQUENTIAL);
+				}
+				else
+				{
+					ROS_ERROR("Blackfly Replay: Failed to map %s: %s", p_path.c_str(), std::strerror(errno));
+				}
+			}
+			close(fd);
+		}
+		~MappedSegment()
+		{
+			if (m_data != nullptr)
+			{
+				munmap(const_cast<uint8_t *>(m_data), m_size);
+			}
+		}
+		const uint8_t *data() const
+		{
+			return m_data;
+		}
+		size_t size() const
+		{
+			return m_size;
+		}
+
+	private:
+		MappedSegment(const MappedSegment &);
+		MappedSegment &operator=(const MappedSegment &);
+		const uint8_t *m_data;
+		size_t m_size;
+};
+
+class RecordingReader
+{
+	public:
+		RecordingReader(const std::string &p_dir) : m_dir(p_dir), m_valid(false)
+		{
+			FILE *index = fopen(recording_index_path(m_dir).c_str(), "rb");
+			if (index == nullptr)
+			{
+				ROS_ERROR("Blackfly Replay: No recording index in %s", m_dir.c_str());
+				return;
+			}
+			recording_index_header header;
+			if (fread(&header, sizeof(header), 1, index) != 1 || header.magic != RECORDING_INDEX_MAGIC || header.version != RECORDING_VERSION ||
+				header.entry_size != sizeof(recorded_frame))
+			{
+				ROS_ERROR("Blackfly Replay: %s is not a recording index of version %d", recording_index_path(m_dir).c_str(), RECORDING_VERSION);
+				fclose(index);
+				return;
+			}
+			m_cam_name = std::string(header.cam_name, strnlen(header.cam_name, sizeof(header.cam_name)));
+			recorded_frame entry;
+			// an index cut short by a crash ends with a partial entry, which is left out
+			while (fread(&entry, sizeof(entry), 1, index) == 1)
+			{
+				if (entry.magic == RECORDING_MAGIC)
+				{
+					m_frames.push_back(entry);
+				}
+			}
+			fclose(index);
+			m_valid = true;
+		}
+		bool valid() const
+		{
+			return m_valid;
+		}
+		const std::string &cam_name() const
+		{
+			return m_cam_name;
+		}
+		size_t size() const
+		{
+			return m_frames.size();
+		}
+		const recorded_frame &frame(size_t i) const
+		{
+			return m_frames[i];
+		}
+		// Payload of frame i inside the segment mapping, nullptr if the segment is missing or too short.
+		// p_mapping keeps the segment mapped for as long as the payload is used.
+		const uint8_t *payload(size_t i, boost::shared_ptr<MappedSegment> &p_mapping)
+		{
+			const recorded_frame &entry = m_frames[i];
+			if (entry.segment >= m_segments.size())
+			{
+				m_segments.resize(entry.segment + 1);
+			}
+			if (!m_segments[entry.segment])
+			{
+				m_segments[entry.segment] = boost::make_shared<MappedSegment>(recording_segment_path(m_dir, entry.segment));
+			}
+			p_mapping = m_segments[entry.segment];
+			uint64_t end = entry.offset + sizeof(recorded_frame) + entry.payload_size;
+			if (p_mapping->data() == nullptr || end > p_mapping->size())
+			{
+				return nullptr;
+			}
+			return p_mapping->data() + entry.offset + sizeof(recorded_frame);
+		}
+		// unmap segments before the one frame i is in, replay does not come back to them until it loops
+		void release_before(size_t i)
+		{
+			uint32_t segment = m_frames[i].segment;
+			for (uint32_t s = 0; s < segment && s < m_segments.size(); s++)
+			{
+				m_segments[s].reset();
+			}
+		}
+
+	private:
+		std::string m_dir;
+		std::string m_cam_name;
+		bool m_valid;
+		std::vector<recorded_frame> m_frames;
+		std::vector<boost::shared_ptr<MappedSegment> > m_segments;
+};
+#endif // RECORDING_READER_
@@ -0,0 +1,153 @@
+#ifndef REPLAYNODELET_
+#define REPLAYNODELET_
+
+#include <vector>
+#include <string>
+#include <thread>
+#include <atomic>
+
+#include <ros/ros.h>
+
+// Nodelet stuff
+#include <nodelet/nodelet.h>
+
+#include "camera.h"
+#include "camera_frame.h"
+#include "message_pool.h"
+#include "recording_reader.h"
+
+namespace blackfly
+{
+
+// original follows the recorded stamps (scaled by speed), fast publishes as fast as possible, fixed steps at rate
+enum replay_mode {REPLAY_ORIGINAL, REPLAY_FAST, REPLAY_FIXED};
+
+// A recorded frame handed to the image event handler. The payload is read from the segment mapping, which stays mapped
+// until the frame is released, also while it is out on loan.
+class RecordedFrame : public CameraFrame
+{
+	public:
+		RecordedFrame() : m_payload(nullptr), m_format(PixelFormat_Mono8), m_width(0), m_height(0), m_stride(0) {}
+		// reuses a pooled frame for the next record, the previous one has been released
+		void assign(const recorded_frame &p_record, const uint8_t *p_payload, boost::shared_ptr<MappedSegment> p_mapping, PixelFormatEnums p_format, ros::Time p_stamp)
+		{
+			m_mapping = p_mapping;
+			m_payload = p_payload;
+			m_format = p_format;
+			m_width = int(p_record.width);
+			m_height = int(p_record.height);
+			m_stride = int(p_record.step);
+			m_stamp = p_stamp;
+			m_metadata = frame_metadata();
+			m_metadata.valid = p_record.metadata_valid != 0;
+			m_metadata.frame_id = p_record.frame_id;
+			m_metadata.device_timestamp = p_record.device_timestamp;
+			m_metadata.exposure_time = p_record.exposure_time;
+			m_metadata.gain = p_record.gain;
+		}
+		bool incomplete() const
+		{
+			return false;
+		}
+		PixelFormatEnums pixel_format() const
+		{
+			return m_format;
+		}
+		int width() const
+		{
+			return m_width;
+		}
+		int height() const
+		{
+			return m_height;
+		}
+		int stride() const
+		{
+			return m_stride;
+		}
+		const void *data() const
+		{
+			return m_payload;
+		}
+		frame_metadata metadata() const
+		{
+			return m_metadata;
+		}
+		void release()
+		{
+			m_mapping.reset();
+			m_payload = nullptr;
+		}
+		bool host_stamp(ros::Time &p_stamp) const
+		{
+			p_stamp = m_stamp;
+			return true;
+		}
+
+	private:
+		boost::shared_ptr<MappedSegment> m_mapping;
+		const uint8_t *m_payload;
+		PixelFormatEnums m_format;
+		int m_width;
+		int m_height;
+		int m_stride;
+		ros::Time m_stamp;
+		frame_metadata m_metadata;
+};
+
+// One recorded camera and the handler it replays through, on the same topics blackfly_nodelet publishes the camera on.
+// Pointers since the cameras live in a vector, they are deleted by the nodelet.
+struct replay_camera
+{
+	replay_camera() : reader_ptr(nullptr), outputs_ptr(nullptr), device_event_handler_ptr(nullptr), image_event_handler_ptr(nullptr), frame_pool_ptr(nullptr), skipped(0) {}
+	std::string cam_name;
+	RecordingReader *reader_ptr;
+	CameraOutputs *outputs_ptr;
+	// never sees an event, the handler only needs one for its statistics
+	DeviceEventHandler *device_event_handler_ptr;
+	ImageEventHandler *image_event_handler_ptr;
+	MessagePool<RecordedFrame> *frame_pool_ptr;
+	// frames whose payload was missing from their segment or whose encoding the handler does not publish
+	uint64_t skipped;
+};
+
+// position of one frame in the merged timeline of all cameras
+struct replay_entry
+{
+	int64_t stamp_ns;
+	uint32_t camera;
+	uint32_t frame;
+};
+
+class replay_nodelet : public nodelet::Nodelet
+{
+public:
+	replay_nodelet() : m_stop(false), m_mode(REPLAY_ORIGINAL), m_speed(1.0), m_rate(10.0), m_loop(false), m_restamp(false), m_jpeg_quality(0),
+						m_mono_output(false), m_pyramid(false), m_demosaic(DEMOSAIC_BILINEAR), Nodelet() {}
+	~replay_nodelet();
+	virtual void onInit();
+
+private:
+	bool add_camera(const std::string &dir, const std::string &cam_info_path);
+	void playback_loop();
+	// sleeps until p_target unless the nodelet is stopping, false when it is
+	bool wait_until(ros::WallTime p_target);
+	void publish_frame(replay_camera &camera, size_t frame);
+	std::vector<replay_camera> m_cameras;
+	std::vector<replay_entry> m_timeline;
+	std::thread m_playback_thread;
+	std::atomic<bool> m_stop;
+	replay_mode m_mode;
+	double m_speed;
+	double m_rate;
+	bool m_loop;
+	// publish with the replay time instead of the recorded stamps
+	bool m_restamp;
+	// host side outputs of every replayed camera, as the live nodelet computes them
+	int m_jpeg_quality;
+	bool m_mono_output;
+	bool m_pyramid;
+	demosaic_method m_demosaic;
+};
+} // namespace blackfly
+#endif // REPLAYNODELET_
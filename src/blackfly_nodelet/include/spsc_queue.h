@@ -0,0 +1,72 @@
+#ifndef SPSC_QUEUE_
+#define SPSC_QUEUE_
+#include <atomic>
+#include <vector>
+#include <cstddef>
+
+// Bounded lock-free queue for exactly one producer and one consumer thread.
+// The consumer may move between threads as long as two of them never pop at the same time.
+template <class T>
+class SpscQueue
+{
+	public:
+		// capacity is rounded up to a power of two
+		SpscQueue(size_t p_capacity) : m_head(0), m_tail(0)
+		{
+			size_t capacity = 1;
+			while (capacity < p_capacity)
+			{
+				capacity <<= 1;
+			}
+			m_slots.resize(capacity);
+			m_mask = capacity - 1;
+		}
+		// producer only, false when the queue is full
+		bool push(const T &item)
+		{
+			size_t head = m_head.load(std::memory_order_relaxed);
+			if (head - m_tail.load(std::memory_order_acquire) > m_mask)
+			{
+				return false;
+			}
+			m_slots[head & m_mask] = item;
+			m_head.store(head + 1, std::memory_order_release);
+			return true;
+		}
+		// consumer only, false when the queue is empty. The slot is reset so the queue holds no references to popped items.
+		bool pop(T &item)
+		{
+			size_t tail = m_tail.load(std::memory_order_relaxed);
+			if (tail == m_head.load(std::memory_order_acquire))
+			{
+				return false;
+			}
+			item = m_slots[tail & m_mask];
+			m_slots[tail & m_mask] = T();
+			m_tail.store(tail + 1, std::memory_order_release);
+			return true;
+		}
+		size_t size() const
+		{
+			return m_head.load(std::memory_order_acquire) - m_tail.load(std::memory_order_acquire);
+		}
+		bool empty() const
+		{
+			return size() == 0;
+		}
+		size_t capacity() const
+		{
+			return m_mask + 1;
+		}
+
+	private:
+		std::vector<T> m_slots;
+		size_t m_mask;
+		// padding keeps the producer and consumer indices on separate cache lines, alignas would need C++17 aligned new
+		char m_pad0[64];
+		std::atomic<size_t> m_head;
+		char m_pad1[64 - sizeof(std::atomic<size_t>)];
+		std::atomic<size_t> m_tail;
+		char m_pad2[64 - sizeof(std::atomic<size_t>)];
+};
+#endif // SPSC_QUEUE_
@@ -0,0 +1,21 @@
+#ifndef BLACKFLY_STATS_
+#define BLACKFLY_STATS_
+#include <string>
+#include <sstream>
+
+#include <diagnostic_msgs/DiagnosticArray.h>
+#include <diagnostic_msgs/DiagnosticStatus.h>
+#include <diagnostic_msgs/KeyValue.h>
+
+// Every camera reports its pipeline counters as one DiagnosticStatus on the nodelet's stats topic
+template <typename T>
+inline void add_stat(diagnostic_msgs::DiagnosticStatus &status, const std::string &key, T value)
+{
+	std::ostringstream ss;
+	ss << value;
+	diagnostic_msgs::KeyValue key_value;
+	key_value.key = key;
+	key_value.value = ss.str();
+	status.values.push_back(key_value);
+}
+#endif // BLACKFLY_STATS_
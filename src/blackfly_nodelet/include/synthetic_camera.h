@@ -0,0 +1,500 @@
+#ifndef SYNTHETIC_CAMERA_
+#define SYNTHETIC_CAMERA_
+#include <vector>
+#include <string>
+#include <mutex>
+#include <atomic>
+#include <thread>
+#include <chrono>
+#include <random>
+#include <functional>
+#include <cmath>
+#include <cstring>
+#include <algorithm>
+#include <condition_variable>
+
+#include <ros/ros.h>
+#include <boost/shared_ptr.hpp>
+#include <boost/make_shared.hpp>
+
+#include "camera.h"
+#include "camera_frame.h"
+
+// A camera without hardware for tests, benchmarks and soak runs. A generator thread produces frames at the configured
+// resolution, pixel format and rate and pushes them through the same ImageEventHandler, and so the same topics, as a
+// blackfly_camera. Exposure end events go to a DeviceEventHandler ahead of every frame, jitter, incomplete frames and
+// drops are drawn at the configured rates.
+
+// preallocated frame buffers shared between the generator and the frames out on loan
+class SyntheticBufferPool
+{
+	public:
+		SyntheticBufferPool(size_t p_count, size_t p_size) : m_size(p_size), m_memory(p_count * p_size)
+		{
+			for (size_t i = 0; i < p_count; i++)
+			{
+				m_free.push_back(i);
+			}
+		}
+		// false when every buffer is in use
+		bool take(size_t &index)
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			if (m_free.empty())
+			{
+				return false;
+			}
+			index = m_free.back();
+			m_free.pop_back();
+			return true;
+		}
+		void give_back(size_t index)
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			m_free.push_back(index);
+		}
+		uint8_t *buffer(size_t index)
+		{
+			return &m_memory[index * m_size];
+		}
+		size_t buffer_size() const
+		{
+			return m_size;
+		}
+
+	private:
+		size_t m_size;
+		std::vector<uint8_t> m_memory;
+		std::mutex m_mutex;
+		std::vector<size_t> m_free;
+};
+
+// a generated frame, the buffer goes back to the pool on release, the pool outlives the camera while frames are out
+class SyntheticFrame : public CameraFrame
+{
+	public:
+		// p_offset is the byte offset of the first pixel of the window in the buffer
+		SyntheticFrame(boost::shared_ptr<SyntheticBufferPool> p_pool, size_t p_index, size_t p_offset, PixelFormatEnums p_format, int p_width, int p_height,
+						int p_stride, bool p_incomplete, const frame_metadata &p_metadata)
+			: m_pool(p_pool), m_index(p_index), m_offset(p_offset), m_format(p_format), m_width(p_width), m_height(p_height), m_stride(p_stride),
+			m_incomplete(p_incomplete), m_metadata(p_metadata), m_released(false) {}
+		~SyntheticFrame()
+		{
+			release();
+		}
+		bool incomplete() const
+		{
+			return m_incomplete;
+		}
+		PixelFormatEnums pixel_format() const
+		{
+			return m_format;
+		}
+		int width() const
+		{
+			return m_width;
+		}
+		int height() const
+		{
+			return m_height;
+		}
+		int stride() const
+		{
+			return m_stride;
+		}
+		const void *data() const
+		{
+			return m_pool->buffer(m_index) + m_offset;
+		}
+		frame_metadata metadata() const
+		{
+			return m_metadata;
+		}
+		void release()
+		{
+			if (!m_released.exchange(true))
+			{
+				m_pool->give_back(m_index);
+			}
+		}
+
+	private:
+		boost::shared_ptr<SyntheticBufferPool> m_pool;
+		size_t m_index;
+		size_t m_offset;
+		PixelFormatEnums m_format;
+		int m_width;
+		int m_height;
+		int m_stride;
+		bool m_incomplete;
+		frame_metadata m_metadata;
+		std::atomic<bool> m_released;
+};
+
+class synthetic_camera : public camera_interface
+{
+public:
+	synthetic_camera(camera_settings settings, WorkerPool *worker_pool_ptr = nullptr, FrameSynchronizer *frame_sync_ptr = nullptr)
+	{
+		m_cam_settings = settings;
+		m_image_event_handler_ptr = nullptr;
+		m_device_event_handler_ptr = nullptr;
+		m_recorder_ptr = nullptr;
+		m_stop = false;
+		m_paused = false;
+		m_frame_id = 0;
+		m_frames_generated = 0;
+		m_frames_dropped = 0;
+		m_frames_incomplete = 0;
+		m_underruns = 0;
+		m_fps = settings.fps > 0.0f ? settings.fps : 1.0;
+		m_exposure_time = settings.fixed_exp_time;
+		m_gain = settings.gain;
+
+		m_outputs.advertise(m_cam_settings);
+
+		ros::WallTime phase_start = ros::WallTime::now();
+		if (!select_format())
+		{
+			m_startup_timing.error = "unsupported pixel format " + m_cam_settings.pixel_format;
+			ROS_ERROR("Blackfly Nodelet: Synthetic camera %s does not support pixel format %s", m_cam_settings.cam_name.c_str(), m_cam_settings.pixel_format.c_str());
+			return;
+		}
+		// automatic sizing as on a spinnaker camera, without the memory cap since the buffers are ordinary heap memory
+		m_buffer_count = m_cam_settings.buffer_count > 0 ? size_t(m_cam_settings.buffer_count) :
+							std::max(size_t(std::ceil(m_fps.load() * m_cam_settings.buffer_latency_budget)), size_t(MIN_AUTO_BUFFER_COUNT));
+		m_pool = boost::make_shared<SyntheticBufferPool>(m_buffer_count, size_t(m_stride) * m_height);
+		fill_pattern();
+		if (!m_cam_settings.record_dir.empty())
+		{
+			m_recorder_ptr = new FrameRecorder(m_cam_settings.cam_name, m_cam_settings.record_dir, m_pool->buffer_size(),
+												m_cam_settings.record_slots > 0 ? size_t(m_cam_settings.record_slots) : 1, m_cam_settings.record_segment_size);
+			if (!m_recorder_ptr->start())
+			{
+				ROS_ERROR("Blackfly Nodelet: Recording of camera %s could not be started", m_cam_settings.cam_name.c_str());
+				delete m_recorder_ptr;
+				m_recorder_ptr = nullptr;
+			}
+		}
+		m_startup_timing.configure = lap(phase_start);
+
+		// the same handlers as a spinnaker camera, without the camera behind them
+		m_device_event_handler_ptr = new DeviceEventHandler(CameraPtr(), m_cam_settings.event_match_tolerance);
+		unsigned int max_loans = m_buffer_count > 2 ? m_buffer_count - 2 : 1;
+		m_image_event_handler_ptr = m_outputs.create_handler(m_cam_settings, CameraPtr(), m_device_event_handler_ptr, max_loans,
+																worker_pool_ptr, m_recorder_ptr, frame_sync_ptr);
+		window_changed();
+		if (m_cam_settings.device_clock)
+		{
+			ROS_WARN("Blackfly Nodelet: Synthetic camera %s has no device clock, stamping from exposure end events", m_cam_settings.cam_name.c_str());
+		}
+		m_startup_timing.register_events = lap(phase_start);
+
+		m_generator_thread = std::thread(&synthetic_camera::generator_loop, this);
+		m_startup_timing.start = lap(phase_start);
+		m_startup_timing.ok = true;
+	}
+	~synthetic_camera()
+	{
+		if (m_generator_thread.joinable())
+		{
+			{
+				std::lock_guard<std::mutex> lock(m_generator_mutex);
+				m_stop = true;
+			}
+			m_generator_cond.notify_all();
+			m_generator_thread.join();
+		}
+		if (m_image_event_handler_ptr != nullptr)
+		{
+			m_image_event_handler_ptr->flush_frame_queue();
+			m_image_event_handler_ptr->close_loans();
+		}
+		delete m_image_event_handler_ptr;
+		delete m_device_event_handler_ptr;
+		delete m_recorder_ptr;
+		// buffers still on loan keep the pool alive
+	}
+	bool started() const
+	{
+		return m_startup_timing.ok;
+	}
+	const camera_startup_timing &get_startup_timing() const
+	{
+		return m_startup_timing;
+	}
+	void fill_stats(diagnostic_msgs::DiagnosticStatus &status)
+	{
+		status.name = m_cam_settings.cam_name;
+		status.level = diagnostic_msgs::DiagnosticStatus::OK;
+		if (m_image_event_handler_ptr == nullptr)
+		{
+			status.level = diagnostic_msgs::DiagnosticStatus::ERROR;
+			status.message = "failed to start: " + m_startup_timing.error;
+			return;
+		}
+		add_stat(status, "backend", "synthetic");
+		add_stat(status, "stream_buffers", m_buffer_count);
+		add_stat(status, "synthetic_generated", m_frames_generated.load());
+		add_stat(status, "synthetic_dropped", m_frames_dropped.load());
+		add_stat(status, "synthetic_incomplete", m_frames_incomplete.load());
+		// frames left out because every buffer was still in the pipeline
+		add_stat(status, "synthetic_underruns", m_underruns.load());
+		if (m_recorder_ptr != nullptr)
+		{
+			m_recorder_ptr->fill_stats(status);
+		}
+		m_image_event_handler_ptr->fill_stats(status);
+	}
+	// nothing to write to a device, the generator picks the values up with its next frame
+	void request_reconfigure(const blackfly::BlackFlyConfig &config)
+	{
+		std::lock_guard<std::mutex> lock(m_generator_mutex);
+		if (config.fps > 0.0)
+		{
+			m_fps = config.fps;
+		}
+		m_exposure_time = double(config.exposure_time);
+		m_gain = double(config.gain);
+		if (config.acquisition_stop)
+		{
+			m_paused = true;
+		}
+		else if (config.acquisition_start)
+		{
+			m_paused = false;
+		}
+		m_generator_cond.notify_all();
+	}
+
+	// Generated frames are the window cut out of the full frame, at the stride of the full width.
+	// There is no readout time to gain, the rate limit stays the configured rate.
+	void set_roi(const blackfly::SetRoi::Request &request, blackfly::SetRoi::Response &response)
+	{
+		if (m_image_event_handler_ptr == nullptr)
+		{
+			response.success = false;
+			response.message = "camera is not running";
+			return;
+		}
+		bool fits = fit_roi(int(request.offset_x), int(request.offset_y), int(request.width), int(request.height));
+		window_changed();
+		response.success = true;
+		response.message = fits ? "" : "window clamped to the sensor";
+		synthetic_window window = current_window();
+		response.offset_x = uint32_t(window.offset_x);
+		response.offset_y = uint32_t(window.offset_y);
+		response.width = uint32_t(window.width);
+		response.height = uint32_t(window.height);
+		response.max_fps = m_fps.load();
+		response.resulting_fps = m_fps.load();
+		response.stopped = false;
+		response.gap = 0.0;
+		ROS_INFO("Blackfly Nodelet: Synthetic camera %s ROI %ux%u at %u,%u", m_cam_settings.cam_name.c_str(), response.width, response.height, response.offset_x, response.offset_y);
+	}
+
+private:
+	struct synthetic_window
+	{
+		int offset_x;
+		int offset_y;
+		int width;
+		int height;
+	};
+	// Clamps the window to the generated frame, a width or height of 0 extends it to the edge. Bayer offsets are rounded down
+	// to even pixels so the window keeps the colour phase of its encoding. Returns false when it had to move or shrink.
+	bool fit_roi(int offset_x, int offset_y, int width, int height)
+	{
+		int increment = (m_format == PixelFormat_BayerRG8 || m_format == PixelFormat_BayerRG16) ? 2 : 1;
+		synthetic_window window;
+		window.offset_x = std::max(0, std::min(offset_x, m_width - 1)) / increment * increment;
+		window.offset_y = std::max(0, std::min(offset_y, m_height - 1)) / increment * increment;
+		window.width = std::min(width > 0 ? width : m_width - window.offset_x, m_width - window.offset_x);
+		window.height = std::min(height > 0 ? height : m_height - window.offset_y, m_height - window.offset_y);
+		{
+			std::lock_guard<std::mutex> lock(m_window_mutex);
+			m_window = window;
+		}
+		return window.offset_x == offset_x && window.offset_y == offset_y && (width == 0 || window.width == width) && (height == 0 || window.height == height);
+	}
+	// the four values of one window, never a mix of an old and a new one
+	synthetic_window current_window()
+	{
+		std::lock_guard<std::mutex> lock(m_window_mutex);
+		return m_window;
+	}
+	void window_changed()
+	{
+		sensor_msgs::RegionOfInterest roi;
+		synthetic_window window = current_window();
+		if (window.width < m_width || window.height < m_height)
+		{
+			roi.x_offset = uint32_t(window.offset_x);
+			roi.y_offset = uint32_t(window.offset_y);
+			roi.width = uint32_t(window.width);
+			roi.height = uint32_t(window.height);
+		}
+		m_image_event_handler_ptr->set_camera_info_roi(roi);
+	}
+	bool select_format()
+	{
+		std::string format = m_cam_settings.pixel_format;
+		if (format.empty())
+		{
+			format = m_cam_settings.mono ? "mono8" : "bgr8";
+		}
+		int bytes_per_pixel = 1;
+		if (format == "mono8")
+		{
+			m_format = PixelFormat_Mono8;
+		}
+		else if (format == "bgr8")
+		{
+			m_format = PixelFormat_BGR8;
+			bytes_per_pixel = 3;
+		}
+		else if (format == "bayer_rg8")
+		{
+			m_format = PixelFormat_BayerRG8;
+		}
+		else if (format == "bayer_rg16")
+		{
+			m_format = PixelFormat_BayerRG16;
+			bytes_per_pixel = 2;
+		}
+		else
+		{
+			return false;
+		}
+		m_width = m_cam_settings.synthetic_width > 0 ? m_cam_settings.synthetic_width : 1;
+		m_height = m_cam_settings.synthetic_height > 0 ? m_cam_settings.synthetic_height : 1;
+		m_stride = m_width * bytes_per_pixel;
+		fit_roi(m_cam_settings.roi_offset_x, m_cam_settings.roi_offset_y, m_cam_settings.roi_width, m_cam_settings.roi_height);
+		return true;
+	}
+	// a diagonal gradient in every buffer, generated once so producing a frame only stamps its counter
+	void fill_pattern()
+	{
+		for (size_t b = 0; b < m_buffer_count; b++)
+		{
+			uint8_t *buffer = m_pool->buffer(b);
+			for (int y = 0; y < m_height; y++)
+			{
+				uint8_t *row = buffer + size_t(y) * m_stride;
+				for (int x = 0; x < m_stride; x++)
+				{
+					row[x] = uint8_t(x + y);
+				}
+			}
+		}
+	}
+	void generator_loop()
+	{
+		std::mt19937_64 rng(std::hash<std::string>()(m_cam_settings.cam_name));
+		std::uniform_real_distribution<double> uniform(0.0, 1.0);
+		std::normal_distribution<double> jitter(0.0, m_cam_settings.synthetic_jitter > 0.0 ? m_cam_settings.synthetic_jitter : 1e-12);
+		std::chrono::steady_clock::time_point next = std::chrono::steady_clock::now();
+		std::unique_lock<std::mutex> lock(m_generator_mutex);
+		while (!m_stop)
+		{
+			next += std::chrono::nanoseconds(int64_t(1e9 / m_fps.load()));
+			// the exposure ends on the pulse, plus the jitter of a real trigger and transfer
+			double offset = m_cam_settings.synthetic_jitter > 0.0 ? std::max(jitter(rng), -0.5 / m_fps.load()) : 0.0;
+			std::chrono::steady_clock::time_point due = next + std::chrono::nanoseconds(int64_t(offset * 1e9));
+			m_generator_cond.wait_until(lock, due, [this]() { return m_stop.load(); });
+			if (m_stop)
+			{
+				break;
+			}
+			if (m_paused)
+			{
+				m_generator_cond.wait(lock, [this]() { return m_stop || !m_paused; });
+				next = std::chrono::steady_clock::now();
+				continue;
+			}
+			if (std::chrono::steady_clock::now() > next + std::chrono::seconds(1))
+			{
+				// fell far behind, do not burst the backlog out
+				next = std::chrono::steady_clock::now();
+			}
+			lock.unlock();
+			produce_frame(uniform(rng), uniform(rng));
+			lock.lock();
+		}
+	}
+	void produce_frame(double drop_draw, double incomplete_draw)
+	{
+		uint64_t frame_id = m_frame_id++;
+		ros::Time exposure_end = ros::Time::now();
+		m_device_event_handler_ptr->exposure_end(frame_id, exposure_end.toNSec());
+		if (drop_draw < m_cam_settings.synthetic_drop_rate)
+		{
+			// the camera exposed the frame but it never reached the host
+			m_frames_dropped++;
+			return;
+		}
+		size_t index;
+		if (!m_pool->take(index))
+		{
+			m_underruns++;
+			ROS_WARN_THROTTLE(1.0, "Blackfly Nodelet: Synthetic camera %s has no free buffer, frame left out", m_cam_settings.cam_name.c_str());
+			return;
+		}
+		// the frame counter in the first pixels of the window lets a subscriber see which frames made it
+		synthetic_window window = current_window();
+		size_t offset = size_t(window.offset_y) * m_stride + size_t(window.offset_x) * (m_stride / m_width);
+		uint8_t *buffer = m_pool->buffer(index);
+		std::memcpy(buffer + offset, &frame_id, std::min(sizeof(frame_id), m_pool->buffer_size() - offset));
+		frame_metadata metadata;
+		metadata.valid = true;
+		metadata.frame_id = frame_id;
+		metadata.device_timestamp = int64_t(exposure_end.toNSec());
+		metadata.exposure_time = m_exposure_time.load();
+		metadata.gain = m_gain.load();
+		bool incomplete = incomplete_draw < m_cam_settings.synthetic_incomplete_rate;
+		if (incomplete)
+		{
+			m_frames_incomplete++;
+		}
+		m_frames_generated++;
+		m_image_event_handler_ptr->handle_frame(boost::make_shared<SyntheticFrame>(m_pool, index, offset, m_format, window.width, window.height, m_stride, incomplete, metadata));
+	}
+	static double lap(ros::WallTime &phase_start)
+	{
+		ros::WallTime now = ros::WallTime::now();
+		double seconds = (now - phase_start).toSec();
+		phase_start = now;
+		return seconds;
+	}
+
+	camera_settings m_cam_settings;
+	camera_startup_timing m_startup_timing;
+	PixelFormatEnums m_format;
+	int m_width;
+	int m_height;
+	int m_stride;
+	// readout window, frames keep the stride of the full width. Written by set_roi, read by the generator thread.
+	std::mutex m_window_mutex;
+	synthetic_window m_window;
+	size_t m_buffer_count;
+	boost::shared_ptr<SyntheticBufferPool> m_pool;
+	// generator thread, paused by acquisition_stop until acquisition_start
+	std::thread m_generator_thread;
+	std::mutex m_generator_mutex;
+	std::condition_variable m_generator_cond;
+	std::atomic<bool> m_stop;
+	std::atomic<bool> m_paused;
+	std::atomic<double> m_fps;
+	std::atomic<double> m_exposure_time;
+	std::atomic<double> m_gain;
+	uint64_t m_frame_id;
+	std::atomic<uint64_t> m_frames_generated;
+	std::atomic<uint64_t> m_frames_dropped;
+	std::atomic<uint64_t> m_frames_incomplete;
+	std::atomic<uint64_t> m_underruns;
+	ImageEventHandler *m_image_event_handler_ptr;
+	DeviceEventHandler *m_device_event_handler_ptr;
+	FrameRecorder *m_recorder_ptr;
+	CameraOutputs m_outputs;
+};
+#endif // SYNTHETIC_CAMERA_
@@ -0,0 +1,64 @@
+#ifndef USER_SET_CACHE_
+#define USER_SET_CACHE_
+#include <string>
+#include <fstream>
+#include <cstdlib>
+#include <cstdint>
+#include <cstdio>
+
+#include <sys/stat.h>
+
+// Remembers which settings were last saved into a camera's UserSet, so the next start can load the set instead of writing every node.
+// One small file per camera serial in $ROS_HOME/blackfly (~/.ros/blackfly by default) holding the user set name and the settings hash.
+
+// 64 bit FNV-1a, stable across runs and builds unlike std::hash
+inline uint64_t fnv1a_hash(const std::string &data)
+{
+	uint64_t hash = 14695981039346656037ULL;
+	for (size_t i = 0; i < data.size(); i++)
+	{
+		hash ^= uint8_t(data[i]);
+		hash *= 1099511628211ULL;
+	}
+	return hash;
+}
+
+inline std::string user_set_cache_dir()
+{
+	const char *ros_home = std::getenv("ROS_HOME");
+	if (ros_home != nullptr)
+	{
+		return std::string(ros_home) + "/blackfly";
+	}
+	const char *home = std::getenv("HOME");
+	return std::string(home != nullptr ? home : "/tmp") + "/.ros/blackfly";
+}
+
+// true when the user set of this camera was saved with exactly this hash
+inline bool user_set_matches(const std::string &serial, const std::string &user_set, uint64_t hash)
+{
+	std::ifstream file((user_set_cache_dir() + "/" + serial + ".userset").c_str());
+	std::string saved_user_set;
+	uint64_t saved_hash;
+	if (!(file >> saved_user_set >> std::hex >> saved_hash))
+	{
+		return false;
+	}
+	return saved_user_set == user_set && saved_hash == hash;
+}
+
+inline bool save_user_set_hash(const std::string &serial, const std::string &user_set, uint64_t hash)
+{
+	std::string dir = user_set_cache_dir();
+	mkdir(dir.c_str(), 0755);
+	std::ofstream file((dir + "/" + serial + ".userset").c_str(), std::ios::trunc);
+	file << user_set << " " << std::hex << hash << std::endl;
+	return bool(file);
+}
+
+// forget the saved state, used before the user set is rewritten so a failed save is never taken for a valid one
+inline void clear_user_set_hash(const std::string &serial)
+{
+	std::remove((user_set_cache_dir() + "/" + serial + ".userset").c_str());
+}
+#endif // USER_SET_CACHE_
@@ -0,0 +1,130 @@
+#ifndef WORKER_POOL_
+#define WORKER_POOL_
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <atomic>
+#include <algorithm>
+
+#include <boost/shared_ptr.hpp>
+#include <boost/make_shared.hpp>
+
+// Fixed set of worker threads shared by all cameras of the nodelet for the host side image processing stages
+class WorkerPool
+{
+	public:
+		WorkerPool(unsigned int p_num_threads)
+		{
+			if (p_num_threads == 0)
+			{
+				p_num_threads = 1;
+			}
+			m_stop = false;
+			for (unsigned int i = 0; i < p_num_threads; i++)
+			{
+				m_threads.push_back(std::thread(&WorkerPool::worker_loop, this));
+			}
+		}
+		~WorkerPool()
+		{
+			{
+				std::lock_guard<std::mutex> lock(m_mutex);
+				m_stop = true;
+			}
+			m_cond.notify_all();
+			for (size_t i = 0; i < m_threads.size(); i++)
+			{
+				m_threads[i].join();
+			}
+		}
+		size_t size() const
+		{
+			return m_threads.size();
+		}
+		// queue a task for the next free worker
+		void post(std::function<void()> task)
+		{
+			{
+				std::lock_guard<std::mutex> lock(m_mutex);
+				m_tasks.push_back(std::move(task));
+			}
+			m_cond.notify_one();
+		}
+		// Runs fn(i) for every i in [0, n) on the workers and the calling thread, returns once all of them are done.
+		// The caller takes part in the work, so this makes progress even while every worker is busy with another camera.
+		void parallel_for(size_t n, const std::function<void(size_t)> &fn)
+		{
+			if (n == 0)
+			{
+				return;
+			}
+			boost::shared_ptr<parallel_job> job = boost::make_shared<parallel_job>(n, fn);
+			size_t helpers = std::min(n - 1, m_threads.size());
+			for (size_t i = 0; i < helpers; i++)
+			{
+				post([job]() { job->run(); });
+			}
+			job->run();
+			std::unique_lock<std::mutex> lock(job->mutex);
+			job->cond.wait(lock, [&job]() { return job->done == job->n; });
+		}
+
+	private:
+		struct parallel_job
+		{
+			parallel_job(size_t p_n, const std::function<void(size_t)> &p_fn) : n(p_n), next(0), done(0), fn(p_fn) {}
+			// claim indices until none are left, late helpers find nothing to do and just drop the job
+			void run()
+			{
+				size_t i;
+				size_t finished = 0;
+				while ((i = next++) < n)
+				{
+					fn(i);
+					finished++;
+				}
+				if (finished > 0)
+				{
+					std::lock_guard<std::mutex> lock(mutex);
+					done += finished;
+					if (done == n)
+					{
+						cond.notify_all();
+					}
+				}
+			}
+			const size_t n;
+			std::atomic<size_t> next;
+			size_t done;
+			std::function<void(size_t)> fn;
+			std::mutex mutex;
+			std::condition_variable cond;
+		};
+		void worker_loop()
+		{
+			while (true)
+			{
+				std::function<void()> task;
+				{
+					std::unique_lock<std::mutex> lock(m_mutex);
+					m_cond.wait(lock, [this]() { return m_stop || !m_tasks.empty(); });
+					if (m_stop && m_tasks.empty())
+					{
+						return;
+					}
+					task = std::move(m_tasks.front());
+					m_tasks.pop_front();
+				}
+				task();
+			}
+		}
+		std::vector<std::thread> m_threads;
+		std::deque<std::function<void()> > m_tasks;
+		std::mutex m_mutex;
+		std::condition_variable m_cond;
+		bool m_stop;
+};
+#endif // WORKER_POOL_
@@ -7,12 +7,37 @@ PLUGINLIB_EXPORT_CLASS(blackfly::blackfly_nodelet, nodelet::Nodelet)
 
 namespace blackfly
 {
+	// newer per camera settings are optional, every camera gets the default when the list is not given
+	template <typename T>
+	static void get_optional_param(ros::NodeHandle &pnh, const std::string &name, std::vector<T> &values, size_t num_cameras, T default_value)
+	{
+		if (!pnh.getParam(name, values))
+		{
+			values.assign(num_cameras, default_value);
+		}
+	}
+
 	blackfly_nodelet::~blackfly_nodelet()
 	{
+		m_stats_timer.stop();
+		// nobody waits for a camera that is already gone
+		if (m_frame_sync_ptr != nullptr)
+		{
+			m_frame_sync_ptr->stop();
+		}
+		// every camera waits for its acquisition to end and its buffers to come back, do that for all of them at once
+		std::vector<std::thread> teardown_threads;
 		for (auto it = m_cam_vect.begin(); it < m_cam_vect.end(); it++)
 		{
-			delete *it;
+			camera_interface *cam = *it;
+			teardown_threads.push_back(std::thread([cam]() { delete cam; }));
+		}
+		for (size_t i = 0; i < teardown_threads.size(); i++)
+		{
+			teardown_threads[i].join();
 		}
+		delete m_worker_pool_ptr;
+		delete m_frame_sync_ptr;
 		// Release system
 		camList.Clear();
 		system->ReleaseInstance();
@@ -85,6 +110,147 @@ namespace blackfly
 		std::vector<bool> exp_comp_flags;
 		pnh.getParam("exp_comp_flags", exp_comp_flags);
 
+		std::vector<bool> zero_copy_flags;
+		get_optional_param(pnh, "zero_copy_flags", zero_copy_flags, camera_names.size(), false);
+
+		// mono8, bgr8, bayer_rg8 or bayer_rg16, overrides mono_flags when given
+		std::vector<std::string> pixel_formats;
+		get_optional_param(pnh, "pixel_formats", pixel_formats, camera_names.size(), std::string(""));
+
+		// none, bilinear or edge_aware, host side demosaic for bayer_rg8 cameras
+		std::vector<std::string> demosaic_methods;
+		get_optional_param(pnh, "demosaic_methods", demosaic_methods, camera_names.size(), std::string("bilinear"));
+
+		// stamp frames from the camera clock instead of the exposure end event arrival
+		std::vector<bool> device_clock_flags;
+		get_optional_param(pnh, "device_clock_flags", device_clock_flags, camera_names.size(), false);
+
+		// seconds between observations of the camera clocks
+		double clock_sync_period = 1.0;
+		pnh.getParam("clock_sync_period", clock_sync_period);
+
+		// seconds an image waits for its exposure end event when the image arrives first
+		double event_match_tolerance = 0.002;
+		pnh.getParam("event_match_tolerance", event_match_tolerance);
+
+		// event or polling, polling pulls frames on a dedicated thread per camera
+		std::vector<std::string> acquisition_modes;
+		get_optional_param(pnh, "acquisition_modes", acquisition_modes, camera_names.size(), std::string("event"));
+
+		// core each polling thread is pinned to, -1 for no pinning
+		std::vector<int> acquisition_cpus;
+		get_optional_param(pnh, "acquisition_cpus", acquisition_cpus, camera_names.size(), -1);
+
+		// SCHED_FIFO priority of each polling thread, 0 keeps the default scheduler
+		std::vector<int> acquisition_priorities;
+		get_optional_param(pnh, "acquisition_priorities", acquisition_priorities, camera_names.size(), 0);
+
+		// frames queued per camera between the spinnaker callback and the worker pool, 0 converts and publishes on the callback thread
+		std::vector<int> queue_depths;
+		get_optional_param(pnh, "queue_depths", queue_depths, camera_names.size(), 0);
+
+		// drop_oldest or drop_newest, which frame is dropped when a camera's queue is full
+		std::vector<std::string> queue_overflow_policies;
+		get_optional_param(pnh, "queue_overflow_policies", queue_overflow_policies, camera_names.size(), std::string("drop_oldest"));
+
+		// stream buffers per camera, 0 sizes them from fps * buffer_latency_budget under buffer_memory_cap
+		std::vector<int> buffer_counts;
+		get_optional_param(pnh, "buffer_counts", buffer_counts, camera_names.size(), 5);
+
+		// NewestOnly, OldestFirst or OldestFirstOverwrite, empty keeps the camera default
+		std::vector<std::string> buffer_handling_modes;
+		get_optional_param(pnh, "buffer_handling_modes", buffer_handling_modes, camera_names.size(), std::string(""));
+
+		// stream buffers in preallocated, locked, huge page backed memory owned by the nodelet, opt in
+		std::vector<bool> user_buffer_flags;
+		get_optional_param(pnh, "user_buffer_flags", user_buffer_flags, camera_names.size(), false);
+
+		// jpeg quality of <cam_name>/compressed encoded by the nodelet, 0 leaves compression to image_transport
+		std::vector<int> jpeg_qualities;
+		get_optional_param(pnh, "jpeg_qualities", jpeg_qualities, camera_names.size(), 0);
+
+		// slices every jpeg frame is split into across the worker threads, 0 uses all of them
+		int jpeg_slices = 0;
+		pnh.getParam("jpeg_slices", jpeg_slices);
+
+		// luminance of colour cameras on image_mono, next to their colour topic
+		std::vector<bool> mono_output_flags;
+		get_optional_param(pnh, "mono_output_flags", mono_output_flags, camera_names.size(), false);
+
+		// image_half and image_quarter topics computed on the host
+		std::vector<bool> pyramid_flags;
+		get_optional_param(pnh, "pyramid_flags", pyramid_flags, camera_names.size(), false);
+
+		// hardware readout window per camera at its binning, 0 width or height extends it to the sensor edge
+		std::vector<int> roi_offsets_x;
+		get_optional_param(pnh, "roi_offsets_x", roi_offsets_x, camera_names.size(), 0);
+		std::vector<int> roi_offsets_y;
+		get_optional_param(pnh, "roi_offsets_y", roi_offsets_y, camera_names.size(), 0);
+		std::vector<int> roi_widths;
+		get_optional_param(pnh, "roi_widths", roi_widths, camera_names.size(), 0);
+		std::vector<int> roi_heights;
+		get_optional_param(pnh, "roi_heights", roi_heights, camera_names.size(), 0);
+
+		// raw recording of the cameras in record_flags into a new directory under record_dir
+		std::vector<bool> record_flags;
+		get_optional_param(pnh, "record_flags", record_flags, camera_names.size(), false);
+		std::string record_dir = "";
+		pnh.getParam("record_dir", record_dir);
+		int record_slots = 16;
+		pnh.getParam("record_slots", record_slots);
+		// [MB]
+		int record_segment_size = 1024;
+		pnh.getParam("record_segment_size", record_segment_size);
+
+		// spinnaker or synthetic, synthetic cameras generate their frames and ignore their serial
+		std::vector<std::string> camera_backends;
+		get_optional_param(pnh, "camera_backends", camera_backends, camera_names.size(), std::string("spinnaker"));
+		int synthetic_width = 1440;
+		pnh.getParam("synthetic_width", synthetic_width);
+		int synthetic_height = 1080;
+		pnh.getParam("synthetic_height", synthetic_height);
+		// [s]
+		double synthetic_jitter = 0.0;
+		pnh.getParam("synthetic_jitter", synthetic_jitter);
+		double synthetic_drop_rate = 0.0;
+		pnh.getParam("synthetic_drop_rate", synthetic_drop_rate);
+		double synthetic_incomplete_rate = 0.0;
+		pnh.getParam("synthetic_incomplete_rate", synthetic_incomplete_rate);
+
+		// seconds of frames held by automatically sized stream buffers
+		double buffer_latency_budget = 0.25;
+		pnh.getParam("buffer_latency_budget", buffer_latency_budget);
+
+		// MB of stream buffers per camera the automatic sizing may use
+		double buffer_memory_cap = 256.0;
+		pnh.getParam("buffer_memory_cap", buffer_memory_cap);
+
+		// lock the process memory with mlockall
+		bool lock_memory = false;
+		pnh.getParam("lock_memory", lock_memory);
+
+		// threads used by the host side image processing of all cameras
+		int worker_threads = std::thread::hardware_concurrency();
+		pnh.getParam("worker_threads", worker_threads);
+
+		// configure cameras with a single UserSetLoad when the user set was saved from the same settings
+		bool warm_start = false;
+		pnh.getParam("warm_start", warm_start);
+		std::string user_set = "UserSet1";
+		pnh.getParam("user_set", user_set);
+
+		// bring the cameras up and down concurrently
+		bool parallel_startup = true;
+		pnh.getParam("parallel_startup", parallel_startup);
+
+		// give the frames of one trigger pulse the same stamp on all triggered cameras
+		bool sync_triggered_cameras = false;
+		pnh.getParam("sync_triggered_cameras", sync_triggered_cameras);
+		double sync_tolerance = 0.002;
+		pnh.getParam("sync_tolerance", sync_tolerance);
+		double sync_max_wait = 0.01;
+		pnh.getParam("sync_max_wait", sync_max_wait);
+
 		// enable dynamic reconfigure
 		bool enable_dyn_reconf;
 		pnh.getParam("enable_dyn_reconf", enable_dyn_reconf);
@@ -109,7 +275,28 @@ namespace blackfly
 			binning_mode.size() != num_cameras_listed ||
 			lighting_mode.size() != num_cameras_listed ||
 			auto_exposure_priority.size() != num_cameras_listed ||
-			exp_comp_flags.size() != num_cameras_listed)
+			exp_comp_flags.size() != num_cameras_listed ||
+			zero_copy_flags.size() != num_cameras_listed ||
+			pixel_formats.size() != num_cameras_listed ||
+			demosaic_methods.size() != num_cameras_listed ||
+			device_clock_flags.size() != num_cameras_listed ||
+			acquisition_modes.size() != num_cameras_listed ||
+			acquisition_cpus.size() != num_cameras_listed ||
+			acquisition_priorities.size() != num_cameras_listed ||
+			queue_depths.size() != num_cameras_listed ||
+			queue_overflow_policies.size() != num_cameras_listed ||
+			buffer_counts.size() != num_cameras_listed ||
+			buffer_handling_modes.size() != num_cameras_listed ||
+			user_buffer_flags.size() != num_cameras_listed ||
+			jpeg_qualities.size() != num_cameras_listed ||
+			record_flags.size() != num_cameras_listed ||
+			pyramid_flags.size() != num_cameras_listed ||
+			mono_output_flags.size() != num_cameras_listed ||
+			roi_offsets_x.size() != num_cameras_listed ||
+			roi_offsets_y.size() != num_cameras_listed ||
+			roi_widths.size() != num_cameras_listed ||
+			roi_heights.size() != num_cameras_listed ||
+			camera_backends.size() != num_cameras_listed)
 		{
 			ROS_FATAL("Camera settings don't match number of camera names");
 			ros::shutdown();
@@ -118,8 +305,9 @@ namespace blackfly
 		system = System::GetInstance();
 		camList = system->GetCameras();
 		numCameras = camList.GetSize();
-		// Finish if there are no cameras
-		if (numCameras == 0)
+		// Finish if there are no cameras, unless every camera is synthetic
+		bool spinnaker_needed = std::find(camera_backends.begin(), camera_backends.end(), std::string("spinnaker")) != camera_backends.end();
+		if (numCameras == 0 && spinnaker_needed)
 		{
 			camList.Clear();
 			system->ReleaseInstance();
@@ -127,42 +315,151 @@ namespace blackfly
 			ros::shutdown();
 		}
 
-		for (int i = 0; i < camera_names.size(); i++)
+		if (lock_memory)
 		{
+			lock_process_memory();
+		}
+		m_worker_pool_ptr = new WorkerPool(worker_threads > 0 ? worker_threads : 1);
 
-			ROS_DEBUG("Camera #%i", i);
-			CameraPtr cam_ptr;
-			try
-			{
-				ROS_DEBUG("Camera Serial : #%s", camera_serials[i].c_str());
-
-				cam_ptr = camList.GetBySerial(camera_serials[i]);
-				if (!cam_ptr->IsValid())
-				{
-					ROS_FATAL("Failed to get camera pointer from spinnaker for camera serial: %s", camera_serials[i].c_str());
-					camList.Clear();
-					system->ReleaseInstance();
-					ros::shutdown();
-				}
-
-				ROS_DEBUG("Camera Pointer Valid");
-			}
-			catch (const std::exception &e)
+		// every start records into its own directory named after the start time
+		std::string record_session_dir = "";
+		if (!record_dir.empty() && std::find(record_flags.begin(), record_flags.end(), true) != record_flags.end())
+		{
+			char session[32];
+			time_t now = time(nullptr);
+			strftime(session, sizeof(session), "%Y%m%d_%H%M%S", localtime(&now));
+			record_session_dir = record_dir + "/" + session;
+			mkdir(record_dir.c_str(), 0755);
+			if (mkdir(record_session_dir.c_str(), 0755) != 0 && errno != EEXIST)
 			{
-				ROS_FATAL("Failed to find camera with serial : %s", camera_serials[i].c_str());
-				ros::shutdown();
+				ROS_ERROR("Blackfly Nodelet: Failed to create recording directory %s: %s", record_session_dir.c_str(), std::strerror(errno));
+				record_session_dir = "";
 			}
+		}
+
+		std::vector<camera_settings> settings_vect;
+		for (int i = 0; i < camera_names.size(); i++)
+		{
 			camera_settings settings(camera_names[i], camera_info_paths[i], mono_flags[i],
 									 is_triggered_flags[i], fps[i], is_auto_exp_flags[i], max_auto_exp[i], min_auto_exp[i], fixed_exp[i],
 									 auto_gain_flags[i], gains[i], max_gains[i], min_gains[i], enable_gamma[i], gammas[i],
 									 binnings[i], binning_mode[i], lighting_mode[i], auto_exposure_priority[i], exp_comp_flags[i]);
+			settings.zero_copy = zero_copy_flags[i];
+			settings.pixel_format = pixel_formats[i];
+			settings.device_clock = device_clock_flags[i];
+			settings.clock_sync_period = clock_sync_period;
+			settings.event_match_tolerance = event_match_tolerance;
+			settings.polling = acquisition_modes[i] == "polling";
+			settings.acquisition_cpu = acquisition_cpus[i];
+			settings.acquisition_priority = acquisition_priorities[i];
+			settings.queue_depth = queue_depths[i] > 0 ? queue_depths[i] : 0;
+			settings.queue_overflow = queue_overflow_policies[i] == "drop_newest" ? QUEUE_DROP_NEWEST : QUEUE_DROP_OLDEST;
+			settings.buffer_count = buffer_counts[i] > 0 ? buffer_counts[i] : 0;
+			settings.buffer_handling_mode = buffer_handling_modes[i];
+			settings.buffer_latency_budget = buffer_latency_budget;
+			settings.buffer_memory_cap = buffer_memory_cap;
+			settings.user_buffers = user_buffer_flags[i];
+			settings.jpeg_quality = std::min(jpeg_qualities[i], 100);
+			settings.jpeg_slices = jpeg_slices;
+			settings.pyramid = pyramid_flags[i];
+			settings.mono_output = mono_output_flags[i];
+			settings.roi_offset_x = std::max(roi_offsets_x[i], 0);
+			settings.roi_offset_y = std::max(roi_offsets_y[i], 0);
+			settings.roi_width = std::max(roi_widths[i], 0);
+			settings.roi_height = std::max(roi_heights[i], 0);
+			if (record_flags[i] && !record_session_dir.empty())
+			{
+				settings.record_dir = record_session_dir + "/" + camera_names[i];
+				settings.record_slots = record_slots;
+				settings.record_segment_size = uint64_t(std::max(record_segment_size, 1)) * 1024 * 1024;
+			}
+			settings.warm_start = warm_start;
+			settings.backend = camera_backends[i];
+			settings.synthetic_width = synthetic_width;
+			settings.synthetic_height = synthetic_height;
+			settings.synthetic_jitter = synthetic_jitter;
+			settings.synthetic_drop_rate = synthetic_drop_rate;
+			settings.synthetic_incomplete_rate = synthetic_incomplete_rate;
+			settings.user_set = user_set;
+			if (demosaic_methods[i] == "none")
+			{
+				settings.demosaic = DEMOSAIC_NONE;
+			}
+			else if (demosaic_methods[i] == "edge_aware")
+			{
+				settings.demosaic = DEMOSAIC_EDGE_AWARE;
+			}
+			else
+			{
+				settings.demosaic = DEMOSAIC_BILINEAR;
+			}
 
 			ROS_DEBUG("Created Camera Settings Object");
+			settings_vect.push_back(settings);
+		}
 
-			blackfly_camera *blackfly_ptr = new blackfly_camera(settings, cam_ptr);
-			ROS_DEBUG("Created Camera Object");
-			m_cam_vect.push_back(blackfly_ptr);
-			ROS_INFO("Successfully launched camera : %s, Serial : %s", settings.cam_name.c_str(), camera_serials[i].c_str());
+		if (sync_triggered_cameras)
+		{
+			std::vector<std::string> sync_names;
+			for (size_t i = 0; i < camera_names.size(); i++)
+			{
+				if (is_triggered_flags[i])
+				{
+					sync_names.push_back(camera_names[i]);
+				}
+			}
+			if (sync_names.size() > 1)
+			{
+				m_frame_sync_ptr = new FrameSynchronizer(sync_names, sync_tolerance, sync_max_wait, m_worker_pool_ptr);
+			}
+			else
+			{
+				ROS_WARN("Blackfly Nodelet: sync_triggered_cameras needs at least two triggered cameras");
+			}
+		}
+
+		// one startup task per camera, a camera that fails is left out without holding up the others
+		ros::WallTime startup_begin = ros::WallTime::now();
+		std::vector<camera_interface *> cameras(settings_vect.size(), nullptr);
+		std::vector<camera_startup_timing> timings(settings_vect.size());
+		if (parallel_startup)
+		{
+			std::vector<std::thread> startup_threads;
+			for (size_t i = 0; i < settings_vect.size(); i++)
+			{
+				startup_threads.push_back(std::thread([this, i, &settings_vect, &camera_serials, &cameras, &timings]()
+														{ cameras[i] = start_camera(settings_vect[i], camera_serials[i], timings[i]); }));
+			}
+			for (size_t i = 0; i < startup_threads.size(); i++)
+			{
+				startup_threads[i].join();
+			}
+		}
+		else
+		{
+			for (size_t i = 0; i < settings_vect.size(); i++)
+			{
+				cameras[i] = start_camera(settings_vect[i], camera_serials[i], timings[i]);
+			}
+		}
+		m_cam_by_id = cameras;
+		for (size_t i = 0; i < cameras.size(); i++)
+		{
+			if (cameras[i] != nullptr)
+			{
+				m_cam_vect.push_back(cameras[i]);
+			}
+			else if (m_frame_sync_ptr != nullptr)
+			{
+				m_frame_sync_ptr->remove(settings_vect[i].cam_name);
+			}
+		}
+		ROS_INFO("Blackfly Nodelet: Started %zu of %zu cameras in %.2f s", m_cam_vect.size(), settings_vect.size(), (ros::WallTime::now() - startup_begin).toSec());
+		publish_startup_timings(pnh, settings_vect, timings);
+		if (m_cam_vect.empty())
+		{
+			ROS_FATAL("Blackfly Nodelet: No camera could be started!");
+			ros::shutdown();
 		}
 
 		if (enable_dyn_reconf)
@@ -172,95 +469,139 @@ namespace blackfly
 			dyn_rec_cb = boost::bind(&blackfly_nodelet::callback_dyn_reconf, this, _1, _2);
 			dr_srv->setCallback(dyn_rec_cb);
 		}
+		// runtime changes of the readout window
+		m_roi_srv = pnh.advertiseService("set_roi", &blackfly_nodelet::callback_set_roi, this);
+		// pipeline counters of every camera
+		m_stats_pub = pnh.advertise<diagnostic_msgs::DiagnosticArray>("stats", 1);
+		m_stats_timer = nh.createTimer(ros::Duration(1.0), &blackfly_nodelet::publish_stats, this);
 		ROS_INFO("Successfully launched all cameras.");
 	}
 
-	void blackfly_nodelet::callback_dyn_reconf(blackfly::BlackFlyConfig &config, uint32_t level)
+	// Looks the camera up by serial and brings it up, returns nullptr if any phase failed. Runs on its own thread per camera.
+	camera_interface *blackfly_nodelet::start_camera(const camera_settings &settings, const std::string &serial, camera_startup_timing &timing)
 	{
-		std::cout << "Dynamic Reconfigure triggered" << std::endl;
-
-		// fps
-		camList[config.cam_id]->AcquisitionFrameRate = config.fps;
-		// gamma
-		camList[config.cam_id]->GammaEnable = config.enable_gamma;
-		camList[config.cam_id]->Gamma.SetValue(config.gamma);
-
-		switch (config.exposure_auto)
+		if (settings.backend == "synthetic")
+		{
+			synthetic_camera *synthetic_ptr = new synthetic_camera(settings, m_worker_pool_ptr, m_frame_sync_ptr);
+			timing = synthetic_ptr->get_startup_timing();
+			if (!synthetic_ptr->started())
+			{
+				delete synthetic_ptr;
+				return nullptr;
+			}
+			ROS_INFO("Successfully launched synthetic camera : %s, %dx%d at %.1f fps", settings.cam_name.c_str(), settings.synthetic_width, settings.synthetic_height, settings.fps);
+			return synthetic_ptr;
+		}
+		else if (settings.backend != "spinnaker")
 		{
-		case 0:
-			camList[config.cam_id]->ExposureAuto.SetValue(ExposureAutoEnums::ExposureAuto_Off);
-			camList[config.cam_id]->ExposureTime = config.exposure_time;
-			break;
-		case 1:
-			camList[config.cam_id]->ExposureAuto.SetValue(ExposureAutoEnums::ExposureAuto_Once);
-			break;
-		default:
-			camList[config.cam_id]->ExposureAuto.SetValue(ExposureAutoEnums::ExposureAuto_Continuous);
-			break;
+			timing.error = "unknown backend " + settings.backend;
+			ROS_ERROR("Blackfly Nodelet: Unknown backend %s for camera %s", settings.backend.c_str(), settings.cam_name.c_str());
+			return nullptr;
 		}
-		switch (config.gain_auto)
+		ros::WallTime enumerate_start = ros::WallTime::now();
+		CameraPtr cam_ptr;
+		try
 		{
-		case 0:
-			camList[config.cam_id]->GainAuto.SetValue(GainAutoEnums::GainAuto_Off);
-			camList[config.cam_id]->Gain = config.gain;
-			break;
-		case 1:
-			camList[config.cam_id]->GainAuto.SetValue(GainAutoEnums::GainAuto_Once);
-			break;
-		default:
-			camList[config.cam_id]->GainAuto.SetValue(GainAutoEnums::GainAuto_Continuous);
-			break;
+			cam_ptr = camList.GetBySerial(serial);
 		}
-
-		switch (config.lighting_mode)
+		catch (Spinnaker::Exception &e)
+		{
+			cam_ptr = nullptr;
+		}
+		timing.enumerate = (ros::WallTime::now() - enumerate_start).toSec();
+		if (!cam_ptr || !cam_ptr->IsValid())
 		{
-		case 1:
-			camList[config.cam_id]->AutoExposureLightingMode.SetValue(AutoExposureLightingModeEnums::AutoExposureLightingMode_Backlight);
-			break;
-		case 2:
-			camList[config.cam_id]->AutoExposureLightingMode.SetValue(AutoExposureLightingModeEnums::AutoExposureLightingMode_Frontlight);
-			break;
-		default:
-			camList[config.cam_id]->AutoExposureLightingMode.SetValue(AutoExposureLightingModeEnums::AutoExposureLightingMode_Normal);
-			break;
+			timing.error = "no camera with serial " + serial;
+			ROS_ERROR("Blackfly Nodelet: Failed to find camera %s with serial : %s", settings.cam_name.c_str(), serial.c_str());
+			return nullptr;
 		}
-		switch (config.auto_exposure_priority)
+		blackfly_camera *blackfly_ptr = new blackfly_camera(settings, cam_ptr, m_worker_pool_ptr, m_frame_sync_ptr);
+		double enumerate = timing.enumerate;
+		timing = blackfly_ptr->get_startup_timing();
+		timing.enumerate = enumerate;
+		if (!blackfly_ptr->started())
 		{
-		case 1:
-			camList[config.cam_id]->AutoExposureControlPriority.SetValue(AutoExposureControlPriorityEnums::AutoExposureControlPriority_ExposureTime);
-			break;
-		default:
-			camList[config.cam_id]->AutoExposureControlPriority.SetValue(AutoExposureControlPriorityEnums::AutoExposureControlPriority_Gain);
-			break;
+			delete blackfly_ptr;
+			return nullptr;
 		}
+		ROS_INFO("Successfully launched camera : %s, Serial : %s", settings.cam_name.c_str(), serial.c_str());
+		ROS_INFO("Blackfly Nodelet: Camera %s startup [s]: enumerate %.3f, init %.3f, configure %.3f%s, register %.3f, start %.3f", settings.cam_name.c_str(),
+					timing.enumerate, timing.init, timing.configure, timing.warm_start ? " (warm)" : "", timing.register_events, timing.start);
+		return blackfly_ptr;
+	}
 
-		if (config.acquisition_stop)
+	// latched, so tools started later still see how long each camera took to come up
+	void blackfly_nodelet::publish_startup_timings(ros::NodeHandle &pnh, const std::vector<camera_settings> &settings_vect, const std::vector<camera_startup_timing> &timings)
+	{
+		m_startup_pub = pnh.advertise<diagnostic_msgs::DiagnosticArray>("startup_timing", 1, true);
+		diagnostic_msgs::DiagnosticArray startup_msg;
+		startup_msg.header.stamp = ros::Time::now();
+		for (size_t i = 0; i < timings.size(); i++)
 		{
-			std::cout << "stop trigger" << std::endl;
-			camList[config.cam_id]->AcquisitionStop();
-			camList[config.cam_id]->TLParamsLocked = 0;
-			camList[config.cam_id]->BinningHorizontal = config.binning;
-			camList[config.cam_id]->BinningVertical = config.binning;
+			diagnostic_msgs::DiagnosticStatus status;
+			status.name = settings_vect[i].cam_name;
+			status.level = timings[i].ok ? (timings[i].error.empty() ? diagnostic_msgs::DiagnosticStatus::OK : diagnostic_msgs::DiagnosticStatus::WARN)
+										 : diagnostic_msgs::DiagnosticStatus::ERROR;
+			status.message = timings[i].error;
+			add_stat(status, "enumerate", timings[i].enumerate);
+			add_stat(status, "init", timings[i].init);
+			add_stat(status, "configure", timings[i].configure);
+			add_stat(status, "register", timings[i].register_events);
+			add_stat(status, "start", timings[i].start);
+			add_stat(status, "warm_start", timings[i].warm_start);
+			startup_msg.status.push_back(status);
+		}
+		m_startup_pub.publish(startup_msg);
+	}
 
-			switch (config.binning_mode)
-			{
-			case 0:
-				camList[config.cam_id]->BinningHorizontalMode.SetValue(BinningHorizontalModeEnums::BinningHorizontalMode_Average);
-				camList[config.cam_id]->BinningVerticalMode.SetValue(BinningVerticalModeEnums::BinningVerticalMode_Average);
-				break;
-
-			default:
-				camList[config.cam_id]->BinningHorizontalMode.SetValue(BinningHorizontalModeEnums::BinningHorizontalMode_Sum);
-				camList[config.cam_id]->BinningVerticalMode.SetValue(BinningVerticalModeEnums::BinningVerticalMode_Sum);
-				break;
-			}
+	void blackfly_nodelet::publish_stats(const ros::TimerEvent &event)
+	{
+		if (m_stats_pub.getNumSubscribers() == 0)
+		{
+			return;
+		}
+		diagnostic_msgs::DiagnosticArray stats_msg;
+		stats_msg.header.stamp = ros::Time::now();
+		for (size_t i = 0; i < m_cam_vect.size(); i++)
+		{
+			diagnostic_msgs::DiagnosticStatus status;
+			m_cam_vect[i]->fill_stats(status);
+			stats_msg.status.push_back(status);
+		}
+		if (m_frame_sync_ptr != nullptr)
+		{
+			diagnostic_msgs::DiagnosticStatus status;
+			m_frame_sync_ptr->fill_stats(status);
+			stats_msg.status.push_back(status);
 		}
-		if (config.acquisition_start)
+		m_stats_pub.publish(stats_msg);
+	}
+
+	void blackfly_nodelet::callback_dyn_reconf(blackfly::BlackFlyConfig &config, uint32_t level)
+	{
+		std::cout << "Dynamic Reconfigure triggered" << std::endl;
+
+		// cam_id is the position in camera_names, the order spinnaker enumerates the cameras in does not matter
+		if (config.cam_id < 0 || config.cam_id >= (int)m_cam_by_id.size() || m_cam_by_id[config.cam_id] == nullptr)
+		{
+			ROS_ERROR("Blackfly Nodelet: Dynamic reconfigure for unknown or stopped camera id %d", config.cam_id);
+			return;
+		}
+		// applied on the control thread of that camera, its node cache only sends the settings that changed
+		m_cam_by_id[config.cam_id]->request_reconfigure(config);
+	}
+
+	bool blackfly_nodelet::callback_set_roi(blackfly::SetRoi::Request &request, blackfly::SetRoi::Response &response)
+	{
+		if (request.cam_id < 0 || request.cam_id >= (int)m_cam_by_id.size() || m_cam_by_id[request.cam_id] == nullptr)
 		{
-			std::cout << "start trigger" << std::endl;
-			camList[config.cam_id]->TLParamsLocked = 1;
-			camList[config.cam_id]->AcquisitionStart();
+			response.success = false;
+			response.message = "unknown or stopped camera id";
+			return true;
 		}
+		// waits for the control thread of that camera, the response carries the window and frame rate it ended up with
+		m_cam_by_id[request.cam_id]->set_roi(request, response);
+		return true;
 	}
 
 } // end namespace blackfly
\ No newline at end of file
@@ -0,0 +1,334 @@
+#include "../include/replay_nodelet.h"
+
+#include <algorithm>
+#include <dirent.h>
+
+// Nodelet stuff
+#include <pluginlib/class_list_macros.h>
+
+PLUGINLIB_EXPORT_CLASS(blackfly::replay_nodelet, nodelet::Nodelet)
+
+namespace blackfly
+{
+	// frames preallocated and loans allowed per replayed camera, matches the queue size of the camera publisher
+	static const size_t REPLAY_POOL_SIZE = 10;
+	// longest single sleep, so a stop request is noticed during long gaps in the recording
+	static const double REPLAY_MAX_SLEEP = 0.1;
+
+	// the pixel format the image event handler publishes a recorded encoding as, and its name in the camera settings
+	static bool pixel_format_of(const std::string &encoding, PixelFormatEnums &format, std::string &setting)
+	{
+		if (encoding == sensor_msgs::image_encodings::MONO8)
+		{
+			format = PixelFormat_Mono8;
+			setting = "mono8";
+		}
+		else if (encoding == sensor_msgs::image_encodings::BGR8)
+		{
+			format = PixelFormat_BGR8;
+			setting = "bgr8";
+		}
+		else if (encoding == sensor_msgs::image_encodings::BAYER_RGGB8)
+		{
+			format = PixelFormat_BayerRG8;
+			setting = "bayer_rg8";
+		}
+		else if (encoding == sensor_msgs::image_encodings::BAYER_RGGB16)
+		{
+			format = PixelFormat_BayerRG16;
+			setting = "bayer_rg16";
+		}
+		else
+		{
+			return false;
+		}
+		return true;
+	}
+
+	static bool is_recording(const std::string &dir)
+	{
+		struct stat info;
+		return stat(recording_index_path(dir).c_str(), &info) == 0;
+	}
+
+	replay_nodelet::~replay_nodelet()
+	{
+		m_stop = true;
+		if (m_playback_thread.joinable())
+		{
+			m_playback_thread.join();
+		}
+		for (size_t i = 0; i < m_cameras.size(); i++)
+		{
+			// loaned frames hold their segment mapping, and frames still held by subscribers keep their pool alive
+			if (m_cameras[i].image_event_handler_ptr != nullptr)
+			{
+				m_cameras[i].image_event_handler_ptr->close_loans();
+			}
+			delete m_cameras[i].image_event_handler_ptr;
+			delete m_cameras[i].device_event_handler_ptr;
+			delete m_cameras[i].frame_pool_ptr;
+			delete m_cameras[i].outputs_ptr;
+			delete m_cameras[i].reader_ptr;
+		}
+	}
+
+	void replay_nodelet::onInit()
+	{
+		ros::NodeHandle &pnh = getMTPrivateNodeHandle();
+
+		// a camera directory written by the recorder, or a session directory holding one per camera
+		std::string recording_dir;
+		pnh.getParam("recording_dir", recording_dir);
+		// original, fast or fixed
+		std::string mode = "original";
+		pnh.getParam("mode", mode);
+		// playback speed factor in original mode
+		pnh.getParam("speed", m_speed);
+		// frames (or bundles of frames with the same stamp) per second in fixed mode
+		pnh.getParam("rate", m_rate);
+		pnh.getParam("loop", m_loop);
+		pnh.getParam("restamp", m_restamp);
+		// host side outputs as on the live nodelet, for every replayed camera
+		pnh.getParam("jpeg_quality", m_jpeg_quality);
+		pnh.getParam("mono_output", m_mono_output);
+		pnh.getParam("pyramid", m_pyramid);
+		// none, bilinear or edge_aware, for bayer_rg8 recordings
+		std::string demosaic = "bilinear";
+		pnh.getParam("demosaic", demosaic);
+		// optional, replay only these cameras
+		std::vector<std::string> camera_names;
+		pnh.getParam("camera_names", camera_names);
+		// optional, camera info of each camera in camera_names
+		std::vector<std::string> camera_info_paths;
+		pnh.getParam("camera_info_paths", camera_info_paths);
+
+		if (mode == "fast")
+		{
+			m_mode = REPLAY_FAST;
+		}
+		else if (mode == "fixed")
+		{
+			m_mode = REPLAY_FIXED;
+		}
+		else
+		{
+			m_mode = REPLAY_ORIGINAL;
+		}
+		if (demosaic == "none")
+		{
+			m_demosaic = DEMOSAIC_NONE;
+		}
+		else if (demosaic == "edge_aware")
+		{
+			m_demosaic = DEMOSAIC_EDGE_AWARE;
+		}
+		else
+		{
+			m_demosaic = DEMOSAIC_BILINEAR;
+		}
+		if (m_speed <= 0.0 || m_rate <= 0.0)
+		{
+			ROS_ERROR("Blackfly Replay: speed and rate must be positive");
+			return;
+		}
+
+		std::vector<std::string> dirs;
+		if (is_recording(recording_dir))
+		{
+			dirs.push_back(recording_dir);
+		}
+		else
+		{
+			DIR *session = opendir(recording_dir.c_str());
+			if (session == nullptr)
+			{
+				ROS_ERROR("Blackfly Replay: Failed to open recording directory %s", recording_dir.c_str());
+				return;
+			}
+			for (struct dirent *entry = readdir(session); entry != nullptr; entry = readdir(session))
+			{
+				std::string name = entry->d_name;
+				if (name != "." && name != ".." && is_recording(recording_dir + "/" + name))
+				{
+					dirs.push_back(recording_dir + "/" + name);
+				}
+			}
+			closedir(session);
+			std::sort(dirs.begin(), dirs.end());
+		}
+
+		for (size_t i = 0; i < dirs.size(); i++)
+		{
+			std::string name = dirs[i].substr(dirs[i].find_last_of('/') + 1);
+			std::vector<std::string>::iterator wanted = std::find(camera_names.begin(), camera_names.end(), name);
+			if (!camera_names.empty() && wanted == camera_names.end())
+			{
+				continue;
+			}
+			std::string cam_info_path = "";
+			size_t position = wanted - camera_names.begin();
+			if (!camera_names.empty() && position < camera_info_paths.size())
+			{
+				cam_info_path = camera_info_paths[position];
+			}
+			add_camera(dirs[i], cam_info_path);
+		}
+		if (m_timeline.empty())
+		{
+			ROS_ERROR("Blackfly Replay: No frames to replay in %s", recording_dir.c_str());
+			return;
+		}
+		// one timeline across all cameras, frames of one trigger pulse keep their recorded order
+		std::stable_sort(m_timeline.begin(), m_timeline.end(), [](const replay_entry &a, const replay_entry &b) { return a.stamp_ns < b.stamp_ns; });
+		ROS_INFO("Blackfly Replay: Replaying %zu frames of %zu cameras from %s in %s mode", m_timeline.size(), m_cameras.size(), recording_dir.c_str(), mode.c_str());
+		m_playback_thread = std::thread(&replay_nodelet::playback_loop, this);
+	}
+
+	bool replay_nodelet::add_camera(const std::string &dir, const std::string &cam_info_path)
+	{
+		RecordingReader *reader_ptr = new RecordingReader(dir);
+		if (!reader_ptr->valid() || reader_ptr->size() == 0)
+		{
+			delete reader_ptr;
+			return false;
+		}
+		m_cameras.push_back(replay_camera());
+		replay_camera &camera = m_cameras.back();
+		camera.reader_ptr = reader_ptr;
+		camera.cam_name = reader_ptr->cam_name();
+		// same topics and handler as blackfly_nodelet, subscribers cannot tell a replay from the camera
+		camera_settings settings;
+		settings.cam_name = camera.cam_name;
+		settings.cam_info_path = cam_info_path;
+		const recorded_frame &first = reader_ptr->frame(0);
+		PixelFormatEnums format;
+		if (!pixel_format_of(std::string(first.encoding, strnlen(first.encoding, sizeof(first.encoding))), format, settings.pixel_format))
+		{
+			settings.pixel_format = "";
+		}
+		settings.mono = settings.pixel_format == "mono8";
+		settings.zero_copy = true;
+		settings.demosaic = m_demosaic;
+		settings.jpeg_quality = m_jpeg_quality;
+		settings.mono_output = m_mono_output;
+		settings.pyramid = m_pyramid;
+		camera.outputs_ptr = new CameraOutputs();
+		camera.outputs_ptr->advertise(settings);
+		camera.device_event_handler_ptr = new DeviceEventHandler(CameraPtr(), settings.event_match_tolerance);
+		camera.image_event_handler_ptr = camera.outputs_ptr->create_handler(settings, CameraPtr(), camera.device_event_handler_ptr, (unsigned int)REPLAY_POOL_SIZE,
+																			nullptr, nullptr, nullptr);
+		camera.frame_pool_ptr = new MessagePool<RecordedFrame>(REPLAY_POOL_SIZE);
+		uint32_t index = uint32_t(m_cameras.size() - 1);
+		for (size_t i = 0; i < reader_ptr->size(); i++)
+		{
+			replay_entry entry;
+			entry.stamp_ns = reader_ptr->frame(i).stamp_ns;
+			entry.camera = index;
+			entry.frame = uint32_t(i);
+			m_timeline.push_back(entry);
+		}
+		ROS_INFO("Blackfly Replay: Camera %s with %zu frames", camera.cam_name.c_str(), reader_ptr->size());
+		return true;
+	}
+
+	bool replay_nodelet::wait_until(ros::WallTime p_target)
+	{
+		while (!m_stop && ros::ok())
+		{
+			double remaining = (p_target - ros::WallTime::now()).toSec();
+			if (remaining <= 0.0)
+			{
+				return true;
+			}
+			ros::WallDuration(std::min(remaining, REPLAY_MAX_SLEEP)).sleep();
+		}
+		return false;
+	}
+
+	void replay_nodelet::playback_loop()
+	{
+		do
+		{
+			ros::WallTime start = ros::WallTime::now();
+			int64_t first_stamp_ns = m_timeline.front().stamp_ns;
+			int64_t previous_stamp_ns = first_stamp_ns;
+			uint64_t step = 0;
+			size_t published = 0;
+			for (size_t i = 0; i < m_timeline.size(); i++)
+			{
+				const replay_entry &entry = m_timeline[i];
+				if (m_mode == REPLAY_ORIGINAL)
+				{
+					double offset = double(entry.stamp_ns - first_stamp_ns) * 1e-9 / m_speed;
+					if (!wait_until(start + ros::WallDuration(offset)))
+					{
+						return;
+					}
+				}
+				else if (m_mode == REPLAY_FIXED)
+				{
+					// frames sharing a stamp go out together
+					if (entry.stamp_ns != previous_stamp_ns)
+					{
+						step++;
+						previous_stamp_ns = entry.stamp_ns;
+					}
+					if (!wait_until(start + ros::WallDuration(double(step) / m_rate)))
+					{
+						return;
+					}
+				}
+				else if (m_stop || !ros::ok())
+				{
+					return;
+				}
+				publish_frame(m_cameras[entry.camera], entry.frame);
+				published++;
+			}
+			double elapsed = (ros::WallTime::now() - start).toSec();
+			ROS_INFO("Blackfly Replay: Replayed %zu frames in %.2f s (%.1f fps)", published, elapsed, elapsed > 0.0 ? published / elapsed : 0.0);
+		} while (m_loop && !m_stop && ros::ok());
+		for (size_t i = 0; i < m_cameras.size(); i++)
+		{
+			if (m_cameras[i].skipped > 0)
+			{
+				ROS_WARN("Blackfly Replay: Skipped %lu frames of camera %s missing from their segments or in an unknown encoding", (unsigned long)m_cameras[i].skipped, m_cameras[i].cam_name.c_str());
+			}
+		}
+	}
+
+	// Hands one recorded frame to the camera's image event handler, which publishes it like a live frame with its recorded stamp:
+	// metadata, the camera topic, the colour, mono, pyramid and jpeg outputs, and the payload loaned straight from the segment mapping.
+	void replay_nodelet::publish_frame(replay_camera &camera, size_t frame)
+	{
+		const recorded_frame &record = camera.reader_ptr->frame(frame);
+		PixelFormatEnums format;
+		std::string setting;
+		if (!pixel_format_of(std::string(record.encoding, strnlen(record.encoding, sizeof(record.encoding))), format, setting))
+		{
+			camera.skipped++;
+			return;
+		}
+		boost::shared_ptr<MappedSegment> mapping;
+		const uint8_t *payload = camera.reader_ptr->payload(frame, mapping);
+		if (payload == nullptr)
+		{
+			camera.skipped++;
+			return;
+		}
+		ros::Time stamp;
+		if (m_restamp)
+		{
+			stamp = ros::Time::now();
+		}
+		else
+		{
+			stamp.fromNSec(uint64_t(record.stamp_ns));
+		}
+		boost::shared_ptr<RecordedFrame> recorded = camera.frame_pool_ptr->acquire();
+		recorded->assign(record, payload, mapping, format, stamp);
+		camera.image_event_handler_ptr->handle_frame(recorded);
+		camera.reader_ptr->release_before(frame);
+	}
+} // namespace blackfly